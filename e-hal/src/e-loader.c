@@ -26,14 +26,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <err.h>
+#include <errno.h>
 #include <elf.h>
 
 #include "e-loader.h"
@@ -70,17 +73,30 @@ struct loader_cfg {
 	uint32_t __pad2;
 } __attribute__((packed));
 
+// TODO: These should be defined in common header file
+#define OVERLAY_IDLE_TIMEOUT_MS 1000
+struct overlay_cfg {
+	uint32_t base;
+	uint32_t size;
+	uint32_t seq;
+	uint32_t done;
+	uint32_t entry;
+	uint32_t __pad;
+} __attribute__((packed));
+
 static void lookup_sections(const void *file, struct section_info *tbl,
 							size_t tbl_size);
 
 extern void ee_get_coords_from_id(e_epiphany_t *dev, unsigned coreid,
 								  unsigned *row, unsigned *col);
 
+static bool ee_elf_emem_extent(const void *file, off_t *lo, off_t *hi);
+
 static e_return_stat_t ee_process_elf(const void *file, e_epiphany_t *dev,
 									  e_mem_t *emem, int row, int col);
 
 static int ee_set_core_config(struct section_info *tbl, e_epiphany_t *dev,
-							  e_mem_t *emem, int row, int col);
+							  int row, int col);
 
 e_loader_diag_t e_load_verbose = L_D0;
 
@@ -143,6 +159,8 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 	struct stat  st;
 	void        *file;
 	bool         is_srec = false;
+	bool         has_emem = false;
+	off_t        emem_lo, emem_hi;
 	e_return_stat_t retval;
 
 	struct section_info tbl[] = {
@@ -150,6 +168,7 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 		{ .name = "ext_mem_cfg" },
 		{ .name = "loader_cfg" },
 	};
+	struct section_info ovl = { .name = "overlay_cfg" };
 
 
 #ifndef ESIM_TARGET
@@ -166,25 +185,15 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 		return E_ERR;
 	}
 
-	// Allocate External DRAM for the epiphany executable code
-	// TODO: this is barely scalable. Really need to test ext. mem size to load
-	// and possibly split the ext. mem accesses into 1MB chunks.
-	if (e_alloc(&emem, 0, EMEM_SIZE)) {
-		warnx("\nERROR: Can't allocate external memory buffer!\n\n");
-		return E_ERR;
-	}
-
 	fd = open(executable, O_RDONLY);
 	if (fd == -1) {
 		warnx("ERROR: Can't open executable file \"%s\".\n", executable);
-		e_free(&emem);
 		return E_ERR;
 	}
 
 	if (fstat(fd, &st) == -1) {
 		warnx("ERROR: Can't stat file \"%s\".\n", executable);
 		close(fd);
-		e_free(&emem);
 		return E_ERR;
     }
 
@@ -192,7 +201,6 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 	if (file == MAP_FAILED) {
 		warnx("ERROR: Can't mmap file \"%s\".\n", executable);
 		close(fd);
-		e_free(&emem);
 		return E_ERR;
     }
 
@@ -208,6 +216,20 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 		goto out;
 	}
 
+	// Allocate External DRAM for the epiphany executable code. Only the
+	// range the ELF segments occupy is mapped; SREC files are not parsed
+	// up front, so they get the whole segment.
+	emem_lo = 0;
+	emem_hi = EMEM_SIZE;
+	if (is_srec || ee_elf_emem_extent(file, &emem_lo, &emem_hi)) {
+		if (e_alloc(&emem, emem_lo, emem_hi - emem_lo)) {
+			warnx("\nERROR: Can't allocate external memory buffer!\n\n");
+			status = E_ERR;
+			goto out;
+		}
+		has_emem = true;
+	}
+
 	if (is_srec) {
 		/* No symbol info in SREC files, use hard coded values */
 		tbl[SEC_WORKGROUP_CFG].present = true;
@@ -218,8 +240,13 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 		tbl[SEC_LOADER_CFG].sh_addr    = 0x58;
 	} else {
 		lookup_sections(file, tbl, ARRAY_SIZE(tbl));
+		lookup_sections(file, &ovl, 1);
 	}
 
+	// The ldfs always place it, it describes a region (size != 0) only in
+	// programs that host overlays. Older ldfs do not have it at all.
+	dev->overlay_cfg = ovl.present ? ovl.sh_addr : 0;
+
 	for (i = 0; i < SEC_NUM; i++) {
 		if (!tbl[i].present) {
 			warnx("e_load_group(): WARNING: %s section not in binary.",
@@ -242,7 +269,7 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 				goto out;
 			}
 
-			ee_set_core_config(tbl, dev, &emem, irow, icol);
+			ee_set_core_config(tbl, dev, irow, icol);
 		}
 	}
 
@@ -264,7 +291,8 @@ int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsign
 out:
 	munmap(file, st.st_size);
 	close(fd);
-	e_free(&emem);
+	if (has_emem)
+		e_free(&emem);
 
 	return status;
 }
@@ -303,7 +331,7 @@ static void lookup_sections(const void *file, struct section_info *tbl,
 }
 
 static int ee_set_core_config(struct section_info *tbl, e_epiphany_t *pEpiphany,
-							  e_mem_t *pEMEM, int row, int col)
+							  int row, int col)
 {
 	e_group_config_t e_group_config;
 	e_emem_config_t  e_emem_config;
@@ -324,7 +352,7 @@ static int ee_set_core_config(struct section_info *tbl, e_epiphany_t *pEpiphany,
 	e_group_config.alignment_padding = 0xdeadbeef;
 
 	e_emem_config.objtype   = E_EXT_MEM;
-	e_emem_config.base      = pEMEM->ephy_base;
+	e_emem_config.base      = e_platform.emem[0].ephy_base;
 
 	if (tbl[SEC_WORKGROUP_CFG].present)
 		e_write(pEpiphany, row, col, tbl[SEC_WORKGROUP_CFG].sh_addr,
@@ -342,6 +370,182 @@ static int ee_set_core_config(struct section_info *tbl, e_epiphany_t *pEpiphany,
 }
 
 
+static unsigned long long overlay_now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Wait until no overlay runs on the core, then return its configuration.
+ * Fails with errno ENOEXEC if the core has no overlay region and with
+ * ETIMEDOUT if the overlay did not return in time. */
+static int overlay_idle(e_epiphany_t *dev, unsigned row, unsigned col,
+						struct overlay_cfg *cfg, unsigned timeout_ms)
+{
+	unsigned long long deadline = overlay_now_ms() + timeout_ms;
+
+	while (1) {
+		if (sizeof(*cfg) != e_read(dev, row, col, dev->overlay_cfg, cfg, sizeof(*cfg)))
+			return E_ERR;
+		if (!cfg->size) {
+			errno = ENOEXEC;
+			return E_ERR;
+		}
+		if (cfg->seq == cfg->done)
+			return E_OK;
+		if (timeout_ms && overlay_now_ms() >= deadline) {
+			errno = ETIMEDOUT;
+			return E_ERR;
+		}
+		usleep(10);
+	}
+}
+
+int e_overlay_wait(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols, unsigned timeout_ms)
+{
+	struct overlay_cfg cfg;
+	unsigned irow, icol;
+
+	if (!dev || !dev->overlay_cfg) {
+		warnx("e_overlay_wait(): The loaded program does not host overlays.");
+		return E_ERR;
+	}
+
+	for (irow = row; irow < row + rows; irow++)
+		for (icol = col; icol < col + cols; icol++)
+			if (E_OK != overlay_idle(dev, irow, icol, &cfg, timeout_ms)) {
+				if (ENOEXEC == errno)
+					warnx("e_overlay_wait(): Core (%u,%u) does not host overlays.", irow, icol);
+				return E_ERR;
+			}
+
+	return E_OK;
+}
+
+int e_load_overlay(const char *overlay, e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols)
+{
+	struct overlay_cfg cfg;
+	Elf32_Ehdr *ehdr;
+	Elf32_Phdr *phdr;
+	unsigned    irow, icol;
+	int         ihdr, fd;
+	int         status = E_OK;
+	size_t      zeros_size = 0;
+	void       *zeros = NULL;
+	struct stat st;
+	uint8_t    *file;
+
+	if (!dev || !dev->overlay_cfg) {
+		warnx("e_load_overlay(): The loaded program does not host overlays.");
+		return E_ERR;
+	}
+
+	fd = open(overlay, O_RDONLY);
+	if (fd == -1) {
+		warnx("ERROR: Can't open overlay file \"%s\".\n", overlay);
+		return E_ERR;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		warnx("ERROR: Can't stat file \"%s\".\n", overlay);
+		close(fd);
+		return E_ERR;
+	}
+
+	file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (file == MAP_FAILED) {
+		warnx("ERROR: Can't mmap file \"%s\".\n", overlay);
+		close(fd);
+		return E_ERR;
+	}
+
+	ehdr = (Elf32_Ehdr *) file;
+	if (!is_epiphany_exec_elf(ehdr)) {
+		warnx("ERROR: Overlay \"%s\" is not an Epiphany ELF executable.\n", overlay);
+		status = E_ERR;
+		goto out;
+	}
+	phdr = (Elf32_Phdr *) &file[ehdr->e_phoff];
+
+	// The .bss parts of the segments are cleared from one zero buffer
+	for (ihdr = 0; ihdr < ehdr->e_phnum; ihdr++) {
+		if (phdr[ihdr].p_filesz > phdr[ihdr].p_memsz ||
+			(off_t) phdr[ihdr].p_offset > st.st_size ||
+			phdr[ihdr].p_filesz > st.st_size - phdr[ihdr].p_offset) {
+			warnx("ERROR: Overlay \"%s\" has a malformed segment.\n", overlay);
+			status = E_ERR;
+			goto out;
+		}
+		if (phdr[ihdr].p_memsz - phdr[ihdr].p_filesz > zeros_size)
+			zeros_size = phdr[ihdr].p_memsz - phdr[ihdr].p_filesz;
+	}
+	if (zeros_size && !(zeros = calloc(1, zeros_size))) {
+		status = E_ERR;
+		goto out;
+	}
+
+	for (irow = row; irow < row + rows; irow++) {
+		for (icol = col; icol < col + cols; icol++) {
+			if (E_OK != overlay_idle(dev, irow, icol, &cfg, OVERLAY_IDLE_TIMEOUT_MS)) {
+				if (ENOEXEC == errno)
+					warnx("e_load_overlay(): Core (%u,%u) does not host overlays.", irow, icol);
+				else
+					warnx("e_load_overlay(): Core (%u,%u) is still running an overlay.", irow, icol);
+				status = E_ERR;
+				goto out;
+			}
+
+			// Everything must go into the region, the rest belongs to
+			// the resident program
+			for (ihdr = 0; ihdr < ehdr->e_phnum; ihdr++) {
+				if (!phdr[ihdr].p_memsz)
+					continue;
+				if (phdr[ihdr].p_vaddr < cfg.base ||
+					phdr[ihdr].p_vaddr + phdr[ihdr].p_memsz > cfg.base + cfg.size) {
+					warnx("e_load_overlay(): Segment at 0x%08x is outside of the overlay region 0x%08x-0x%08x of core (%u,%u).",
+						  phdr[ihdr].p_vaddr, cfg.base, cfg.base + cfg.size, irow, icol);
+					status = E_ERR;
+					goto out;
+				}
+			}
+			if (ehdr->e_entry < cfg.base || ehdr->e_entry >= cfg.base + cfg.size) {
+				warnx("e_load_overlay(): Entry point 0x%08x is outside of the overlay region.", ehdr->e_entry);
+				status = E_ERR;
+				goto out;
+			}
+
+			for (ihdr = 0; ihdr < ehdr->e_phnum; ihdr++) {
+				if (!phdr[ihdr].p_memsz)
+					continue;
+				diag(L_D3) { fprintf(diag_fd, "e_load_overlay(): copying %d bytes to 0x%08x of core (%u,%u)\n",
+									 phdr[ihdr].p_filesz, phdr[ihdr].p_vaddr, irow, icol); }
+				e_write(dev, irow, icol, phdr[ihdr].p_vaddr, &file[phdr[ihdr].p_offset], phdr[ihdr].p_filesz);
+				if (phdr[ihdr].p_memsz > phdr[ihdr].p_filesz)
+					e_write(dev, irow, icol, phdr[ihdr].p_vaddr + phdr[ihdr].p_filesz, zeros,
+							phdr[ihdr].p_memsz - phdr[ihdr].p_filesz);
+			}
+
+			// The core starts the overlay once it sees seq move
+			cfg.entry = ehdr->e_entry;
+			cfg.seq++;
+			e_write(dev, irow, icol, dev->overlay_cfg + offsetof(struct overlay_cfg, entry), &cfg.entry, sizeof(cfg.entry));
+			e_write(dev, irow, icol, dev->overlay_cfg + offsetof(struct overlay_cfg, seq), &cfg.seq, sizeof(cfg.seq));
+		}
+	}
+
+	diag(L_D1) { fprintf(diag_fd, "e_load_overlay(): started %s\n", overlay); }
+
+out:
+	free(zeros);
+	munmap(file, st.st_size);
+	close(fd);
+
+	return status;
+}
+
+
 e_loader_diag_t e_set_loader_verbosity(e_loader_diag_t verbose)
 {
 	e_loader_diag_t old_load_verbose;
@@ -377,6 +581,42 @@ static bool is_valid_range(uint32_t from, uint32_t size)
 	return is_valid_addr(from) && is_valid_addr(from + size - 1);
 }
 
+/* Offsets into the first external memory segment of the data the ELF
+ * segments put there. Returns false if there is none. */
+static bool ee_elf_emem_extent(const void *file, off_t *lo, off_t *hi)
+{
+	Elf32_Ehdr *ehdr;
+	Elf32_Phdr *phdr;
+	int        ihdr;
+	off_t      from, to;
+	bool       found = false;
+	uint8_t   *src = (uint8_t *) file;
+
+	ehdr = (Elf32_Ehdr *) &src[0];
+	phdr = (Elf32_Phdr *) &src[ehdr->e_phoff];
+
+	for (ihdr = 0; ihdr < ehdr->e_phnum; ihdr++) {
+		if (!phdr[ihdr].p_filesz
+			|| !e_is_addr_in_emem(phdr[ihdr].p_vaddr)
+			|| !is_valid_range(phdr[ihdr].p_vaddr, phdr[ihdr].p_memsz))
+			continue;
+
+		from = phdr[ihdr].p_vaddr - e_platform.emem[0].ephy_base;
+		to   = from + phdr[ihdr].p_filesz;
+		if (!found || from < *lo)
+			*lo = from;
+		if (!found || to > *hi)
+			*hi = to;
+		found = true;
+	}
+
+	diag(L_D2) {
+		if (found)
+			fprintf(diag_fd, "ee_elf_emem_extent(): external memory 0x%08x - 0x%08x\n",
+					(uint) *lo, (uint) *hi); }
+
+	return found;
+}
 
 static e_return_stat_t
 ee_process_elf(const void *file, e_epiphany_t *dev, e_mem_t *emem,
@@ -405,8 +645,10 @@ ee_process_elf(const void *file, e_epiphany_t *dev, e_mem_t *emem,
 	}
 
 	for (ihdr = 0; ihdr < ehdr->e_phnum; ihdr++) {
-		/* Nothing to do if section is empty */
-		if (!phdr[ihdr].p_memsz)
+		/* Nothing to copy if section is empty or bss only. External
+		 * memory is only mapped where segments have data, so dst must
+		 * not be computed for the others. */
+		if (!phdr[ihdr].p_filesz)
 			continue;
 
 		islocal = is_local(phdr[ihdr].p_vaddr);
@@ -44,6 +44,31 @@ typedef enum {
 int e_load(const char *executable, e_epiphany_t *dev, unsigned row, unsigned col, e_bool_t start);
 int e_load_group(const char *executable, e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols, e_bool_t start);
 
+/**
+ * Load the code and data of an overlay into the overlay region of cores
+ * that run a resident program idling in the e-lib e_overlay_run(), and
+ * start it. Only the overlay's segments are written; the resident program,
+ * its configuration and the rest of local memory are left alone. The
+ * overlay must be an ELF executable linked to load into the region.
+ *
+ * Waits for a previous overlay to return first.
+ *
+ * @return E_OK on success, E_ERR if a core has no overlay region or is
+ * not idle, or the overlay does not fit into its region.
+ */
+int e_load_overlay(const char *overlay, e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols);
+
+/**
+ * Wait until the overlays started on the cores returned.
+ *
+ * @param timeout_ms - give up after this long, 0 to wait forever
+ *
+ * @return E_OK when all cores are idle, E_ERR otherwise. errno is
+ * ETIMEDOUT if an overlay did not return in time and ENOEXEC if a core
+ * has no overlay region.
+ */
+int e_overlay_wait(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigned cols, unsigned timeout_ms);
+
 e_loader_diag_t e_set_loader_verbosity(e_loader_diag_t verbose);
 
 #ifdef __cplusplus
@@ -0,0 +1,163 @@
+/*
+ * Host memory emulation of an Epiphany platform (EHAL_TARGET=emu).
+ *
+ * The SRAM and register file of every core and the first external memory
+ * segment live in one shared anonymous mapping, so forked processes see
+ * the same "chip". Nothing executes on the emulated cores: the backend is
+ * meant for benchmarking and regression testing the host side (the e-hal
+ * access paths, the loader and the shm manager) on any Linux machine.
+ *
+ * All physical addresses the e-hal would mmap() from the driver are
+ * translated by emu_map(), after which the native access functions work
+ * unchanged on plain memory. Like on the chip every core owns a 1MB window
+ * and the windows of a row are adjacent, so a whole row can be mapped at
+ * once; only the touched pages of the windows are ever backed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <err.h>
+#include "emu-target.h"
+
+#define EMU_CORE_SPACE	(1 << 20)	// address window of a core
+
+static struct {
+	uint8_t		*base;        // the whole mapping
+	size_t		 size;
+	unsigned	 row, col;    // first core of the platform
+	unsigned	 rows, cols;
+	off_t		 regs_base;   // offset of the register file in a core's window
+	size_t		 regs_size;
+	off_t		 emem_phy;    // host side address of the external memory
+	size_t		 emem_size;
+	uint8_t		*emem;
+} emu;
+
+bool emu_target_p()
+{
+	static bool initialized = false;
+	static bool emu_p = false;
+	const char *p;
+
+	if (!initialized) {
+		p = getenv(EHAL_TARGET_ENV);
+		emu_p = (p && strncmp(p, "emu", sizeof("emu")) == 0);
+		initialized = true;
+	}
+
+	return emu_p;
+}
+
+int emu_default_platform(e_platform_t *platform)
+{
+	const char *chip = getenv(EMU_CHIP_ENV);
+
+	if (!chip)
+		chip = EMU_DEFAULT_CHIP;
+
+	strncpy(platform->version, "EMULATOR", sizeof(platform->version));
+
+	platform->num_chips = 1;
+	platform->chip = (e_chip_t *) calloc(1, sizeof(e_chip_t));
+
+	platform->num_emems = 1;
+	platform->emem = (e_memseg_t *) calloc(1, sizeof(e_memseg_t));
+
+	if (!platform->chip || !platform->emem)
+		return E_ERR;
+
+	/* Same layout as a Parallella board */
+	strncpy(platform->chip[0].version, chip, sizeof(platform->chip[0].version) - 1);
+	platform->chip[0].row = 32;
+	platform->chip[0].col = 8;
+
+	platform->emem[0].phy_base  = 0x3e000000;
+	platform->emem[0].ephy_base = 0x8e000000;
+	platform->emem[0].size      = 0x02000000;
+	platform->emem[0].type      = E_RDWR;
+
+	return E_OK;
+}
+
+int emu_init(const e_platform_t *platform)
+{
+	if (!platform->num_chips || !platform->num_emems) {
+		warnx("emu_init(): The platform has no chips or no external memory.");
+		return E_ERR;
+	}
+
+	emu.row       = platform->row;
+	emu.col       = platform->col;
+	emu.rows      = platform->rows;
+	emu.cols      = platform->cols;
+	emu.regs_base = platform->chip[0].regs_base;
+	emu.regs_size = platform->chip[0].regs_size;
+	emu.emem_phy  = platform->emem[0].phy_base;
+	emu.emem_size = platform->emem[0].size;
+
+	/* Pages are only backed once they are touched */
+	emu.size = (size_t) EMU_CORE_SPACE * emu.rows * emu.cols + emu.emem_size;
+	emu.base = mmap(NULL, emu.size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (emu.base == MAP_FAILED) {
+		warnx("emu_init(): Failed to map %zu bytes of emulated memory.", emu.size);
+		emu.base = NULL;
+		return E_ERR;
+	}
+	emu.emem = emu.base + (size_t) EMU_CORE_SPACE * emu.rows * emu.cols;
+
+	return emu_reset();
+}
+
+void emu_finalize()
+{
+	if (emu.base)
+		munmap(emu.base, emu.size);
+	emu.base = NULL;
+}
+
+void *emu_map(off_t phy_addr, size_t size)
+{
+	unsigned row, col;
+	off_t    off;
+
+	if (!emu.base)
+		return NULL;
+
+	if (phy_addr >= emu.emem_phy && phy_addr + size <= emu.emem_phy + emu.emem_size)
+		return emu.emem + (phy_addr - emu.emem_phy);
+
+	row = (phy_addr >> 26) & 0x3f;
+	col = (phy_addr >> 20) & 0x3f;
+	if (row < emu.row || row >= emu.row + emu.rows || col < emu.col || col >= emu.col + emu.cols)
+		return NULL;
+
+	// The range may span the windows of several cores, but not of two rows
+	off = (off_t) (col - emu.col) * EMU_CORE_SPACE + (phy_addr & (EMU_CORE_SPACE - 1));
+	if (off + size > (size_t) emu.cols * EMU_CORE_SPACE)
+		return NULL;
+
+	return emu.base + (size_t) (row - emu.row) * emu.cols * EMU_CORE_SPACE + off;
+}
+
+int emu_reset()
+{
+	unsigned row, col;
+	uint8_t *regs;
+
+	if (!emu.base)
+		return E_ERR;
+
+	for (row = 0; row < emu.rows; row++)
+		for (col = 0; col < emu.cols; col++) {
+			regs = emu.base + (size_t) (row * emu.cols + col) * EMU_CORE_SPACE + emu.regs_base;
+			memset(regs, 0, emu.regs_size);
+			/* The read-only COREID register */
+			*(uint32_t *) (regs + (E_REG_COREID - E_REG_R0)) =
+				((emu.row + row) << 6) | (emu.col + col);
+		}
+
+	return E_OK;
+}
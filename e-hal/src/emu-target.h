@@ -0,0 +1,29 @@
+#ifndef __EHAL_EMU_H
+#define __EHAL_EMU_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "epiphany-hal-data.h"
+
+/* Chip emulated when no HDF is given, override with EHAL_EMU_CHIP */
+#define EMU_CHIP_ENV		"EHAL_EMU_CHIP"
+#define EMU_DEFAULT_CHIP	"E16G301"
+
+extern bool emu_target_p();
+
+/* Describe the emulated board (one chip, one external memory segment) */
+extern int emu_default_platform(e_platform_t *platform);
+
+/* Create / drop the host memory that backs the platform */
+extern int emu_init(const e_platform_t *platform);
+extern void emu_finalize();
+
+/* Host pointer to size bytes at a physical (host side) address, or NULL */
+extern void *emu_map(off_t phy_addr, size_t size);
+
+/* Clear the register files of all cores */
+extern int emu_reset();
+
+#endif
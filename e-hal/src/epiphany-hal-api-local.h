@@ -62,6 +62,12 @@ ssize_t  ee_mwrite_buf(e_mem_t *mbuf, off_t to_addr, const void *buf, size_t siz
 int      ee_reset_core(e_epiphany_t *dev, unsigned row, unsigned col);
 
 
+//////////////////
+// Workgroup leases
+int      ee_lease_check(unsigned row, unsigned col, unsigned rows, unsigned cols);
+unsigned ee_lease_others(void);
+
+
 ////////////////////
 // Utility functions
 unsigned ee_get_num_from_id(e_epiphany_t *dev, unsigned coreid);
@@ -70,6 +76,7 @@ unsigned ee_get_id_from_num(e_epiphany_t *dev, unsigned corenum);
 void     ee_get_coords_from_id(e_epiphany_t *dev, unsigned coreid, unsigned *row, unsigned *col);
 int      ee_set_platform_params(e_platform_t *platform);
 int      ee_set_chip_params(e_chip_t *dev);
+const char *ee_chip_version(unsigned arch, unsigned rows, unsigned cols);
 int      ee_parse_hdf(e_platform_t *dev, char *hdf);
 int      ee_parse_simple_hdf(e_platform_t *dev, char *hdf);
 int      ee_parse_xml_hdf(e_platform_t *dev, char *hdf);
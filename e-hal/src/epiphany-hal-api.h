@@ -38,6 +38,13 @@ extern "C"
 /////////////////////////////////
 // Device communication functions
 //
+// Thread safety: e_init() and e_finalize() are reference counted and may
+// be called from any thread; the platform is set up by the first e_init()
+// and stays unchanged until the last e_finalize(). Different threads may
+// use different e_epiphany_t/e_mem_t handles at the same time, and the
+// shared memory functions may be called from any thread. A single handle
+// must not be opened, closed or freed while another thread uses it.
+//
 // Platform configuration
 int		e_init(char *hdf);
 int		e_get_platform_info(e_platform_t *platform);
@@ -53,6 +60,10 @@ int		e_free(e_mem_t *mbuf);
 // Data transfer
 ssize_t e_read(void *dev, unsigned row, unsigned col, off_t from_addr, void *buf, size_t size);
 ssize_t e_write(void *dev, unsigned row, unsigned col, off_t to_addr, const void *buf, size_t size);
+//
+// Multicast
+int		e_set_multicast(e_epiphany_t *dev, unsigned mcast_id);
+ssize_t e_multicast_write(e_epiphany_t *dev, off_t to_addr, const void *buf, size_t size);
 
 
 ///////////////////////////
@@ -67,6 +78,33 @@ int		e_signal(e_epiphany_t *dev, unsigned row, unsigned col);
 int		e_halt(e_epiphany_t *dev, unsigned row, unsigned col);
 int		e_resume(e_epiphany_t *dev, unsigned row, unsigned col);
 
+////////////////////////////////
+// Workgroup reservation functions
+
+/**
+ * Lease a free workgroup of rows x cols cores, open it and reset its
+ * cores. The workgroup is placed where it leaves the free cores in the
+ * largest pieces. Other processes cannot e_open() leased cores or
+ * e_reset_system() the chip until the lease is released with
+ * e_release_group() or the process exits.
+ *
+ * The leases are kept in the file named by EPIPHANY_LEASES, by default
+ * /run/epiphany/leases. Its directory must exist, belong to the group of
+ * the users that share the board and not be writable by others; without
+ * it there are no leases.
+ *
+ * @return E_OK on success, E_ERR on failure. errno is EBUSY if no free
+ * workgroup of that size exists.
+ */
+int		e_reserve_group(e_epiphany_t *dev, unsigned rows, unsigned cols);
+
+/**
+ * Close a workgroup opened with e_reserve_group() and drop its lease.
+ *
+ * @return E_OK on success, E_ERR if the workgroup was not leased.
+ */
+int		e_release_group(e_epiphany_t *dev);
+
 ////////////////////////////////////////////
 // Shared Memory Manager function prototypes
 
@@ -117,6 +155,228 @@ int e_shm_release(const char *name);
  */
 e_shmtable_t* e_shm_get_shmtable(void);
 
+/////////////////////////////////////////
+// Host <-> eCore streaming queue functions
+
+/**
+ * Allocate a single-producer/single-consumer queue in a named shared
+ * memory region. The eCore side attaches to it by name with the e-lib
+ * e_queue_attach().
+ *
+ * @param q - the queue handle to initialize
+ * @param name - the shared region name
+ * @param dir - E_QUEUE_H2D if the host pushes, E_QUEUE_D2H if it pops
+ * @param item_size - size of a single item in bytes
+ * @param capacity - number of items, rounded up to a power of two
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_queue_alloc(e_queue_t *q, const char *name, e_queue_dir_t dir,
+					  size_t item_size, unsigned capacity);
+
+/**
+ * Attach to a queue previously allocated with e_queue_alloc().
+ *
+ * @return E_OK on success, E_ERR if no valid queue exists with name.
+ */
+int		e_queue_attach(e_queue_t *q, const char *name);
+
+/**
+ * Drop the reference to the queue's shared region.
+ */
+int		e_queue_release(e_queue_t *q);
+
+/**
+ * Push up to n items into an E_QUEUE_H2D queue. Never blocks.
+ *
+ * @return the number of items actually queued.
+ */
+unsigned e_queue_push(e_queue_t *q, const void *items, unsigned n);
+
+/**
+ * Pop up to n items from an E_QUEUE_D2H queue. Never blocks.
+ *
+ * @return the number of items actually copied into items.
+ */
+unsigned e_queue_pop(e_queue_t *q, void *items, unsigned n);
+
+/**
+ * Return the number of items currently held by the queue.
+ */
+unsigned e_queue_count(e_queue_t *q);
+
+//////////////////////////
+// Task runtime
+
+/**
+ * Load a task server program into every core of a workgroup and start it.
+ * The program registers its kernels with the e-lib e_task_register() and
+ * then calls e_task_serve(), so the kernels stay resident and each task
+ * only costs a descriptor write.
+ *
+ * @param rt - the runtime to initialize
+ * @param dev - the workgroup to run the tasks on
+ * @param executable - the task server program
+ * @param batch - most tasks posted to a core at once, 0 for E_TASK_SLOTS
+ *
+ * @return E_OK on success, E_ERR if the program could not be loaded or a
+ * core did not start serving.
+ */
+int		e_task_init(e_task_rt_t *rt, e_epiphany_t *dev, const char *executable, unsigned batch);
+
+/**
+ * Queue a task. Tasks queued for a core may still run on another core
+ * that runs out of work.
+ *
+ * @param core - core number in the workgroup, or E_TASK_ANY for the core
+ * with the least work
+ * @param kernel - kernel ID
+ * @param args - nargs (at most E_TASK_NUM_ARGS) kernel arguments
+ * @param ret - where to store the kernel's return value, or NULL
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_task_submit(e_task_rt_t *rt, int core, unsigned kernel,
+					  const uint32_t *args, unsigned nargs, int32_t *ret);
+
+/**
+ * Collect finished tasks and hand queued ones to cores with free mailbox
+ * slots. Never blocks.
+ *
+ * @return the number of tasks not finished yet.
+ */
+unsigned e_task_poll(e_task_rt_t *rt);
+
+/**
+ * Run e_task_poll() until all submitted tasks are finished.
+ *
+ * @param timeout_ms - give up after this long, 0 to wait forever
+ *
+ * @return E_OK when all tasks finished, E_ERR with errno ETIMEDOUT if not.
+ */
+int		e_task_wait(e_task_rt_t *rt, unsigned timeout_ms);
+
+/**
+ * Stop the task servers, reset the workgroup and release the runtime.
+ * Tasks that have not finished are dropped.
+ */
+int		e_task_finalize(e_task_rt_t *rt);
+
+//////////////////////////
+// Platform descriptions
+
+/**
+ * Load a platform description. The file may be a text HDF, an XML HDF or
+ * a description compiled with e_hdf_save(). The format is recognized by
+ * the contents. A compiled description is mapped and checked without
+ * being parsed.
+ *
+ * @return the description, to be released with e_hdf_free(), or NULL on
+ * failure.
+ */
+e_hdf_t *e_hdf_load(const char *hdf);
+
+/**
+ * Write a description in the compiled format, which e_hdf_load() and
+ * e_init() read much faster than the text formats.
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_hdf_save(const e_hdf_t *desc, const char *path);
+
+/**
+ * Release a description returned by e_hdf_load().
+ */
+void	e_hdf_free(e_hdf_t *desc);
+
+//////////////////////////
+// Core to host messages
+
+/**
+ * Set up the receiving end of the messages the cores send with the e-lib
+ * e_mailbox_post(). One process per platform should have it open.
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_mailbox_open(e_mailbox_t *mb);
+
+/**
+ * Close the mailbox and release its shared region.
+ */
+int		e_mailbox_close(e_mailbox_t *mb);
+
+/**
+ * Return a file descriptor that poll()/epoll report readable when
+ * messages are pending, or -1 if the platform has no mailbox and the
+ * messages go through shared memory.
+ */
+int		e_mailbox_fd(e_mailbox_t *mb);
+
+/**
+ * Return the number of pending messages.
+ */
+int		e_mailbox_count(e_mailbox_t *mb);
+
+/**
+ * Read up to n pending messages, waiting for the first one for at most
+ * timeout_ms (0 does not wait, -1 waits forever). Without a mailbox the
+ * wait spins for a while and then sleeps, so it does not keep a host CPU
+ * busy.
+ *
+ * @return the number of messages read, or E_ERR on failure.
+ */
+int		e_mailbox_read(e_mailbox_t *mb, e_mailbox_msg_t *msgs, unsigned n, int timeout_ms);
+
+//////////////////////////
+// Core state snapshots
+
+/**
+ * Capture the registers (including the DMA state) and the local memory
+ * of every core of a workgroup. The cores are read by several threads
+ * in parallel and are not halted.
+ *
+ * @param dev - the workgroup to capture
+ * @param snap - filled in, release it with e_snapshot_free()
+ * @param sram_size - bytes of local memory per core, 0 for all of it
+ * @param threads - number of capture threads, 0 for one per core
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_snapshot_capture(e_epiphany_t *dev, e_snapshot_t *snap, size_t sram_size, unsigned threads);
+
+/**
+ * Write a snapshot to a file. Zero filled pages of local memory are
+ * left out of the file.
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_snapshot_save(e_snapshot_t *snap, const char *path);
+
+/**
+ * Read a snapshot written by e_snapshot_save().
+ *
+ * @return E_OK on success, E_ERR on failure.
+ */
+int		e_snapshot_load(e_snapshot_t *snap, const char *path);
+
+/**
+ * Release the memory held by a snapshot.
+ */
+void	e_snapshot_free(e_snapshot_t *snap);
+
+/**
+ * Return the core snapshot at (row, col) relative to the first core,
+ * or NULL if it is outside of the snapshot.
+ */
+e_core_snapshot_t *e_snapshot_core(e_snapshot_t *snap, unsigned row, unsigned col);
+
+/**
+ * Address and name of the idx-th special core register of a snapshot,
+ * idx < E_SNAPSHOT_NUM_SCRS.
+ */
+off_t	e_snapshot_scr_addr(unsigned idx);
+const char *e_snapshot_scr_name(unsigned idx);
+
 ////////////////////
 // Utility functions
 unsigned e_get_num_from_coords(e_epiphany_t *dev, unsigned row, unsigned col);
@@ -216,6 +216,11 @@ typedef struct {
 	int				 memfd;		  // for mmap
 
 	es_state		*esim;        // ESIM handle
+
+	void		   **row_map;     // one mapping per row of cores, NULL if mapped per core
+	size_t			 row_map_size; // size of each row mapping
+
+	off_t			 overlay_cfg; // local address of the loaded program's overlay_cfg, 0 if none
 } e_epiphany_t;
 
 
@@ -236,6 +241,222 @@ typedef struct {
 
 #define ALIGN(x)	__attribute__ ((aligned (x)))
 
+
+// Streaming queue shared by the host and the eCores. The header lives at
+// the start of a shared memory region, followed by the item storage.
+// NOTE: This layout must match e_queue_hdr_t in the e-lib e_queue.h.
+#define E_QUEUE_MAGIC     0x5155e001
+#define E_QUEUE_LINE_SIZE 64
+
+typedef enum {
+	E_QUEUE_H2D = 0,          // host produces, eCore consumes
+	E_QUEUE_D2H = 1,          // eCore produces, host consumes
+} e_queue_dir_t;
+
+typedef struct ALIGN(8) e_queue_hdr {
+	uint32_t		 magic;       // E_QUEUE_MAGIC once initialized
+	uint32_t		 dir;         // e_queue_dir_t
+	uint32_t		 item_size;   // size of a single item in bytes
+	uint32_t		 capacity;    // number of items, always a power of two
+	uint32_t		 data_offset; // offset of item storage from header
+	uint8_t			 __pad0[E_QUEUE_LINE_SIZE - 5 * sizeof(uint32_t)];
+	volatile uint32_t head;       // free-running write index, producer only
+	uint8_t			 __pad1[E_QUEUE_LINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t tail;       // free-running read index, consumer only
+	uint8_t			 __pad2[E_QUEUE_LINE_SIZE - sizeof(uint32_t)];
+} e_queue_hdr_t;
+
+typedef struct {
+	e_mem_t			 mem;         // shared memory region backing the queue
+	e_queue_hdr_t	*hdr;         // application space address of the header
+	uint8_t			*data;        // application space address of item storage
+	uint32_t		 item_size;   // size of a single item in bytes
+	uint32_t		 mask;        // capacity - 1
+	uint32_t		 head;        // local copy of the write index
+	uint32_t		 tail;        // local copy of the read index
+	char			 name[256];   // shared region name
+} e_queue_t;
+
+
+// Task runtime. Every core runs e_task_serve() from the e-lib and serves
+// a mailbox in its local memory; the host posts task descriptors into the
+// mailbox slots and the core runs them in order.
+// NOTE: These layouts must match the ones in the e-lib e_task.h.
+#define E_TASK_MAGIC       0x4b534154 // "TASK"
+#define E_TASK_SLOTS       8          // descriptors per mailbox, a power of two
+#define E_TASK_NUM_ARGS    6
+#define E_TASK_MAX_KERNELS 32
+#define E_TASK_SHM_NAME    "e_task_rt"
+#define E_TASK_NO_KERNEL   ((int32_t) 0x80000000)
+#define E_TASK_ANY         (-1)       // let the scheduler pick the core
+
+typedef struct ALIGN(8) e_task_desc {
+	uint32_t		  kernel;     // kernel ID given to e_task_register()
+	int32_t			  ret;        // return value of the kernel
+	uint32_t		  arg[E_TASK_NUM_ARGS];
+} e_task_desc_t;
+
+typedef struct ALIGN(8) e_task_mbox {
+	uint32_t		  magic;      // E_TASK_MAGIC once the core serves tasks
+	volatile uint32_t head;       // free-running count of posted tasks, host only
+	volatile uint32_t tail;       // free-running count of finished tasks, core only
+	uint32_t		  __pad;
+	e_task_desc_t	  slot[E_TASK_SLOTS];
+} e_task_mbox_t;
+
+typedef struct {
+	uint32_t		 kernel;
+	uint32_t		 arg[E_TASK_NUM_ARGS];
+	int32_t			*ret;         // where to store the result, or NULL
+} e_task_t;
+
+typedef struct {
+	off_t			 mbox;        // local address of the core's mailbox
+	e_task_t		*queue;       // tasks waiting for this core
+	unsigned		 qsize;       // queue capacity, a power of two
+	unsigned		 qhead;       // free-running, next task to post
+	unsigned		 qtail;       // free-running, end of the queue
+	unsigned		 head;        // tasks posted to the mailbox
+	unsigned		 tail;        // tasks finished, as last read
+	int32_t			*inflight[E_TASK_SLOTS]; // result pointers of posted tasks
+	uint64_t		 finished;    // tasks run by this core
+	uint64_t		 stolen;      // tasks taken from other cores' queues
+} e_task_core_t;
+
+typedef struct {
+	e_epiphany_t	*dev;
+	e_mem_t			 dir;         // shared region holding the mailbox addresses
+	unsigned		 num_cores;
+	unsigned		 batch;       // most tasks posted to a core at once
+	unsigned		 pending;     // submitted and not finished
+	e_task_core_t	*core;        // per core state, row major
+} e_task_rt_t;
+
+
+// Compiled platform description (HDF). e_hdf_load() returns the text and
+// XML formats in this layout as well. A file that is already in this
+// layout is mapped instead of parsed. The chip and memory segment arrays
+// follow the header, at chip_off and emem_off. The checksum covers
+// everything after the first E_HDF_PREAMBLE bytes.
+#define E_HDF_MAGIC	   0x46444845 // "EHDF"
+#define E_HDF_FORMAT   1
+#define E_HDF_PREAMBLE 32
+#define E_HDF_NO_IOREG (~0u)
+#define E_HDF_MAPPED   0x1        // flags: e_hdf_load() mapped the file
+#define E_HDF_CHIPS(h) ((const e_hdf_chip_t *) ((const char *) (h) + (h)->chip_off))
+#define E_HDF_EMEMS(h) ((const e_hdf_emem_t *) ((const char *) (h) + (h)->emem_off))
+
+typedef struct {
+	char			  version[32]; // chip version, e.g. "E16G301"
+	uint32_t		  arch;        // architecture generation
+	uint32_t		  row;         // chip absolute row number
+	uint32_t		  col;         // chip absolute col number
+	uint32_t		  rows;
+	uint32_t		  cols;
+	uint32_t		  sram_size;   // bytes of SRAM in each core
+	uint32_t		  host_base;   // base address of the host, 0 if not given
+	uint32_t		  ioreg_row;   // core with the I/O registers, or E_HDF_NO_IOREG
+	uint32_t		  ioreg_col;
+	uint32_t		  __pad;
+} e_hdf_chip_t;
+
+typedef struct {
+	char			  name[32];
+	uint32_t		  phy_base;    // base address as seen by the host
+	uint32_t		  ephy_base;   // base address as seen by the cores
+	uint32_t		  size;
+	uint32_t		  type;        // e_memtype_t
+} e_hdf_emem_t;
+
+typedef struct {
+	uint32_t		  magic;       // E_HDF_MAGIC
+	uint32_t		  format;      // E_HDF_FORMAT
+	uint32_t		  size;        // bytes in the whole description
+	uint32_t		  checksum;    // FNV-1a of the bytes after the preamble
+	uint32_t		  flags;       // only set in memory, 0 in files
+	uint32_t		  __pad[3];
+	uint32_t		  num_chips;
+	uint32_t		  num_emems;
+	uint32_t		  chip_off;
+	uint32_t		  emem_off;
+	char			  version[32]; // platform version, e.g. "PARALLELLA1601"
+	char			  name[64];    // platform name
+	char			  lib[64];     // library e-server drives the platform with
+	char			  libinitargs[128];
+} e_hdf_t;
+
+
+// Core to host messages. With a driver that has the e-link mailbox the
+// cores write the message to the mailbox register and the host reads it
+// with the mailbox ioctls. Otherwise every core has a single-producer ring
+// in the "e_mailbox" shared region. The region header tells the cores
+// which one to use.
+// NOTE: These layouts must match the ones in the e-lib e_mailbox.h.
+#define E_MAILBOX_MAGIC    0x584f424d // "MBOX"
+#define E_MAILBOX_SHM_NAME "e_mailbox"
+#define E_MAILBOX_RING     8          // messages per core ring, a power of two
+#define E_MAILBOX_HW_ADDR  0x810f0730 // e-link mailbox register
+
+typedef struct {
+	uint32_t		  from;       // core ID of the sender
+	uint32_t		  data;
+} e_mailbox_msg_t;
+
+typedef struct ALIGN(8) e_mailbox_ring {
+	volatile uint32_t head;       // free-running, written by the core
+	volatile uint32_t tail;       // free-running, written by the host
+	e_mailbox_msg_t	  msg[E_MAILBOX_RING];
+} e_mailbox_ring_t;
+
+typedef struct ALIGN(8) e_mailbox_hdr {
+	volatile uint32_t magic;      // E_MAILBOX_MAGIC once initialized
+	volatile uint32_t gen;        // changes each time the host opens the mailbox
+	uint32_t		  hw_addr;    // mailbox register to post to, 0 for the rings
+	uint32_t		  row;        // platform origin and size, one ring per core
+	uint32_t		  col;
+	uint32_t		  rows;
+	uint32_t		  cols;
+	e_mailbox_ring_t  ring[];
+} e_mailbox_hdr_t;
+
+typedef struct {
+	int				  fd;         // device with the mailbox, -1 for the rings
+	e_mem_t			  mem;        // shared region with the header and rings
+	e_mailbox_hdr_t	 *hdr;
+	unsigned		  num_rings;
+	unsigned		  next;       // ring to look at first
+	unsigned		  spins;      // polls before sleeping, adapted to the traffic
+} e_mailbox_t;
+
+
+// Core state snapshot. The special core registers are kept in the order
+// of e_snapshot_scr_addr(), which skips the holes of the register map.
+#define E_SNAPSHOT_MAGIC     0x50414e53 // "SNAP"
+#define E_SNAPSHOT_VERSION   1
+#define E_SNAPSHOT_NUM_GPRS  64
+#define E_SNAPSHOT_NUM_SCRS  42
+#define E_SNAPSHOT_PAGE_SIZE 256        // granularity of the zero page elision
+
+typedef struct {
+	unsigned		 row;         // row relative to the snapshot's first core
+	unsigned		 col;         // col relative to the snapshot's first core
+	unsigned		 id;          // core ID
+	uint32_t		 gpr[E_SNAPSHOT_NUM_GPRS];
+	uint32_t		 scr[E_SNAPSHOT_NUM_SCRS];
+	uint8_t			*sram;        // sram_size bytes of local memory
+} e_core_snapshot_t;
+
+typedef struct {
+	unsigned		 row;         // absolute row of the first core
+	unsigned		 col;         // absolute col of the first core
+	unsigned		 rows;        // number of rows captured
+	unsigned		 cols;        // number of cols captured
+	unsigned		 sram_size;   // bytes of local memory per core
+	uint32_t		 capture_us;  // time the capture took
+	uint64_t		 timestamp;   // start of the capture, usec since the epoch
+	e_core_snapshot_t *core;      // rows * cols cores, row major
+} e_snapshot_t;
+
 #define MAX_SHM_REGIONS				   64
 
 /*
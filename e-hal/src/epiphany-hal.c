@@ -30,10 +30,12 @@
 #include <string.h>
 #include <ctype.h>
 #include <err.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <pthread.h>
 
 /* Redesigned driver API */
 #include "epiphany2.h"
@@ -42,6 +44,7 @@
 #include "epiphany-shm-manager.h"	/* For private APIs */
 #include "epiphany-hal-api-local.h"
 #include "esim-target.h"
+#include "emu-target.h"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-compare"
@@ -76,6 +79,7 @@ static ssize_t ee_mwrite_word_native (e_mem_t *, off_t, int);
 static ssize_t ee_mread_buf_native (e_mem_t *, const off_t, void *, size_t);
 static ssize_t ee_mwrite_buf_native (e_mem_t *, off_t, const void *, size_t);
 static int e_reset_system_native (void);
+static void ee_emem_cache_flush (void);
 
 static int ee_read_word_esim (e_epiphany_t *, unsigned, unsigned, const off_t);
 static ssize_t ee_write_word_esim (e_epiphany_t *, unsigned, unsigned, off_t, int);
@@ -90,6 +94,8 @@ static ssize_t ee_mwrite_buf_esim (e_mem_t *, off_t, const void *, size_t);
 static int e_reset_system_esim (void);
 static int ee_hdf_from_sim_cfg(e_platform_t *dev);
 
+static int e_reset_system_emu (void);
+
 struct target_ops {
 	int (*ee_read_word) (e_epiphany_t *, unsigned, unsigned, const off_t);
 	ssize_t (*ee_write_word) (e_epiphany_t *, unsigned, unsigned, off_t, int);
@@ -104,13 +110,7 @@ struct target_ops {
 	int (*e_reset_system) (void);
 };
 
-#ifdef ESIM_TARGET
 static struct target_ops target = {
-#else
-/* Not tested, but the const should help the compiler optimize the indirection
- * away. */
-static const struct target_ops target = {
-#endif
 	.ee_read_word = ee_read_word_native,
 	.ee_write_word = ee_write_word_native,
 	.ee_read_buf = ee_read_buf_native,
@@ -141,13 +141,117 @@ static void use_esim_target_ops()
 #endif
 }
 
+/* The emulated memory is mapped like the device memory, so only the
+ * operations that talk to the driver need their own variant. */
+static void use_emu_target_ops()
+{
+	target.e_reset_system = e_reset_system_emu;
+}
+
+// Map a range of the physical address space into the process, either from
+// the device or, with the emu target, from the emulated host memory.
+static void *ee_map_phys(int memfd, off_t page_base, size_t size)
+{
+	void *p;
+
+	if (emu_target_p()) {
+		p = emu_map(page_base, size);
+		return p ? p : MAP_FAILED;
+	}
+
+	return mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, page_base);
+}
+
+static void ee_unmap_phys(void *addr, size_t size)
+{
+	if (!emu_target_p())
+		munmap(addr, size);
+}
+
+// Map the cores of the group with one mapping per row. The cores of a row
+// are 1MB apart in the global address space, so a row is one contiguous
+// window and a 64-core group needs 8 instead of 128 mappings (and as many
+// page table setups). Leaves dev->row_map NULL if the window cannot be
+// mapped as a whole, the cores are then mapped one by one.
+static void ee_map_rows(e_epiphany_t *dev)
+{
+	int irow;
+	off_t phy_base;
+
+	dev->row_map_size = (size_t) dev->cols << 20;
+	dev->row_map = (void **) calloc(dev->rows, sizeof(void *));
+	if (!dev->row_map)
+		return;
+
+	for (irow=0; irow<dev->rows; irow++)
+	{
+		phy_base = (off_t) ee_get_id_from_coords(dev, irow, 0) << 20;
+		dev->row_map[irow] = ee_map_phys(dev->memfd, phy_base, dev->row_map_size);
+		if (dev->row_map[irow] == MAP_FAILED)
+		{
+			diag(H_D1) { fprintf(diag_fd, "e_open(): row %d cannot be mapped as a whole, mapping the cores one by one\n", irow); }
+			while (irow--)
+				ee_unmap_phys(dev->row_map[irow], dev->row_map_size);
+			free(dev->row_map);
+			dev->row_map = NULL;
+			return;
+		}
+	}
+}
+
+// Ask the simulator for a direct pointer to a range of its memory. It is
+// NULL when the range is not backed by one contiguous host mapping, in
+// which case the accesses go through es_ops.mem_load()/mem_store().
+static void *ee_esim_raw_pointer(es_state *esim, uint64_t addr, uint64_t size)
+{
+	if (!es_ops.client_get_raw_pointer)
+		return NULL;
+
+	return (void *) es_ops.client_get_raw_pointer(esim, addr, size);
+}
+
+// True if [addr, addr + size) can be accessed through the raw pointer of
+// the region. base is page_offset bytes into the map_size bytes mapping.
+#define ee_esim_direct(mem, addr, size) \
+	((mem)->base && (addr) >= 0 && \
+	 (addr) + (size) <= (mem)->map_size - (mem)->page_offset)
+
 /////////////////////////////////
 // Device communication functions
 //
 // Platform configuration
 //
+// e_init() and e_finalize() are reference counted: only the first e_init()
+// sets up e_platform and the target ops, only the last e_finalize() tears
+// them down. In between they are never written, so the other functions
+// read them without locking.
+static pthread_mutex_t platform_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned		   platform_users = 0;
+
+static int ee_init_platform(char *hdf);
+static int ee_finalize_platform(void);
+
 // Initialize Epiphany platform according to configuration found in the HDF
 int e_init(char *hdf)
+{
+	int rc = E_OK;
+
+	pthread_mutex_lock(&platform_lock);
+
+	if (platform_users == 0)
+		rc = ee_init_platform(hdf);
+	else
+		diag(H_D2) { fprintf(diag_fd, "e_init(): platform already initialized, %u users\n", platform_users); }
+
+	if (rc == E_OK)
+		platform_users++;
+
+	pthread_mutex_unlock(&platform_lock);
+
+	return rc;
+}
+
+static int ee_init_platform(char *hdf)
 {
 	char *hdf_env, *esdk_env, hdf_dfl[1024];
 	int i;
@@ -183,6 +287,14 @@ int e_init(char *hdf)
 		/* unreachable, checked above */
 		abort();
 #endif
+	} else if (emu_target_p() && hdf == NULL && getenv(hdf_env_var_name) == NULL) {
+		// Without an HDF emulate a single chip board
+		diag(H_D2) { fprintf(diag_fd, "e_init(): no HDF, emulating the default platform\n"); }
+		if (E_OK != emu_default_platform(&e_platform))
+		{
+			warnx("e_init(): Error creating the emulated platform.");
+			return E_ERR;
+		}
 	} else {
 		// Parse HDF, get platform configuration
 		if (hdf == NULL)
@@ -248,11 +360,21 @@ int e_init(char *hdf)
 	diag(H_D2) { fprintf(diag_fd, "e_init(): platform.(row,col)	  = (%d,%d)\n", e_platform.row, e_platform.col); }
 	diag(H_D2) { fprintf(diag_fd, "e_init(): platform.(rows,cols) = (%d,%d)\n", e_platform.rows, e_platform.cols); }
 
+	if (emu_target_p()) {
+		use_emu_target_ops();
+		if (E_OK != emu_init(&e_platform)) {
+			warnx("e_init(): Cannot create the emulated platform memory.");
+			return E_ERR;
+		}
+	}
+
 	if ( E_OK != e_shm_init() ) {
 		warnx("e_init(): Failed to initialize the Epiphany Shared Memory Manager.");
 		return E_ERR;
 	}
 
+	// Publish the platform only once all of it is visible to other threads
+	__sync_synchronize();
 	e_platform.initialized = E_TRUE;
 
 	return E_OK;
@@ -262,17 +384,35 @@ int e_init(char *hdf)
 // Finalize connection with the Epiphany platform; Free allocated resources.
 int e_finalize(void)
 {
-	if (e_platform.initialized == E_FALSE)
+	int rc = E_OK;
+
+	pthread_mutex_lock(&platform_lock);
+
+	if (platform_users == 0)
 	{
 		warnx("e_finalize(): Platform was not initiated.");
-		return E_ERR;
+		rc = E_ERR;
 	}
+	else if (--platform_users == 0)
+		rc = ee_finalize_platform();
 
+	pthread_mutex_unlock(&platform_lock);
+
+	return rc;
+}
+
+static int ee_finalize_platform(void)
+{
 	e_shm_finalize();
 
 	if (esim_target_p())
 		es_ops.client_disconnect(e_platform.esim, true);
 
+	if (emu_target_p())
+		emu_finalize();
+	else
+		ee_emem_cache_flush();
+
 	e_platform.initialized = E_FALSE;
 
 	free(e_platform.chip);
@@ -312,8 +452,13 @@ int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigne
 		return E_ERR;
 	}
 
+	// The emulated platform is private to this process
+	if (!emu_target_p() && E_OK != ee_lease_check(row, col, rows, cols))
+		return E_ERR;
+
 	dev->objtype = E_EPI_GROUP;
 	dev->type	 = e_platform.chip[0].type; // TODO: assumes one chip type in platform
+	dev->overlay_cfg = 0;
 
 	// Set device geometry
 	// TODO: check if coordinates and size are legal.
@@ -332,6 +477,9 @@ int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigne
 	if (esim_target_p()) {
 		// Connect to ESIM shm file
 		dev->esim = e_platform.esim;
+	} else if (emu_target_p()) {
+		// The cores are backed by host memory
+		dev->memfd = -1;
 	} else {
 		// Open memory device
 		dev->memfd = open(EPIPHANY_DEV, O_RDWR | O_SYNC);
@@ -342,6 +490,10 @@ int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigne
 		}
 	}
 
+	dev->row_map = NULL;
+	if (!esim_target_p())
+		ee_map_rows(dev);
+
 	// Map individual cores to virtual memory space
 	dev->core = (e_core_t **) malloc(dev->rows * sizeof(e_core_t *));
 	if (!dev->core)
@@ -380,11 +532,21 @@ int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigne
 			curr_core->mems.page_offset = curr_core->mems.phy_base - curr_core->mems.page_base;
 			curr_core->mems.map_size = e_platform.chip[0].sram_size + curr_core->mems.page_offset;
 
-			if (!esim_target_p()) {
-				curr_core->mems.mapped_base = mmap(NULL, curr_core->mems.map_size, PROT_READ|PROT_WRITE, MAP_SHARED, dev->memfd, curr_core->mems.page_base);
+			if (dev->row_map) {
+				// Part of the row mapping, not mapped by itself
+				curr_core->mems.mapped_base = NULL;
+				curr_core->mems.base = dev->row_map[irow] + ((icol << 20) | e_platform.chip[0].sram_base);
+			} else if (!esim_target_p()) {
+				curr_core->mems.mapped_base = ee_map_phys(dev->memfd, curr_core->mems.page_base, curr_core->mems.map_size);
 				curr_core->mems.base = curr_core->mems.mapped_base + curr_core->mems.page_offset;
 
 				diag(H_D2) { fprintf(diag_fd, "e_open(): mems.phy_base = 0x%08x, mems.base = 0x%08x, mems.size = 0x%08x\n", (uint) curr_core->mems.phy_base, (uint) curr_core->mems.base, (uint) curr_core->mems.map_size); }
+			} else {
+				// Direct access to the simulated SRAM, if the simulator allows it
+				curr_core->mems.mapped_base = ee_esim_raw_pointer(dev->esim, curr_core->mems.page_base, curr_core->mems.map_size);
+				curr_core->mems.base = curr_core->mems.mapped_base ? curr_core->mems.mapped_base + curr_core->mems.page_offset : NULL;
+
+				diag(H_D2) { fprintf(diag_fd, "e_open(): core (%d,%d) SRAM is %s\n", curr_core->row, curr_core->col, curr_core->mems.base ? "mapped" : "accessed through ESIM"); }
 			}
 
 			// e-core regs
@@ -393,8 +555,11 @@ int e_open(e_epiphany_t *dev, unsigned row, unsigned col, unsigned rows, unsigne
 			curr_core->regs.page_offset = curr_core->regs.phy_base - curr_core->regs.page_base;
 			curr_core->regs.map_size = e_platform.chip[0].regs_size + curr_core->regs.page_offset;
 
-			if (!esim_target_p()) {
-				curr_core->regs.mapped_base = mmap(NULL, curr_core->regs.map_size, PROT_READ|PROT_WRITE, MAP_SHARED, dev->memfd, curr_core->regs.page_base);
+			if (dev->row_map) {
+				curr_core->regs.mapped_base = NULL;
+				curr_core->regs.base = dev->row_map[irow] + ((icol << 20) | e_platform.chip[0].regs_base);
+			} else if (!esim_target_p()) {
+				curr_core->regs.mapped_base = ee_map_phys(dev->memfd, curr_core->regs.page_base, curr_core->regs.map_size);
 				curr_core->regs.base = curr_core->regs.mapped_base + curr_core->regs.page_offset;
 
 				diag(H_D2) { fprintf(diag_fd, "e_open(): regs.phy_base = 0x%08x, regs.base = 0x%08x, regs.size = 0x%08x\n", (uint) curr_core->regs.phy_base, (uint) curr_core->regs.base, (uint) curr_core->regs.map_size); }
@@ -433,13 +598,15 @@ int e_close(e_epiphany_t *dev)
 
 	for (irow=0; irow<dev->rows; irow++)
 	{
-		if (!esim_target_p()) {
+		if (dev->row_map) {
+			ee_unmap_phys(dev->row_map[irow], dev->row_map_size);
+		} else if (!esim_target_p()) {
 			for (icol=0; icol<dev->cols; icol++)
 			{
 				curr_core = &(dev->core[irow][icol]);
 
-				munmap(curr_core->mems.mapped_base, curr_core->mems.map_size);
-				munmap(curr_core->regs.mapped_base, curr_core->regs.map_size);
+				ee_unmap_phys(curr_core->mems.mapped_base, curr_core->mems.map_size);
+				ee_unmap_phys(curr_core->regs.mapped_base, curr_core->regs.map_size);
 			}
 		}
 
@@ -447,8 +614,10 @@ int e_close(e_epiphany_t *dev)
 	}
 
 	free(dev->core);
+	free(dev->row_map);
+	dev->row_map = NULL;
 
-	if (!esim_target_p())
+	if (!esim_target_p() && !emu_target_p())
 		close(dev->memfd);
 
 	return E_OK;
@@ -531,6 +700,45 @@ ssize_t e_write(void *dev, unsigned row, unsigned col, off_t to_addr, const void
 }
 
 
+// Set the multicast address that all cores in a group listen to. Cores
+// running with e-lib can equally join with e_multicast_init().
+int e_set_multicast(e_epiphany_t *dev, unsigned mcast_id)
+{
+	int row, col;
+
+	if (mcast_id & ~0xfff) {
+		warnx("e_set_multicast(): Invalid multicast ID 0x%x.", mcast_id);
+		return E_ERR;
+	}
+
+	for (row=0; row<dev->rows; row++)
+		for (col=0; col<dev->cols; col++)
+			if (ee_write_reg(dev, row, col, E_REG_MULTICAST, mcast_id) == E_ERR)
+				return E_ERR;
+
+	diag(H_D1) { fprintf(diag_fd, "e_set_multicast(): group listens on 0x%03x.\n", mcast_id); }
+
+	return E_OK;
+}
+
+
+// Write a memory block to the same address on every core in a group.
+// The host link cannot emit mesh multicast transactions, so the write is
+// fanned out as one unicast write per core. Device code should use the
+// e-lib e_multicast_write() to get a single hardware multicast.
+ssize_t e_multicast_write(e_epiphany_t *dev, off_t to_addr, const void *buf, size_t size)
+{
+	int row, col;
+
+	for (row=0; row<dev->rows; row++)
+		for (col=0; col<dev->cols; col++)
+			if (ee_write_buf(dev, row, col, to_addr, buf, size) == E_ERR)
+				return E_ERR;
+
+	return size;
+}
+
+
 // Read a word from SRAM of a core in a group
 static int ee_read_word_esim(e_epiphany_t *dev, unsigned row, unsigned col, const off_t from_addr)
 {
@@ -539,6 +747,9 @@ static int ee_read_word_esim(e_epiphany_t *dev, unsigned row, unsigned col, cons
 	uint32_t addr;
 
 	size = sizeof(int);
+	if (ee_esim_direct(&dev->core[row][col].mems, from_addr, size))
+		return *(volatile int *) (dev->core[row][col].mems.base + from_addr);
+
 	addr = (dev->core[row][col].id << 20) + from_addr;
 
 	if (ES_OK != es_ops.mem_load(dev->esim, addr, size, (uint8_t *) &data))
@@ -584,6 +795,11 @@ static ssize_t ee_write_word_esim(e_epiphany_t *dev, unsigned row, unsigned col,
 	uint32_t addr;
 
 	size = sizeof(int);
+	if (ee_esim_direct(&dev->core[row][col].mems, to_addr, size)) {
+		*(volatile int *) (dev->core[row][col].mems.base + to_addr) = data;
+		return size;
+	}
+
 	addr = (dev->core[row][col].id << 20) + to_addr;
 
 	if (ES_OK != es_ops.mem_store(dev->esim, addr, size, (uint8_t *) &data))
@@ -701,6 +917,11 @@ static ssize_t ee_read_buf_esim(e_epiphany_t *dev, unsigned row, unsigned col, c
 {
 	uint32_t addr;
 
+	if (ee_esim_direct(&dev->core[row][col].mems, from_addr, size)) {
+		memcpy(buf, dev->core[row][col].mems.base + from_addr, size);
+		return size;
+	}
+
 	addr = (dev->core[row][col].id << 20) + from_addr;
 
 	if (ES_OK != es_ops.mem_load(dev->esim, addr, size, (uint8_t *) buf))
@@ -776,6 +997,11 @@ static ssize_t ee_write_buf_esim(e_epiphany_t *dev, unsigned row, unsigned col,
 {
 	uint32_t addr;
 
+	if (ee_esim_direct(&dev->core[row][col].mems, to_addr, size)) {
+		memcpy(dev->core[row][col].mems.base + to_addr, buf, size);
+		return size;
+	}
+
 	addr = (dev->core[row][col].id << 20) + to_addr;
 
 	if (ES_OK != es_ops.mem_store(dev->esim, addr, size, (uint8_t *) buf))
@@ -918,6 +1144,157 @@ ssize_t ee_write_reg(e_epiphany_t *dev, unsigned row, unsigned col, off_t to_add
 
 // External Memory access
 //
+// Mapping cache of the first external memory segment. The segment gets one
+// reserved address range on first use; its 1MB chunks are mapped from the
+// device into that range when a buffer first covers them and stay mapped
+// until e_finalize(). Buffers are then just pointers into the range, so
+// repeated e_alloc()/e_free() pairs (e.g. one per e_load_group()) do not
+// pay for mmap()/munmap() any more. The per-chunk reference counts track
+// the buffers that are currently allocated.
+#define EMEM_CHUNK_SIZE (1 << 20)
+
+static struct {
+	pthread_mutex_t	 lock;
+	int				 memfd;		  // device, kept open while chunks are mapped
+	uint8_t			*base;		  // reserved address range of the segment
+	off_t			 phy_base;	  // physical address of base
+	size_t			 size;		  // whole chunks
+	unsigned		*refcnt;	  // buffers using each chunk
+	uint8_t			*mapped;	  // chunk is mapped
+} emem_cache = { .lock = PTHREAD_MUTEX_INITIALIZER, .memfd = -1 };
+
+static int ee_emem_cache_init(void)
+{
+	e_memseg_t *emem = &e_platform.emem[0];
+	unsigned nchunks;
+
+	emem_cache.phy_base = emem->phy_base & ~((off_t) EMEM_CHUNK_SIZE - 1);
+	emem_cache.size		= (emem->phy_base + emem->size - emem_cache.phy_base + EMEM_CHUNK_SIZE - 1) & ~((size_t) EMEM_CHUNK_SIZE - 1);
+	nchunks				= emem_cache.size / EMEM_CHUNK_SIZE;
+
+	emem_cache.refcnt = (unsigned *) calloc(nchunks, sizeof(unsigned));
+	emem_cache.mapped = (uint8_t *) calloc(nchunks, sizeof(uint8_t));
+	emem_cache.memfd  = open(EPIPHANY_DEV, O_RDWR | O_SYNC);
+	emem_cache.base	  = mmap(NULL, emem_cache.size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (!emem_cache.refcnt || !emem_cache.mapped || emem_cache.memfd == -1 || emem_cache.base == MAP_FAILED)
+	{
+		if (emem_cache.base != MAP_FAILED)
+			munmap(emem_cache.base, emem_cache.size);
+		if (emem_cache.memfd != -1)
+			close(emem_cache.memfd);
+		free(emem_cache.refcnt);
+		free(emem_cache.mapped);
+		emem_cache.base	  = NULL;
+		emem_cache.memfd  = -1;
+		emem_cache.refcnt = NULL;
+		emem_cache.mapped = NULL;
+		return E_ERR;
+	}
+
+	diag(H_D2) { fprintf(diag_fd, "ee_emem_cache_init(): reserved 0x%08x bytes for phy_base 0x%08x\n", (uint) emem_cache.size, (uint) emem_cache.phy_base); }
+
+	return E_OK;
+}
+
+// Take references on the chunks of [phy_base, phy_base + size), mapping the
+// ones that are not mapped yet. NULL if the range is not in the segment or
+// a chunk cannot be mapped.
+static void *ee_emem_cache_get(off_t phy_base, size_t size)
+{
+	unsigned first, last, i;
+	void *p, *chunk;
+
+	if (!e_platform.num_emems || !size)
+		return NULL;
+
+	pthread_mutex_lock(&emem_cache.lock);
+
+	p = NULL;
+	if (!emem_cache.base && E_OK != ee_emem_cache_init())
+		goto out;
+
+	if (phy_base < emem_cache.phy_base || phy_base + size > emem_cache.phy_base + emem_cache.size)
+		goto out;
+
+	first = (phy_base - emem_cache.phy_base) / EMEM_CHUNK_SIZE;
+	last  = (phy_base + size - 1 - emem_cache.phy_base) / EMEM_CHUNK_SIZE;
+
+	for (i = first; i <= last; i++)
+	{
+		if (emem_cache.mapped[i])
+			continue;
+
+		chunk = mmap(emem_cache.base + (size_t) i * EMEM_CHUNK_SIZE, EMEM_CHUNK_SIZE, PROT_READ|PROT_WRITE,
+					 MAP_SHARED | MAP_FIXED, emem_cache.memfd, emem_cache.phy_base + (off_t) i * EMEM_CHUNK_SIZE);
+		if (chunk == MAP_FAILED)
+		{
+			diag(H_D1) { fprintf(diag_fd, "ee_emem_cache_get(): failed to map chunk %u\n", i); }
+			goto out;
+		}
+		emem_cache.mapped[i] = 1;
+	}
+
+	for (i = first; i <= last; i++)
+		emem_cache.refcnt[i]++;
+
+	p = emem_cache.base + (phy_base - emem_cache.phy_base);
+
+ out:
+	pthread_mutex_unlock(&emem_cache.lock);
+	return p;
+}
+
+// Drop the references taken by ee_emem_cache_get(). Returns E_FALSE if addr
+// is not in the cache, i.e. it was mapped by itself.
+static e_bool_t ee_emem_cache_put(void *addr, size_t size)
+{
+	unsigned first, last, i;
+	e_bool_t ret = E_FALSE;
+
+	pthread_mutex_lock(&emem_cache.lock);
+
+	if (emem_cache.base && (uint8_t *) addr >= emem_cache.base &&
+		(uint8_t *) addr + size <= emem_cache.base + emem_cache.size)
+	{
+		first = ((uint8_t *) addr - emem_cache.base) / EMEM_CHUNK_SIZE;
+		last  = ((uint8_t *) addr + size - 1 - emem_cache.base) / EMEM_CHUNK_SIZE;
+		for (i = first; i <= last; i++)
+			if (emem_cache.refcnt[i])
+				emem_cache.refcnt[i]--;
+		ret = E_TRUE;
+	}
+
+	pthread_mutex_unlock(&emem_cache.lock);
+	return ret;
+}
+
+// Unmap all chunks, called from e_finalize()
+static void ee_emem_cache_flush(void)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&emem_cache.lock);
+
+	if (emem_cache.base)
+	{
+		for (i = 0; i < emem_cache.size / EMEM_CHUNK_SIZE; i++)
+			if (emem_cache.refcnt[i])
+				diag(H_D1) { fprintf(diag_fd, "e_finalize(): external memory chunk %u still has %u users\n", i, emem_cache.refcnt[i]); }
+
+		munmap(emem_cache.base, emem_cache.size);
+		close(emem_cache.memfd);
+		free(emem_cache.refcnt);
+		free(emem_cache.mapped);
+		emem_cache.base	  = NULL;
+		emem_cache.memfd  = -1;
+		emem_cache.refcnt = NULL;
+		emem_cache.mapped = NULL;
+	}
+
+	pthread_mutex_unlock(&emem_cache.lock);
+}
+
 // Allocate a buffer in external memory
 int e_alloc(e_mem_t *mbuf, off_t offset, size_t size)
 {
@@ -933,12 +1310,7 @@ int e_alloc(e_mem_t *mbuf, off_t offset, size_t size)
 		// Connect to ESIM shm file
 		mbuf->esim = e_platform.esim;
 	} else {
-		mbuf->memfd = open(EPIPHANY_DEV, O_RDWR | O_SYNC);
-		if (mbuf->memfd == -1)
-		{
-			warnx("e_alloc(): EPIPHANY_DEV file open failure.");
-			return E_ERR;
-		}
+		mbuf->memfd = -1;
 	}
 
 	diag(H_D2) { fprintf(diag_fd, "e_alloc(): allocating EMEM buffer at offset 0x%08x\n", (uint) offset); }
@@ -949,13 +1321,30 @@ int e_alloc(e_mem_t *mbuf, off_t offset, size_t size)
 	mbuf->map_size = size + mbuf->page_offset;
 
 	if (!esim_target_p()) {
-		mbuf->mapped_base = mmap(NULL, mbuf->map_size, PROT_READ|PROT_WRITE, MAP_SHARED, mbuf->memfd, mbuf->page_base);
+		mbuf->mapped_base = emu_target_p() ? NULL : ee_emem_cache_get(mbuf->page_base, mbuf->map_size);
+		if (!mbuf->mapped_base && !emu_target_p()) {
+			// Outside of the cached segment, map the buffer by itself
+			mbuf->memfd = open(EPIPHANY_DEV, O_RDWR | O_SYNC);
+			if (mbuf->memfd == -1)
+			{
+				warnx("e_alloc(): EPIPHANY_DEV file open failure.");
+				return E_ERR;
+			}
+		}
+		if (!mbuf->mapped_base)
+			mbuf->mapped_base = ee_map_phys(mbuf->memfd, mbuf->page_base, mbuf->map_size);
 		mbuf->base = (void*)(((char*)mbuf->mapped_base) + mbuf->page_offset);
 	}
 
 	mbuf->ephy_base = (e_platform.emem[0].ephy_base + offset); // TODO: this takes only the 1st segment into account
 	mbuf->emap_size = size;
 
+	if (esim_target_p()) {
+		// Direct access to the simulated external memory, if possible
+		mbuf->mapped_base = ee_esim_raw_pointer(mbuf->esim, mbuf->ephy_base - mbuf->page_offset, mbuf->map_size);
+		mbuf->base = mbuf->mapped_base ? (void*)(((char*)mbuf->mapped_base) + mbuf->page_offset) : NULL;
+	}
+
 	if (!esim_target_p()) {
 		diag(H_D2) { fprintf(diag_fd, "e_alloc(): mbuf.phy_base = 0x%08x, mbuf.ephy_base = 0x%08x, mbuf.base = 0x%08x, mbuf.size = 0x%08x\n", (uint) mbuf->phy_base, (uint) mbuf->ephy_base, (uint) mbuf->base, (uint) mbuf->map_size); }
 
@@ -979,9 +1368,10 @@ int e_free(e_mem_t *mbuf)
 	if (E_SHARED_MEM != mbuf->objtype) {
 		// The shared memory mapping is persistent - don't unmap
 
-		if (!esim_target_p()) {
-			munmap(mbuf->mapped_base, mbuf->map_size);
-			close(mbuf->memfd);
+		if (!esim_target_p() && !ee_emem_cache_put(mbuf->mapped_base, mbuf->map_size)) {
+			ee_unmap_phys(mbuf->mapped_base, mbuf->map_size);
+			if (mbuf->memfd != -1)
+				close(mbuf->memfd);
 		}
 	}
 
@@ -1018,10 +1408,13 @@ static int ee_mread_word_esim(e_mem_t *mbuf, const off_t from_addr)
 	uint32_t addr;
 	ssize_t size;
 
+	size = sizeof(int);
+	if (ee_esim_direct(mbuf, from_addr, size))
+		return *(volatile int *) (mbuf->base + from_addr);
+
 	/* ???: Not sure whether this is always the right address */
 	addr = mbuf->ephy_base + from_addr + mbuf->page_offset;
 
-	size = sizeof(int);
 	if (ES_OK != es_ops.mem_load(mbuf->esim, addr, size, (uint8_t *) &data))
 	{
 		warnx("ee_mread_word(): Failed.");
@@ -1064,10 +1457,15 @@ static ssize_t ee_mwrite_word_esim(e_mem_t *mbuf, off_t to_addr, int data)
 	uint32_t addr;
 	ssize_t size;
 
+	size = sizeof(int);
+	if (ee_esim_direct(mbuf, to_addr, size)) {
+		*(volatile int *) (mbuf->base + to_addr) = data;
+		return size;
+	}
+
 	/* ???: Not sure whether this is always the right address */
 	addr = mbuf->ephy_base + to_addr;
 
-	size = sizeof(int);
 	if (ES_OK != es_ops.mem_store(mbuf->esim, addr, size, (uint8_t *) &data))
 	{
 		warnx("ee_mwrite_word(): Failed.");
@@ -1108,6 +1506,11 @@ static ssize_t ee_mread_buf_esim(e_mem_t *mbuf, const off_t from_addr, void *buf
 {
 	uint32_t addr;
 
+	if (ee_esim_direct(mbuf, from_addr, size)) {
+		memcpy(buf, mbuf->base + from_addr, size);
+		return size;
+	}
+
 	/* ???: Not sure whether this is always the right address */
 	addr = mbuf->ephy_base + mbuf->page_offset + from_addr;
 
@@ -1154,6 +1557,11 @@ static ssize_t ee_mwrite_buf_esim(e_mem_t *mbuf, off_t to_addr, const void *buf,
 {
 	uint32_t addr;
 
+	if (ee_esim_direct(mbuf, to_addr, size)) {
+		memcpy(mbuf->base + to_addr, buf, size);
+		return size;
+	}
+
 	/* ???: Not sure whether this is always the right address */
 	addr = mbuf->ephy_base + mbuf->page_offset + to_addr;
 
@@ -1248,8 +1656,25 @@ int e_reset_system_native(void)
 }
 
 
+static int e_reset_system_emu(void)
+{
+	return emu_reset();
+}
+
+
 int e_reset_system(void)
 {
+	unsigned leases;
+
+	// Don't pull the chip from under other jobs, they use e_reset_group()
+	leases = ee_lease_others();
+	if (leases)
+	{
+		warnx("e_reset_system(): %u workgroups are leased by other processes.", leases);
+		errno = EBUSY;
+		return E_ERR;
+	}
+
 	return target.e_reset_system();
 }
 
@@ -1276,7 +1701,7 @@ int ee_reset_core(e_epiphany_t *dev, unsigned row, unsigned col)
 	diag(H_D1) { fprintf(diag_fd, "e_reset_core(): pausing DMAs.\n"); }
 	e_write(dev, row, col, E_REG_CONFIG, &CONFIG, sizeof(unsigned));
 
-	if (!esim_target_p())
+	if (!esim_target_p() && !emu_target_p())
 		usleep(100000);
 
 	diag(H_D1) { fprintf(diag_fd, "e_reset_core(): resetting core (%d,%d) (0x%03x)...\n", row, col, dev->core[row][col].id); }
@@ -1306,7 +1731,7 @@ int e_reset_group(e_epiphany_t *dev)
 		for (col=0; col<dev->cols; col++)
 			e_write(dev, row, col, E_REG_CONFIG, &CONFIG, sizeof(unsigned));
 
-	if (!esim_target_p())
+	if (!esim_target_p() && !emu_target_p())
 		usleep(100000);
 
 	diag(H_D1) { fprintf(diag_fd, "e_reset_group(): resetting cores...\n"); }
@@ -1535,190 +1960,14 @@ e_hal_diag_t e_set_host_verbosity(e_hal_diag_t verbose)
 {
 	e_hal_diag_t old_host_verbose;
 
-	old_host_verbose = e_host_verbose;
 	diag_fd = stderr;
-	e_host_verbose = verbose;
+	old_host_verbose = __sync_lock_test_and_set(&e_host_verbose, verbose);
 
 	return old_host_verbose;
 }
 
 
 
-////////////////////////////////////
-// HDF parser
-
-int ee_parse_hdf(e_platform_t *dev, char *hdf)
-{
-	int	  ret = E_ERR;
-	char *ext;
-
-	if (strlen(hdf) >= 4)
-	{
-		ext = hdf + strlen(hdf) - 4;
-		if (!strcmp(ext, ".hdf"))
-			ret = ee_parse_simple_hdf(dev, hdf);
-		else if (!strcmp(ext, ".xml"))
-			ret = ee_parse_xml_hdf(dev, hdf);
-		else
-			ret = E_ERR;
-	} else {
-		ret = E_ERR;
-	}
-
-	return ret;
-}
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
-int ee_parse_simple_hdf(e_platform_t *dev, char *hdf)
-{
-	FILE	   *fp;
-	int			chip_num;
-	int			emem_num;
-	e_chip_t   *curr_chip = NULL;
-	e_memseg_t *curr_emem = NULL;
-
-	char line[255], etag[255], eval[255], *dummy;
-	int l;
-
-	fp = fopen(hdf, "r");
-	if (fp == NULL)
-	{
-		warnx("ee_parse_simple_hdf(): Can't open Hardware Definition File (HDF) %s.", hdf);
-		return E_ERR;
-	}
-
-	chip_num = -1;
-	emem_num = -1;
-
-	l = 0;
-
-	while (!feof(fp))
-	{
-		l++;
-		dummy = fgets(line, sizeof(line), fp);
-		ee_trim_str(line);
-		if (!strcmp(line, ""))
-			continue;
-		sscanf(line, "%s %s", etag, eval);
-		diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): line %d: %s %s\n", l, etag, eval); }
-
-
-		// Platform definition
-		if		(!strcmp("PLATFORM_VERSION", etag))
-		{
-			sscanf(eval, "%s", dev->version);
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): platform version = %s\n", dev->version); }
-		}
-
-		else if (!strcmp("NUM_CHIPS", etag))
-		{
-			sscanf(eval, "%d", &(dev->num_chips));
-			dev->chip = (e_chip_t *) calloc(dev->num_chips, sizeof(e_chip_t));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): number of chips = %d\n", dev->num_chips); }
-		}
-
-		else if (!strcmp("NUM_EXT_MEMS", etag))
-		{
-			sscanf(eval, "%d", &(dev->num_emems));
-			dev->emem = (e_memseg_t *) calloc(dev->num_emems, sizeof(e_memseg_t));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): number of ext. memory segments = %d\n", dev->num_emems); }
-		}
-
-		else if (!strcmp("ESYS_REGS_BASE", etag)) {
-			diag(H_D3) { fprintf(diag_fd, "Ignoring deprecated ESYS_REGS_BASE\n"); }
-		}
-
-
-		// Chip definition
-		else if (!strcmp("CHIP", etag))
-		{
-			chip_num++;
-			curr_chip = &(dev->chip[chip_num]);
-			sscanf(eval, "%s", curr_chip->version);
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): processing chip #%d, version = \"%s\"\n", chip_num, curr_chip->version); }
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): chip version = %s\n", curr_chip->version); }
-		}
-
-		else if (!strcmp("CHIP_ROW", etag))
-		{
-			sscanf(eval, "%d", &(curr_chip->row));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): chip row = %d\n", curr_chip->row); }
-		}
-
-		else if (!strcmp("CHIP_COL", etag))
-		{
-			sscanf(eval, "%d", &(curr_chip->col));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): chip col = %d\n", curr_chip->col); }
-		}
-
-
-		// External memory definitions
-		else if (!strcmp("EMEM", etag))
-		{
-			emem_num++;
-			curr_emem = &(dev->emem[emem_num]);
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): processing external memory segment #%d\n", emem_num); }
-		}
-
-		else if (!strcmp("EMEM_BASE_ADDRESS", etag))
-		{
-			sscanf(eval, "%x", (unsigned int *) &(curr_emem->phy_base));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): base addr. of ext. mem. segment = 0x%08x\n", (uint) curr_emem->phy_base); }
-		}
-
-		else if (!strcmp("EMEM_EPI_BASE", etag))
-		{
-			sscanf(eval, "%x", (unsigned int *) &(curr_emem->ephy_base));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): base addr. of ext. mem. segment (device side)= 0x%08x\n", (uint) curr_emem->ephy_base); }
-		}
-
-		else if (!strcmp("EMEM_SIZE", etag))
-		{
-			sscanf(eval, "%x", (unsigned int *) &(curr_emem->size));
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): size of ext. mem. segment = %x\n", (uint) curr_emem->size); }
-		}
-
-		else if (!strcmp("EMEM_TYPE", etag))
-		{
-			if (!strcmp(etag, "RD"))
-				curr_emem->type = E_RD;
-			else if (!strcmp(etag, "WR"))
-				curr_emem->type = E_WR;
-			else if (!strcmp(etag, "RDWR"))
-				curr_emem->type = E_RDWR;
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): type of ext. mem. segment = %x\n", (uint) curr_emem->type); }
-		}
-
-
-		// Other
-		else if (!strcmp("//", etag))
-		{
-			;
-			diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): comment\n"); }
-		}
-		else {
-			return E_ERR;
-		}
-	}
-
-	fclose(fp);
-
-	return E_OK;
-}
-#pragma GCC diagnostic pop
-
-int ee_parse_xml_hdf(e_platform_t *dev, char *hdf)
-{
-	(void)dev;
-	(void)hdf;
-	warnx("ee_parse_xml_hdf(): XML file format is not yet supported. "
-		  "Please use simple HDF format.");
-
-	return E_ERR;
-}
-
-
 // Platform data structures
 typedef struct {
 	e_objtype_t		 objtype;	  // object type identifier
@@ -1823,6 +2072,23 @@ int ee_set_chip_params(e_chip_t *chip)
 	return E_OK;
 }
 
+// Name of the chip with the given generation and size, for descriptions
+// that do not name their chips
+const char *ee_chip_version(unsigned arch, unsigned rows, unsigned cols)
+{
+	int chip_ver;
+
+	for (chip_ver = 0; chip_ver < NUM_CHIP_VERSIONS; chip_ver++)
+		if (chip_params_table[chip_ver].arch == arch &&
+			chip_params_table[chip_ver].rows == rows &&
+			chip_params_table[chip_ver].cols == cols)
+			return chip_params_table[chip_ver].version;
+
+	diag(H_D2) { fprintf(diag_fd, "ee_chip_version(): no %ux%u chip of generation %u, using \"%s\"\n", rows, cols, arch, chip_params_table[0].version); }
+
+	return chip_params_table[0].version;
+}
+
 #if ESIM_TARGET
 static int ee_hdf_from_sim_cfg(e_platform_t *dev)
 {
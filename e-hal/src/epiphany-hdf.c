@@ -0,0 +1,778 @@
+/*
+  File: epiphany-hdf.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.	 If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Platform descriptions.
+ *
+ * The text HDF, the XML HDF and the compiled format all read into the
+ * same model, e_hdf_t. The model is a flat block with no pointers, so
+ * e_hdf_save() writes it out as it is, and e_hdf_load() reads or maps a
+ * compiled file and only checks its header and checksum. e_init() turns the model
+ * into e_platform_t. e-server turns it into the platform_definition_t
+ * that the XML parser used to build for it.
+ *
+ * The chips are matched against the chip table of the HAL in both
+ * directions. A text HDF names the chip ("E16G301"), and the table gives
+ * its generation, size and SRAM. An XML HDF gives the generation and the
+ * size, and the table gives the name.
+ *
+ * XML banks describe memory as the cores see it ("start"). The optional
+ * "host_start" and "type" attributes give the host side address and the
+ * access type that the text HDF has in EMEM_BASE_ADDRESS and EMEM_TYPE.
+ * e_alloc(), the loader and shared memory use the first bank, so the
+ * shipped XMLs list the same bank as their text HDFs, and nothing else.
+ * The optional "platform_version" attribute of <platform> is the
+ * PLATFORM_VERSION of the text HDF; without it the name stands in.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "epiphany-hal.h"
+#include "epiphany-hal-api-local.h"
+
+extern int	 e_host_verbose;
+extern FILE *diag_fd;
+#define diag(vN) if (e_host_verbose >= vN)
+
+#define HDF_MAX_CHIPS	  256
+#define HDF_MAX_EMEMS	  16
+#define HDF_MAX_XML_ATTRS 16
+#define HDF_DEFAULT_LIB	  "libe-hal.so"
+#define HDF_READ_MAX	  (64 << 10) // compiled files up to this size are read, not mapped
+
+// A description while it is being read, packed into e_hdf_t at the end
+typedef struct {
+	e_hdf_t		 hdr;
+	int			 num_chips;    // declared by NUM_CHIPS, -1 if not
+	int			 num_emems;    // declared by NUM_EXT_MEMS, -1 if not
+	e_hdf_chip_t chip[HDF_MAX_CHIPS];
+	e_hdf_emem_t emem[HDF_MAX_EMEMS];
+} hdf_build_t;
+
+typedef struct {
+	char *name;
+	char *value;
+} hdf_xml_attr_t;
+
+
+static uint32_t hdf_checksum(const e_hdf_t *desc)
+{
+	const unsigned char *p	 = (const unsigned char *) desc + E_HDF_PREAMBLE;
+	const unsigned char *end = (const unsigned char *) desc + desc->size;
+	uint32_t			 h	 = 2166136261u;
+
+	while (p < end)
+		h = (h ^ *p++) * 16777619u;
+
+	return h;
+}
+
+static void hdf_strcpy(char *dst, const char *src, size_t size)
+{
+	if (snprintf(dst, size, "%s", src) >= (int) size)
+		diag(H_D1) { fprintf(diag_fd, "e_hdf_load(): \"%s\" is cut to %u characters\n", src, (unsigned) size - 1); }
+}
+
+static hdf_build_t *hdf_build_new(void)
+{
+	hdf_build_t *b;
+
+	b = (hdf_build_t *) calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	b->num_chips = -1;
+	b->num_emems = -1;
+	hdf_strcpy(b->hdr.lib, HDF_DEFAULT_LIB, sizeof(b->hdr.lib));
+
+	return b;
+}
+
+static e_hdf_chip_t *hdf_add_chip(hdf_build_t *b)
+{
+	e_hdf_chip_t *chip;
+
+	if (b->hdr.num_chips == HDF_MAX_CHIPS)
+		return NULL;
+
+	chip = &b->chip[b->hdr.num_chips++];
+	chip->ioreg_row = E_HDF_NO_IOREG;
+	chip->ioreg_col = E_HDF_NO_IOREG;
+
+	return chip;
+}
+
+static e_hdf_emem_t *hdf_add_emem(hdf_build_t *b)
+{
+	e_hdf_emem_t *emem;
+
+	if (b->hdr.num_emems == HDF_MAX_EMEMS)
+		return NULL;
+
+	emem = &b->emem[b->hdr.num_emems++];
+	emem->type = E_RDWR;
+
+	return emem;
+}
+
+// Fill in what the chip table knows about a chip named by its version
+static void hdf_chip_from_table(e_hdf_chip_t *chip)
+{
+	e_chip_t tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+	hdf_strcpy(tmp.version, chip->version, sizeof(tmp.version));
+	ee_set_chip_params(&tmp);
+
+	chip->arch		= tmp.arch;
+	chip->rows		= tmp.rows;
+	chip->cols		= tmp.cols;
+	chip->sram_size = tmp.sram_size;
+}
+
+static uint32_t hdf_memtype(const char *s)
+{
+	if (!strcmp(s, "RD"))
+		return E_RD;
+	else if (!strcmp(s, "WR"))
+		return E_WR;
+
+	return E_RDWR;
+}
+
+// Pack the description into one block
+static e_hdf_t *hdf_build_finish(hdf_build_t *b, const char *hdf)
+{
+	e_hdf_t *desc;
+	size_t	 chips, emems;
+
+	if ((b->num_chips >= 0 && b->num_chips != (int) b->hdr.num_chips) ||
+		(b->num_emems >= 0 && b->num_emems != (int) b->hdr.num_emems)) {
+		warnx("e_hdf_load(): %s declares %d chips and %d memory segments but describes %u and %u.",
+			  hdf, b->num_chips, b->num_emems, b->hdr.num_chips, b->hdr.num_emems);
+		free(b);
+		return NULL;
+	}
+
+	if (!b->hdr.num_chips) {
+		warnx("e_hdf_load(): %s describes no chips.", hdf);
+		free(b);
+		return NULL;
+	}
+
+	if (!b->hdr.name[0])
+		hdf_strcpy(b->hdr.name, b->hdr.version, sizeof(b->hdr.name));
+
+	chips = b->hdr.num_chips * sizeof(e_hdf_chip_t);
+	emems = b->hdr.num_emems * sizeof(e_hdf_emem_t);
+
+	desc = (e_hdf_t *) malloc(sizeof(e_hdf_t) + chips + emems);
+	if (desc) {
+		*desc			= b->hdr;
+		desc->magic		= E_HDF_MAGIC;
+		desc->format	= E_HDF_FORMAT;
+		desc->size		= sizeof(e_hdf_t) + chips + emems;
+		desc->chip_off	= sizeof(e_hdf_t);
+		desc->emem_off	= sizeof(e_hdf_t) + chips;
+		memcpy((char *) desc + desc->chip_off, b->chip, chips);
+		memcpy((char *) desc + desc->emem_off, b->emem, emems);
+		desc->checksum	= hdf_checksum(desc);
+	}
+
+	free(b);
+
+	return desc;
+}
+
+
+////////////////////////////////////
+// Text HDF
+
+static e_hdf_t *hdf_parse_simple(const char *hdf)
+{
+	FILE		 *fp;
+	hdf_build_t	 *b;
+	e_hdf_chip_t *curr_chip = NULL;
+	e_hdf_emem_t *curr_emem = NULL;
+	char		  line[255], etag[255], eval[255];
+	int			  l = 0;
+
+	fp = fopen(hdf, "r");
+	if (fp == NULL)
+	{
+		warnx("ee_parse_simple_hdf(): Can't open Hardware Definition File (HDF) %s.", hdf);
+		return NULL;
+	}
+
+	b = hdf_build_new();
+	if (!b)
+	{
+		fclose(fp);
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		l++;
+		ee_trim_str(line);
+		if (!strcmp(line, ""))
+			continue;
+		eval[0] = '\0';
+		sscanf(line, "%254s %254s", etag, eval);
+		diag(H_D3) { fprintf(diag_fd, "ee_parse_simple_hdf(): line %d: %s %s\n", l, etag, eval); }
+
+		// Comments
+		if (!strncmp("//", etag, 2))
+			continue;
+
+		// Platform definition
+		if		(!strcmp("PLATFORM_VERSION", etag))
+			hdf_strcpy(b->hdr.version, eval, sizeof(b->hdr.version));
+
+		else if (!strcmp("NUM_CHIPS", etag))
+			b->num_chips = atoi(eval);
+
+		else if (!strcmp("NUM_EXT_MEMS", etag))
+			b->num_emems = atoi(eval);
+
+		else if (!strcmp("ESYS_REGS_BASE", etag)) {
+			diag(H_D3) { fprintf(diag_fd, "Ignoring deprecated ESYS_REGS_BASE\n"); }
+		}
+
+		// Chip definition
+		else if (!strcmp("CHIP", etag))
+		{
+			if (!(curr_chip = hdf_add_chip(b)))
+				break;
+			hdf_strcpy(curr_chip->version, eval, sizeof(curr_chip->version));
+			hdf_chip_from_table(curr_chip);
+		}
+
+		else if (!strcmp("CHIP_ROW", etag) && curr_chip)
+			curr_chip->row = strtoul(eval, NULL, 10);
+
+		else if (!strcmp("CHIP_COL", etag) && curr_chip)
+			curr_chip->col = strtoul(eval, NULL, 10);
+
+		// External memory definitions
+		else if (!strcmp("EMEM", etag))
+		{
+			if (!(curr_emem = hdf_add_emem(b)))
+				break;
+			hdf_strcpy(curr_emem->name, eval, sizeof(curr_emem->name));
+		}
+
+		else if (!strcmp("EMEM_BASE_ADDRESS", etag) && curr_emem)
+			curr_emem->phy_base = strtoul(eval, NULL, 16);
+
+		else if (!strcmp("EMEM_EPI_BASE", etag) && curr_emem)
+			curr_emem->ephy_base = strtoul(eval, NULL, 16);
+
+		else if (!strcmp("EMEM_SIZE", etag) && curr_emem)
+			curr_emem->size = strtoul(eval, NULL, 16);
+
+		else if (!strcmp("EMEM_TYPE", etag) && curr_emem)
+			curr_emem->type = hdf_memtype(eval);
+
+		else
+			break;
+	}
+
+	if (!feof(fp))
+	{
+		warnx("ee_parse_simple_hdf(): %s line %d: unexpected \"%s\".", hdf, l, line);
+		fclose(fp);
+		free(b);
+		return NULL;
+	}
+
+	fclose(fp);
+
+	return hdf_build_finish(b, hdf);
+}
+
+
+////////////////////////////////////
+// XML HDF
+
+// Replace the predefined entities in place
+static void hdf_xml_unescape(char *s)
+{
+	static const struct { const char *ent; char c; } ents[] = {
+		{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''},
+	};
+	char	*d = s;
+	unsigned i;
+
+	while (*s) {
+		for (i = 0; i < sizeof(ents) / sizeof(ents[0]); i++)
+			if (!strncmp(s, ents[i].ent, strlen(ents[i].ent)))
+				break;
+		if (i < sizeof(ents) / sizeof(ents[0])) {
+			*d++ = ents[i].c;
+			s	+= strlen(ents[i].ent);
+		} else {
+			*d++ = *s++;
+		}
+	}
+	*d = '\0';
+}
+
+// Split the next start tag into its name and attributes, in place. Returns
+// the position after the tag, or NULL at the end of the document or on a
+// syntax error (*err set).
+static char *hdf_xml_next(char *p, char **name, hdf_xml_attr_t *attrs, int *nattrs, int *err)
+{
+	char quote;
+
+	*err = 0;
+	while ((p = strchr(p, '<'))) {
+		if (!strncmp(p, "<!--", 4)) {
+			p = strstr(p + 4, "-->");
+			if (!p)
+				break;
+			p += 3;
+		} else if (p[1] == '?' || p[1] == '!' || p[1] == '/') {
+			p = strchr(p, '>');
+			if (!p)
+				break;
+			p++;
+		} else {
+			break;
+		}
+	}
+	if (!p) {
+		return NULL;
+	}
+
+	// Element name
+	*name = ++p;
+	while (*p && !isspace((unsigned char) *p) && *p != '>' && *p != '/')
+		p++;
+
+	// Attributes
+	*nattrs = 0;
+	while (1) {
+		while (isspace((unsigned char) *p))
+			*p++ = '\0';
+		if (*p == '/' || *p == '>') {
+			*p = '\0';
+			return p + 1;
+		}
+		if (!*p || *nattrs == HDF_MAX_XML_ATTRS)
+			break;
+
+		attrs[*nattrs].name = p;
+		while (*p && *p != '=' && !isspace((unsigned char) *p))
+			p++;
+		while (isspace((unsigned char) *p))
+			*p++ = '\0';
+		if (*p != '=')
+			break;
+		*p++ = '\0';
+		while (isspace((unsigned char) *p))
+			p++;
+		if (*p != '"' && *p != '\'')
+			break;
+		quote = *p++;
+		attrs[*nattrs].value = p;
+		p = strchr(p, quote);
+		if (!p)
+			break;
+		*p++ = '\0';
+		hdf_xml_unescape(attrs[*nattrs].value);
+		(*nattrs)++;
+	}
+
+	*err = 1;
+	return NULL;
+}
+
+static const char *hdf_xml_attr(hdf_xml_attr_t *attrs, int nattrs, const char *name)
+{
+	int i;
+
+	for (i = 0; i < nattrs; i++)
+		if (!strcmp(attrs[i].name, name))
+			return attrs[i].value;
+
+	return NULL;
+}
+
+static e_hdf_t *hdf_parse_xml(const char *hdf)
+{
+	hdf_xml_attr_t attrs[HDF_MAX_XML_ATTRS];
+	hdf_build_t	  *b = NULL;
+	e_hdf_chip_t  *curr_chip = NULL;
+	e_hdf_emem_t  *curr_emem;
+	const char	  *v, *ver;
+	struct stat	   st;
+	char		  *doc = NULL, *p, *name = "";
+	int			   fd, nattrs, err = 0;
+
+	fd = open(hdf, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || !(doc = (char *) malloc(st.st_size + 1)) ||
+		read(fd, doc, st.st_size) != st.st_size)
+	{
+		warnx("ee_parse_xml_hdf(): Can't read Hardware Definition File (HDF) %s.", hdf);
+		goto out;
+	}
+	doc[st.st_size] = '\0';
+
+	b = hdf_build_new();
+	if (!b)
+		goto out;
+
+	p = doc;
+	while ((p = hdf_xml_next(p, &name, attrs, &nattrs, &err)))
+	{
+		diag(H_D3) { fprintf(diag_fd, "ee_parse_xml_hdf(): element <%s>, %d attributes\n", name, nattrs); }
+
+		if (!strcmp(name, "platform"))
+		{
+			if ((v = hdf_xml_attr(attrs, nattrs, "name")))
+				hdf_strcpy(b->hdr.name, v, sizeof(b->hdr.name));
+			if ((v = hdf_xml_attr(attrs, nattrs, "lib")))
+				hdf_strcpy(b->hdr.lib, v, sizeof(b->hdr.lib));
+			if ((v = hdf_xml_attr(attrs, nattrs, "libinitargs")))
+				hdf_strcpy(b->hdr.libinitargs, v, sizeof(b->hdr.libinitargs));
+			// PLATFORM_VERSION of the text HDF, older XMLs only have the name
+			v = hdf_xml_attr(attrs, nattrs, "platform_version");
+			hdf_strcpy(b->hdr.version, v ? v : b->hdr.name, sizeof(b->hdr.version));
+		}
+
+		else if (!strcmp(name, "chip"))
+		{
+			if (!(curr_chip = hdf_add_chip(b)))
+				break;
+			if (!(v = hdf_xml_attr(attrs, nattrs, "id")) ||
+				sscanf(v, "(%u,%u)", &curr_chip->row, &curr_chip->col) != 2)
+				break;
+
+			ver = hdf_xml_attr(attrs, nattrs, "version");
+			if (ver && !isdigit((unsigned char) ver[0])) {
+				// A chip name, as in the text HDF
+				hdf_strcpy(curr_chip->version, ver, sizeof(curr_chip->version));
+				hdf_chip_from_table(curr_chip);
+			} else {
+				curr_chip->arch = ver ? strtoul(ver, NULL, 0) : 0;
+			}
+			if ((v = hdf_xml_attr(attrs, nattrs, "rows")))
+				curr_chip->rows = strtoul(v, NULL, 0);
+			if ((v = hdf_xml_attr(attrs, nattrs, "cols")))
+				curr_chip->cols = strtoul(v, NULL, 0);
+			if ((v = hdf_xml_attr(attrs, nattrs, "core_memory_size")))
+				curr_chip->sram_size = strtoul(v, NULL, 0);
+			if ((v = hdf_xml_attr(attrs, nattrs, "host_base")))
+				curr_chip->host_base = strtoul(v, NULL, 0);
+			if (!curr_chip->version[0])
+				hdf_strcpy(curr_chip->version, ee_chip_version(curr_chip->arch, curr_chip->rows, curr_chip->cols),
+						   sizeof(curr_chip->version));
+		}
+
+		else if (!strcmp(name, "ioregs") && curr_chip)
+		{
+			if ((v = hdf_xml_attr(attrs, nattrs, "row")))
+				curr_chip->ioreg_row = strtoul(v, NULL, 0);
+			if ((v = hdf_xml_attr(attrs, nattrs, "col")))
+				curr_chip->ioreg_col = strtoul(v, NULL, 0);
+		}
+
+		else if (!strcmp(name, "bank"))
+		{
+			if (!(curr_emem = hdf_add_emem(b)) ||
+				!(v = hdf_xml_attr(attrs, nattrs, "start")))
+				break;
+			curr_emem->ephy_base = strtoul(v, NULL, 0);
+			curr_emem->phy_base	 = curr_emem->ephy_base;
+			if ((v = hdf_xml_attr(attrs, nattrs, "host_start")))
+				curr_emem->phy_base = strtoul(v, NULL, 0);
+			if ((v = hdf_xml_attr(attrs, nattrs, "size")))
+				curr_emem->size = strtoul(v, NULL, 0);
+			if ((v = hdf_xml_attr(attrs, nattrs, "name")))
+				hdf_strcpy(curr_emem->name, v, sizeof(curr_emem->name));
+			if ((v = hdf_xml_attr(attrs, nattrs, "type")))
+				curr_emem->type = hdf_memtype(v);
+		}
+	}
+
+	if (p || err)
+	{
+		warnx("ee_parse_xml_hdf(): %s: malformed or incomplete <%s> element.", hdf, err ? "?" : name);
+		free(b);
+		b = NULL;
+	}
+
+ out:
+	if (fd >= 0)
+		close(fd);
+	free(doc);
+
+	return b ? hdf_build_finish(b, hdf) : NULL;
+}
+
+
+////////////////////////////////////
+// Compiled HDF
+
+static int hdf_check(e_hdf_t *desc, off_t size, const char *hdf)
+{
+	if (desc->format != E_HDF_FORMAT)
+	{
+		warnx("e_hdf_load(): %s is in compiled HDF format %u, expected %u. Compile it again.",
+			  hdf, desc->format, E_HDF_FORMAT);
+		return E_ERR;
+	}
+
+	// Counts are checked against the room after their offset, so nothing
+	// can wrap on a 32-bit host, and the arrays are used in place
+	if (desc->size != size ||
+		desc->chip_off < sizeof(e_hdf_t) || desc->chip_off > desc->size ||
+		desc->emem_off < sizeof(e_hdf_t) || desc->emem_off > desc->size ||
+		desc->chip_off % __alignof__(e_hdf_chip_t) || desc->emem_off % __alignof__(e_hdf_emem_t) ||
+		desc->num_chips > HDF_MAX_CHIPS || desc->num_emems > HDF_MAX_EMEMS ||
+		desc->num_chips > (desc->size - desc->chip_off) / sizeof(e_hdf_chip_t) ||
+		desc->num_emems > (desc->size - desc->emem_off) / sizeof(e_hdf_emem_t) ||
+		desc->checksum != hdf_checksum(desc))
+	{
+		warnx("e_hdf_load(): %s has a bad checksum or layout.", hdf);
+		return E_ERR;
+	}
+
+	return E_OK;
+}
+
+static e_hdf_t *hdf_load_compiled(int fd, const char *hdf)
+{
+	e_hdf_t	   *desc;
+	struct stat st;
+
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(e_hdf_t))
+	{
+		warnx("e_hdf_load(): %s is truncated.", hdf);
+		return NULL;
+	}
+
+	// A single read is cheaper than setting up a mapping for the usual
+	// description of a few hundred bytes
+	if (st.st_size <= HDF_READ_MAX)
+	{
+		desc = (e_hdf_t *) malloc(st.st_size);
+		if (!desc)
+			return NULL;
+		if (pread(fd, desc, st.st_size, 0) != st.st_size ||
+			E_OK != hdf_check(desc, st.st_size, hdf))
+		{
+			free(desc);
+			return NULL;
+		}
+		desc->flags = 0;
+
+		return desc;
+	}
+
+	// Private and writable so that the flags can be set, nothing else is
+	// written and only the first page is ever copied
+	desc = (e_hdf_t *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (desc == MAP_FAILED)
+	{
+		warnx("e_hdf_load(): Can't map %s.", hdf);
+		return NULL;
+	}
+
+	if (E_OK != hdf_check(desc, st.st_size, hdf))
+	{
+		munmap(desc, st.st_size);
+		return NULL;
+	}
+	desc->flags = E_HDF_MAPPED;
+
+	return desc;
+}
+
+
+e_hdf_t *e_hdf_load(const char *hdf)
+{
+	e_hdf_t *desc = NULL;
+	char	 head[64];
+	uint32_t magic = 0;
+	ssize_t	 n;
+	int		 fd, i;
+
+	fd = open(hdf, O_RDONLY);
+	if (fd < 0)
+	{
+		warnx("e_hdf_load(): Can't open Hardware Definition File (HDF) %s.", hdf);
+		return NULL;
+	}
+
+	n = read(fd, head, sizeof(head) - 1);
+	if (n < 0)
+		n = 0;
+	head[n] = '\0';
+
+	for (i = 0; i < n && isspace((unsigned char) head[i]); i++)
+		;
+
+	if (n >= (ssize_t) sizeof(magic))
+		memcpy(&magic, head, sizeof(magic));
+
+	if (magic == E_HDF_MAGIC)
+		desc = hdf_load_compiled(fd, hdf);
+	else if (head[i] == '<')
+		desc = hdf_parse_xml(hdf);
+	else
+		desc = hdf_parse_simple(hdf);
+
+	close(fd);
+
+	diag(H_D2) { if (desc) fprintf(diag_fd, "e_hdf_load(): %s: platform \"%s\", %u chips, %u memory segments%s\n",
+								   hdf, desc->version, desc->num_chips, desc->num_emems,
+								   (desc->flags & E_HDF_MAPPED) ? ", mapped" : ""); }
+
+	return desc;
+}
+
+
+int e_hdf_save(const e_hdf_t *desc, const char *path)
+{
+	e_hdf_t hdr;
+	char	tmp[4096];
+	FILE   *fp;
+	int		ok;
+
+	// Write a copy and rename it, a running e_init() never sees half a file
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+	fp = fopen(tmp, "wb");
+	if (!fp)
+	{
+		warnx("e_hdf_save(): Can't create %s.", tmp);
+		return E_ERR;
+	}
+
+	hdr		  = *desc;
+	hdr.flags = 0;
+	ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1) &&
+		 (fwrite((const char *) desc + sizeof(hdr), desc->size - sizeof(hdr), 1, fp) == 1);
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmp, path))
+	{
+		warnx("e_hdf_save(): Can't write %s.", path);
+		unlink(tmp);
+		return E_ERR;
+	}
+
+	return E_OK;
+}
+
+
+void e_hdf_free(e_hdf_t *desc)
+{
+	if (!desc)
+		return;
+
+	if (desc->flags & E_HDF_MAPPED)
+		munmap(desc, desc->size);
+	else
+		free(desc);
+}
+
+
+////////////////////////////////////
+// HDF parser
+
+static int ee_platform_from_hdf(e_platform_t *dev, e_hdf_t *desc)
+{
+	const e_hdf_chip_t *chip;
+	const e_hdf_emem_t *emem;
+	unsigned			i;
+
+	if (!desc)
+		return E_ERR;
+
+	chip = E_HDF_CHIPS(desc);
+	emem = E_HDF_EMEMS(desc);
+
+	hdf_strcpy(dev->version, desc->version, sizeof(dev->version));
+
+	dev->num_chips = desc->num_chips;
+	dev->chip	   = (e_chip_t *) calloc(desc->num_chips, sizeof(e_chip_t));
+	dev->num_emems = desc->num_emems;
+	dev->emem	   = (e_memseg_t *) calloc(desc->num_emems ? desc->num_emems : 1, sizeof(e_memseg_t));
+	if (!dev->chip || !dev->emem)
+	{
+		e_hdf_free(desc);
+		return E_ERR;
+	}
+
+	// The chip parameters are filled in from the chip table by e_init()
+	for (i = 0; i < desc->num_chips; i++)
+	{
+		dev->chip[i].objtype = E_EPI_CHIP;
+		hdf_strcpy(dev->chip[i].version, chip[i].version, sizeof(dev->chip[i].version));
+		dev->chip[i].row	 = chip[i].row;
+		dev->chip[i].col	 = chip[i].col;
+	}
+
+	for (i = 0; i < desc->num_emems; i++)
+	{
+		dev->emem[i].objtype   = E_EXT_MEM;
+		dev->emem[i].phy_base  = emem[i].phy_base;
+		dev->emem[i].ephy_base = emem[i].ephy_base;
+		dev->emem[i].size	   = emem[i].size;
+		dev->emem[i].type	   = (e_memtype_t) emem[i].type;
+	}
+
+	e_hdf_free(desc);
+
+	return E_OK;
+}
+
+int ee_parse_hdf(e_platform_t *dev, char *hdf)
+{
+	return ee_platform_from_hdf(dev, e_hdf_load(hdf));
+}
+
+int ee_parse_simple_hdf(e_platform_t *dev, char *hdf)
+{
+	return ee_platform_from_hdf(dev, hdf_parse_simple(hdf));
+}
+
+int ee_parse_xml_hdf(e_platform_t *dev, char *hdf)
+{
+	return ee_platform_from_hdf(dev, hdf_parse_xml(hdf));
+}
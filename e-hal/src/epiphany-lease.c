@@ -0,0 +1,581 @@
+/*
+  File: epiphany-lease.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.	 If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Workgroup leases.
+ *
+ * Processes that share a board reserve their workgroups through a lease
+ * file. Each line of the file holds one lease, "pid start row col rows cols",
+ * with the start time of the process from /proc/<pid>/stat and the
+ * coordinates relative to the platform like those of e_open(). The file is
+ * always read and rewritten as a whole under flock(), and the leases of
+ * processes that no longer exist are dropped whenever it is read, so a
+ * crashed job never keeps its cores. The start time tells a recycled pid
+ * from the process that took the lease.
+ *
+ * The file lives in a directory the administrator sets up for the group
+ * of the users that share the board, e.g.
+ *
+ *     install -d -m 2770 -g epiphany /run/epiphany
+ *
+ * The file gets the group of the directory and mode 0660. A directory
+ * that others can write to is refused, and a lease that does not fit the
+ * platform is dropped like a stale one. Without the directory there are
+ * no leases and e_open() does not check for them.
+ *
+ * A changed table is written to a new file that is renamed over the old
+ * one, so a crash never leaves a partial table behind. A process that
+ * locked the old file after the rename sees that the path moved on and
+ * opens it again.
+ *
+ * e_open() refuses a workgroup that overlaps a lease of another process,
+ * and e_reset_system() refuses to reset the chip while other processes
+ * hold leases. e_reset_group() is the way to reset a leased workgroup.
+ *
+ * The emulated platform only exists within one process, so its leases are
+ * kept in an anonymous temporary file instead.
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "epiphany-hal.h"
+#include "epiphany-hal-api-local.h"
+#include "emu-target.h"
+
+extern e_platform_t e_platform;
+extern int e_host_verbose;
+#define diag(vN) if (e_host_verbose >= vN)
+
+#define LEASE_FILE_ENV  "EPIPHANY_LEASES"
+#define LEASE_DIR_DFL   "/run/epiphany"
+#define LEASE_FILE_DFL  LEASE_DIR_DFL "/leases"
+#define LEASE_FILE_MODE 0660
+#define LEASE_LINE_MAX  96
+
+typedef struct {
+	pid_t		 pid;
+	unsigned long long start;  // start time of the process, in clock ticks
+	unsigned	 row;
+	unsigned	 col;
+	unsigned	 rows;
+	unsigned	 cols;
+} lease_t;
+
+typedef struct {
+	int			 fd;
+	const char	*path;
+	lease_t		*lease;
+	unsigned	 num;
+	e_bool_t	 dirty;       // lease[] differs from the file
+} lease_table_t;
+
+// flock() does not keep apart threads that share an open file, which the
+// emulated platform does, so threads are serialized here as well.
+static pthread_mutex_t lease_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int			   emu_lease_fd = -1;
+
+
+/* Start time of a process, 0 if it does not exist. */
+static unsigned long long lease_start_time(pid_t pid)
+{
+	unsigned long long start = 0;
+	char	 path[32], buf[512], *p;
+	ssize_t	 len;
+	int		 fd, field;
+
+	snprintf(path, sizeof(path), "/proc/%ld/stat", (long) pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ( -1 == fd )
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if ( len <= 0 )
+		return 0;
+	buf[len] = '\0';
+
+	// The name (field 2) may hold blanks, so count the fields from the last
+	// ')'. Each step moves p to the blank before field + 1.
+	p = strrchr(buf, ')');
+	for ( field = 2; p && field < 22; field++ )
+		p = strchr(p + 1, ' ');
+	if ( p )
+		sscanf(p + 1, "%llu", &start);
+
+	return start;
+}
+
+static e_bool_t lease_alive(const lease_t *l)
+{
+	return (l->start && lease_start_time(l->pid) == l->start) ? E_TRUE : E_FALSE;
+}
+
+static e_bool_t lease_valid(const lease_t *l)
+{
+	return (l->pid > 0 && l->rows && l->cols &&
+			l->row < e_platform.rows && l->rows <= e_platform.rows - l->row &&
+			l->col < e_platform.cols && l->cols <= e_platform.cols - l->col) ? E_TRUE : E_FALSE;
+}
+
+static e_bool_t lease_overlaps(const lease_t *l, unsigned row, unsigned col, unsigned rows, unsigned cols)
+{
+	return (l->row < row + rows && row < l->row + l->rows &&
+			l->col < col + cols && col < l->col + l->cols) ? E_TRUE : E_FALSE;
+}
+
+static int lease_parse(lease_table_t *tbl, char *text)
+{
+	char	*line, *save;
+	unsigned lines = 1;
+	long	 pid;
+	lease_t	 l;
+	char	*p;
+
+	for ( p = text; *p; p++ )
+		if ( '\n' == *p )
+			lines++;
+
+	tbl->lease = (lease_t *) calloc(lines, sizeof(lease_t));
+	if ( !tbl->lease )
+		return E_ERR;
+
+	for ( line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save) ) {
+		if ( 6 != sscanf(line, "%ld %llu %u %u %u %u", &pid, &l.start, &l.row, &l.col, &l.rows, &l.cols) ||
+			 (l.pid = (pid_t) pid) != pid || !lease_valid(&l) ) {
+			diag(H_D1) { fprintf(stderr, "lease_parse(): ignoring bad lease \"%s\"\n", line); }
+			tbl->dirty = E_TRUE;
+			continue;
+		}
+		if ( !lease_alive(&l) ) {
+			diag(H_D1) { fprintf(stderr, "lease_parse(): reclaiming lease (%u,%u,%u,%u) of dead process %ld\n",
+								 l.row, l.col, l.rows, l.cols, pid); }
+			tbl->dirty = E_TRUE;
+			continue;
+		}
+		tbl->lease[tbl->num++] = l;
+	}
+
+	return E_OK;
+}
+
+/* Open the lease file, creating it if needed. The directory must not be
+ * writable by others, and the file is neither followed through a symbolic
+ * link nor accepted with extra hard links. */
+static int lease_open_file(const char *path, const char *fn)
+{
+	char		 dir[PATH_MAX];
+	struct stat	 dst, st;
+	int			 fd;
+
+	if ( strlen(path) >= sizeof(dir) ) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(dir, path);
+	if ( stat(dirname(dir), &dst) )
+		return -1;
+	if ( !S_ISDIR(dst.st_mode) || (dst.st_mode & S_IWOTH) ) {
+		warnx("%s(): The lease directory %s must not be writable by others.", fn, dir);
+		errno = EPERM;
+		return -1;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, LEASE_FILE_MODE);
+	if ( -1 != fd ) {
+		// Shared by the group of the directory, whatever the umask is
+		if ( fchown(fd, (uid_t) -1, dst.st_gid) || fchmod(fd, LEASE_FILE_MODE) ) {
+			diag(H_D1) { fprintf(stderr, "%s(): cannot share the lease file: %s\n", fn, strerror(errno)); }
+		}
+		return fd;
+	}
+	if ( EEXIST != errno )
+		return -1;
+
+	fd = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	if ( -1 == fd )
+		return -1;
+	// No link left means the file was just replaced, lease_open() retries
+	if ( fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_nlink > 1 || (st.st_mode & S_IWOTH) ) {
+		warnx("%s(): Refusing the lease file %s, it is not a private regular file.", fn, path);
+		close(fd);
+		errno = EPERM;
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Lock the lease table and read it. */
+static int lease_open(lease_table_t *tbl, const char *fn)
+{
+	const char	*path;
+	struct stat	 st, pst;
+	char		*text;
+	ssize_t		 len;
+	FILE		*fp;
+	int			 open_errno;
+
+	memset(tbl, 0, sizeof(*tbl));
+	tbl->fd = -1;
+
+	path = getenv(LEASE_FILE_ENV);
+	if ( !path )
+		path = LEASE_FILE_DFL;
+	tbl->path = path;
+
+	pthread_mutex_lock(&lease_mutex);
+
+ again:
+	if ( emu_target_p() ) {
+		if ( -1 == emu_lease_fd && (fp = tmpfile()) ) {
+			emu_lease_fd = dup(fileno(fp));
+			fclose(fp);
+		}
+		tbl->fd = emu_lease_fd;
+	} else {
+		tbl->fd = lease_open_file(path, fn);
+	}
+
+	if ( -1 == tbl->fd ) {
+		open_errno = errno;
+		if ( ENOENT == open_errno ) {
+			// Leases are not set up on this machine
+			diag(H_D1) { fprintf(stderr, "%s(): no lease file %s\n", fn, path); }
+		} else if ( EPERM != open_errno ) {
+			warnx("%s(): Cannot open the lease file. Error is %s", fn, strerror(open_errno));
+		}
+		errno = open_errno;
+		goto err;
+	}
+
+	if ( flock(tbl->fd, LOCK_EX) || fstat(tbl->fd, &st) ) {
+		warnx("%s(): Cannot lock the lease file. Error is %s", fn, strerror(errno));
+		goto err;
+	}
+
+	// The table was replaced while we waited for the lock
+	if ( tbl->fd != emu_lease_fd &&
+		 (stat(path, &pst) || pst.st_dev != st.st_dev || pst.st_ino != st.st_ino) ) {
+		close(tbl->fd);
+		goto again;
+	}
+
+	text = (char *) malloc(st.st_size + 1);
+	if ( !text )
+		goto err;
+
+	len = pread(tbl->fd, text, st.st_size, 0);
+	text[len > 0 ? len : 0] = '\0';
+
+	if ( E_OK != lease_parse(tbl, text) ) {
+		free(text);
+		goto err;
+	}
+
+	free(text);
+	return E_OK;
+
+ err:
+	if ( -1 != tbl->fd && tbl->fd != emu_lease_fd )
+		close(tbl->fd);
+	pthread_mutex_unlock(&lease_mutex);
+	return E_ERR;
+}
+
+/* Replace the lease file with text. The new file is complete before it
+ * becomes visible under the path. */
+static int lease_write(lease_table_t *tbl, const char *text, size_t len)
+{
+	char		 tmp[PATH_MAX];
+	struct stat	 st;
+	int			 fd;
+
+	// The emulated leases never leave this process and the mutex
+	if ( tbl->fd == emu_lease_fd )
+		return (ftruncate(tbl->fd, 0) || (ssize_t) len != pwrite(tbl->fd, text, len, 0)) ? E_ERR : E_OK;
+
+	if ( (size_t) snprintf(tmp, sizeof(tmp), "%s.XXXXXX", tbl->path) >= sizeof(tmp) ) {
+		errno = ENAMETOOLONG;
+		return E_ERR;
+	}
+	fd = mkstemp(tmp);
+	if ( -1 == fd )
+		return E_ERR;
+
+	// Same group and mode as the file it replaces
+	if ( fstat(tbl->fd, &st) || fchown(fd, (uid_t) -1, st.st_gid) ) {
+		diag(H_D1) { fprintf(stderr, "lease_write(): cannot share the lease file: %s\n", strerror(errno)); }
+	}
+	if ( fchmod(fd, LEASE_FILE_MODE) || (ssize_t) len != write(fd, text, len) || rename(tmp, tbl->path) ) {
+		unlink(tmp);
+		close(fd);
+		return E_ERR;
+	}
+
+	close(fd);
+	return E_OK;
+}
+
+/* Write the lease table back if it changed and unlock it. */
+static int lease_close(lease_table_t *tbl)
+{
+	char	 line[LEASE_LINE_MAX];
+	char	*text;
+	size_t	 len = 0;
+	unsigned i;
+	int		 retval = E_OK;
+
+	if ( tbl->dirty ) {
+		text = (char *) malloc((size_t) tbl->num * LEASE_LINE_MAX + 1);
+		if ( text ) {
+			for ( i = 0; i < tbl->num; i++ ) {
+				snprintf(line, sizeof(line), "%ld %llu %u %u %u %u\n", (long) tbl->lease[i].pid,
+						 tbl->lease[i].start, tbl->lease[i].row, tbl->lease[i].col, tbl->lease[i].rows, tbl->lease[i].cols);
+				memcpy(text + len, line, strlen(line));
+				len += strlen(line);
+			}
+			retval = lease_write(tbl, text, len);
+			free(text);
+		} else {
+			retval = E_ERR;
+		}
+	}
+
+	flock(tbl->fd, LOCK_UN);
+	if ( tbl->fd != emu_lease_fd )
+		close(tbl->fd);
+	free(tbl->lease);
+	pthread_mutex_unlock(&lease_mutex);
+
+	return retval;
+}
+
+static e_bool_t lease_is_free(lease_table_t *tbl, unsigned row, unsigned col, unsigned rows, unsigned cols)
+{
+	unsigned i;
+
+	for ( i = 0; i < tbl->num; i++ )
+		if ( lease_overlaps(&tbl->lease[i], row, col, rows, cols) )
+			return E_FALSE;
+
+	return E_TRUE;
+}
+
+/* Number of cells on the border of the rectangle that touch the edge of
+ * the platform or a leased core. Packing the groups against each other
+ * keeps the free area in large pieces. */
+static unsigned lease_contact(lease_table_t *tbl, unsigned row, unsigned col, unsigned rows, unsigned cols)
+{
+	unsigned contact = 0, i;
+
+	for ( i = 0; i < cols; i++ ) {
+		contact += (row == 0 || !lease_is_free(tbl, row - 1, col + i, 1, 1));
+		contact += (row + rows == e_platform.rows || !lease_is_free(tbl, row + rows, col + i, 1, 1));
+	}
+	for ( i = 0; i < rows; i++ ) {
+		contact += (col == 0 || !lease_is_free(tbl, row + i, col - 1, 1, 1));
+		contact += (col + cols == e_platform.cols || !lease_is_free(tbl, row + i, col + cols, 1, 1));
+	}
+
+	return contact;
+}
+
+
+/* Remove a lease of this process. */
+static int lease_drop(unsigned row, unsigned col, unsigned rows, unsigned cols, const char *fn)
+{
+	lease_table_t tbl;
+	unsigned	  i;
+	int			  retval = E_ERR;
+
+	if ( E_OK != lease_open(&tbl, fn) )
+		return E_ERR;
+
+	for ( i = 0; i < tbl.num; i++ ) {
+		if ( tbl.lease[i].pid == getpid() && tbl.lease[i].row == row && tbl.lease[i].col == col &&
+			 tbl.lease[i].rows == rows && tbl.lease[i].cols == cols ) {
+			tbl.lease[i] = tbl.lease[--tbl.num];
+			tbl.dirty = E_TRUE;
+			retval = E_OK;
+			break;
+		}
+	}
+
+	if ( E_OK != lease_close(&tbl) )
+		retval = E_ERR;
+
+	return retval;
+}
+
+
+int ee_lease_check(unsigned row, unsigned col, unsigned rows, unsigned cols)
+{
+	lease_table_t tbl;
+	unsigned	  i;
+	int			  retval = E_OK;
+
+	if ( E_OK != lease_open(&tbl, "e_open") ) {
+		// Without a lease file there is nobody to coordinate with
+		return E_OK;
+	}
+
+	for ( i = 0; i < tbl.num; i++ ) {
+		if ( tbl.lease[i].pid != getpid() &&
+			 lease_overlaps(&tbl.lease[i], row, col, rows, cols) ) {
+			warnx("e_open(): Cores (%u,%u,%u,%u) are leased by process %ld.",
+				  tbl.lease[i].row, tbl.lease[i].col, tbl.lease[i].rows, tbl.lease[i].cols,
+				  (long) tbl.lease[i].pid);
+			errno = EBUSY;
+			retval = E_ERR;
+			break;
+		}
+	}
+
+	lease_close(&tbl);
+	return retval;
+}
+
+unsigned ee_lease_others(void)
+{
+	lease_table_t tbl;
+	unsigned	  i, n = 0;
+
+	if ( E_OK != lease_open(&tbl, "e_reset_system") )
+		return 0;
+
+	for ( i = 0; i < tbl.num; i++ )
+		if ( tbl.lease[i].pid != getpid() )
+			n++;
+
+	lease_close(&tbl);
+	return n;
+}
+
+int e_reserve_group(e_epiphany_t *dev, unsigned rows, unsigned cols)
+{
+	lease_table_t tbl;
+	lease_t		 *grown;
+	unsigned	  row, col, contact, best_contact = 0;
+	e_bool_t	  found = E_FALSE;
+	lease_t		  l;
+
+	if ( e_platform.initialized == E_FALSE ) {
+		warnx("e_reserve_group(): Platform was not initialized. Use e_init().");
+		return E_ERR;
+	}
+
+	if ( !rows || !cols || rows > e_platform.rows || cols > e_platform.cols ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	if ( E_OK != lease_open(&tbl, "e_reserve_group") ) {
+		if ( ENOENT == errno )
+			warnx("e_reserve_group(): Leases are not set up, the lease directory does not exist.");
+		return E_ERR;
+	}
+
+	// Best fit: the free position whose border touches the most leased
+	// cores and platform edges, the first one in row-major order on ties.
+	for ( row = 0; row + rows <= e_platform.rows; row++ ) {
+		for ( col = 0; col + cols <= e_platform.cols; col++ ) {
+			if ( !lease_is_free(&tbl, row, col, rows, cols) )
+				continue;
+			contact = lease_contact(&tbl, row, col, rows, cols);
+			if ( !found || contact > best_contact ) {
+				found = E_TRUE;
+				best_contact = contact;
+				l.row = row;
+				l.col = col;
+			}
+		}
+	}
+
+	if ( !found ) {
+		diag(H_D1) { fprintf(stderr, "e_reserve_group(): no free %ux%u workgroup\n", rows, cols); }
+		lease_close(&tbl);
+		errno = EBUSY;
+		return E_ERR;
+	}
+
+	grown = (lease_t *) realloc(tbl.lease, (tbl.num + 1) * sizeof(lease_t));
+	if ( !grown ) {
+		lease_close(&tbl);
+		errno = ENOMEM;
+		return E_ERR;
+	}
+	l.pid	   = getpid();
+	l.start	   = lease_start_time(l.pid);
+	l.rows	   = rows;
+	l.cols	   = cols;
+	tbl.lease  = grown;
+	tbl.lease[tbl.num++] = l;
+	tbl.dirty  = E_TRUE;
+
+	if ( E_OK != lease_close(&tbl) ) {
+		warnx("e_reserve_group(): Failed to write the lease file.");
+		return E_ERR;
+	}
+
+	diag(H_D1) { fprintf(stderr, "e_reserve_group(): leased (%u,%u,%u,%u)\n", l.row, l.col, rows, cols); }
+
+	if ( E_OK != e_open(dev, l.row, l.col, rows, cols) ) {
+		lease_drop(l.row, l.col, rows, cols, "e_reserve_group");
+		return E_ERR;
+	}
+
+	// A previous tenant may have left the cores running
+	if ( E_OK != e_reset_group(dev) ) {
+		e_release_group(dev);
+		return E_ERR;
+	}
+
+	return E_OK;
+}
+
+int e_release_group(e_epiphany_t *dev)
+{
+	int retval;
+
+	retval = lease_drop(dev->row - e_platform.row, dev->col - e_platform.col,
+						dev->rows, dev->cols, "e_release_group");
+	if ( E_OK != retval )
+		warnx("e_release_group(): The workgroup is not leased by this process.");
+
+	e_close(dev);
+
+	return retval;
+}
@@ -0,0 +1,294 @@
+/*
+  File: epiphany-mailbox.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.	 If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Core to host messages.
+ *
+ * A core sends a message with the e-lib e_mailbox_post(). When the driver
+ * has the e-link mailbox, the core writes the message to the mailbox
+ * register. The host waits for it with poll() on the device file and
+ * drains the FIFO with the mailbox ioctls. No host CPU is used while no
+ * message is pending. If poll() returns at once without a message, the
+ * driver has no poll support and the wait sleeps until the timeout.
+ *
+ * Older drivers, the simulator and the emulated platform have no mailbox.
+ * Every core then gets a single-producer ring in the "e_mailbox" shared
+ * region. The core only writes head and the host only writes tail.
+ * e_mailbox_read() drains the rings in turn, starting after the ring it
+ * stopped at the last time. While they are empty it spins for a while and
+ * then sleeps with a growing interval. The length of the spin adapts to
+ * the traffic. It gets longer when messages come during the spin and
+ * shorter when the wait had to sleep anyway.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "epiphany-hal.h"
+#include "epiphany-hal-api-local.h"
+#include "epiphany2.h"
+#include "esim-target.h"
+#include "emu-target.h"
+
+extern int e_host_verbose;
+#define diag(vN) if (e_host_verbose >= vN)
+
+extern e_platform_t e_platform;
+
+#define MAILBOX_SPIN_MIN   64
+#define MAILBOX_SPIN_MAX   (1 << 16)
+#define MAILBOX_SLEEP_MIN  50         // us
+#define MAILBOX_SLEEP_MAX  1000       // us
+
+
+static uint64_t mailbox_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Open the device if its driver has the mailbox, -1 otherwise
+static int mailbox_open_dev(void)
+{
+	int fd;
+
+	if (esim_target_p() || emu_target_p())
+		return -1;
+
+	fd = open(EPIPHANY_DEV, O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	if (ioctl(fd, E_IOCTL_MAILBOX_COUNT) < 0) {
+		diag(H_D1) { fprintf(stderr, "e_mailbox_open(): no mailbox in the driver, using shared memory\n"); }
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Move up to n messages from the rings, round robin over the cores
+static unsigned mailbox_drain_rings(e_mailbox_t *mb, e_mailbox_msg_t *msgs, unsigned n)
+{
+	e_mailbox_ring_t *ring;
+	unsigned		  i, r, head, tail, got = 0;
+
+	for (i = 0; i < mb->num_rings && got < n; i++) {
+		r	 = (mb->next + i) % mb->num_rings;
+		ring = &mb->hdr->ring[r];
+		head = ring->head;
+		tail = ring->tail;
+		if (head == tail)
+			continue;
+
+		__sync_synchronize();
+		while (tail != head && got < n) {
+			msgs[got++] = ring->msg[tail & (E_MAILBOX_RING - 1)];
+			tail++;
+		}
+		__sync_synchronize();
+		ring->tail = tail;
+
+		// A core with more pending is looked at first the next time
+		mb->next = (tail == head) ? r + 1 : r;
+	}
+
+	return got;
+}
+
+int e_mailbox_open(e_mailbox_t *mb)
+{
+	size_t	 size;
+	uint32_t gen;
+
+	memset(mb, 0, sizeof(*mb));
+	mb->spins	  = MAILBOX_SPIN_MIN;
+	mb->num_rings = e_platform.rows * e_platform.cols;
+	size		  = sizeof(e_mailbox_hdr_t) + mb->num_rings * sizeof(e_mailbox_ring_t);
+
+	if (E_OK != e_shm_alloc(&mb->mem, E_MAILBOX_SHM_NAME, size)) {
+		// Left behind by a process that did not close it
+		if (E_OK != e_shm_attach(&mb->mem, E_MAILBOX_SHM_NAME) || mb->mem.emap_size < size) {
+			warnx("e_mailbox_open(): Failed to allocate shared region %s.", E_MAILBOX_SHM_NAME);
+			return E_ERR;
+		}
+	}
+
+	mb->fd	= mailbox_open_dev();
+	mb->hdr = (e_mailbox_hdr_t *) mb->mem.base;
+
+	// A new generation makes the cores drop the ring state they cached
+	// from an earlier open
+	gen = mb->hdr->gen + 1;
+	memset(mb->hdr, 0, size);
+	mb->hdr->gen	 = gen ? gen : 1;
+	mb->hdr->hw_addr = (mb->fd >= 0) ? E_MAILBOX_HW_ADDR : 0;
+	mb->hdr->row	 = e_platform.row;
+	mb->hdr->col	 = e_platform.col;
+	mb->hdr->rows	 = e_platform.rows;
+	mb->hdr->cols	 = e_platform.cols;
+
+	// The cores only post once they see the magic
+	__sync_synchronize();
+	mb->hdr->magic = E_MAILBOX_MAGIC;
+
+	diag(H_D1) { fprintf(stderr, "e_mailbox_open(): %s, %u rings\n",
+						 (mb->fd >= 0) ? "e-link mailbox" : "shared memory", mb->num_rings); }
+
+	return E_OK;
+}
+
+int e_mailbox_close(e_mailbox_t *mb)
+{
+	if (mb->hdr) {
+		mb->hdr->magic = 0;
+		mb->hdr		   = NULL;
+		e_shm_release(E_MAILBOX_SHM_NAME);
+	}
+
+	if (mb->fd >= 0)
+		close(mb->fd);
+	mb->fd = -1;
+
+	return E_OK;
+}
+
+int e_mailbox_fd(e_mailbox_t *mb)
+{
+	return mb->fd;
+}
+
+int e_mailbox_count(e_mailbox_t *mb)
+{
+	unsigned i, count = 0;
+	int		 rc;
+
+	if (mb->fd >= 0) {
+		rc = ioctl(mb->fd, E_IOCTL_MAILBOX_COUNT);
+		if (rc < 0) {
+			warnx("e_mailbox_count(): Mailbox count ioctl failure.");
+			return E_ERR;
+		}
+		return rc;
+	}
+
+	for (i = 0; i < mb->num_rings; i++)
+		count += mb->hdr->ring[i].head - mb->hdr->ring[i].tail;
+
+	return count;
+}
+
+int e_mailbox_read(e_mailbox_t *mb, e_mailbox_msg_t *msgs, unsigned n, int timeout_ms)
+{
+	struct pollfd		 pfd;
+	struct e_mailbox_msg msg;
+	uint64_t			 deadline = 0, now = 0;
+	unsigned			 got, spin, sleep_us;
+	int					 count, rc, no_poll = 0;
+
+	if (!mb->hdr || !n) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	if (timeout_ms > 0)
+		deadline = mailbox_now_us() + (uint64_t) timeout_ms * 1000;
+
+	if (mb->fd >= 0) {
+		pfd.fd	   = mb->fd;
+		pfd.events = POLLIN;
+		sleep_us   = MAILBOX_SLEEP_MIN;
+		while ((count = e_mailbox_count(mb)) == 0 && timeout_ms != 0) {
+			if (timeout_ms > 0 && (now = mailbox_now_us()) >= deadline)
+				break;
+
+			// A driver without poll support says readable at once. Sleep
+			// out the rest of the timeout instead of returning empty.
+			if (no_poll) {
+				usleep(sleep_us);
+				if (sleep_us < MAILBOX_SLEEP_MAX)
+					sleep_us *= 2;
+				continue;
+			}
+
+			rc = poll(&pfd, 1, timeout_ms < 0 ? -1 : (int) ((deadline - now + 999) / 1000));
+			if (rc < 0 && errno == EINTR)
+				continue;
+			no_poll = (rc != 0);
+		}
+		if (count < 0)
+			return E_ERR;
+
+		// The FIFO only ever grows under us, so these reads do not block
+		for (got = 0; got < n && got < (unsigned) count; got++) {
+			if (ioctl(mb->fd, E_IOCTL_MAILBOX_READ, &msg)) {
+				warnx("e_mailbox_read(): Mailbox read ioctl failure.");
+				return got ? (int) got : E_ERR;
+			}
+			msgs[got].from = msg.from;
+			msgs[got].data = msg.data;
+		}
+		return got;
+	}
+
+	// No fd to poll, spin and then sleep until the deadline
+	for (spin = 0; spin < mb->spins; spin++) {
+		got = mailbox_drain_rings(mb, msgs, n);
+		if (got || timeout_ms == 0) {
+			// Worth spinning a little longer next time
+			if (got && spin && mb->spins < MAILBOX_SPIN_MAX)
+				mb->spins *= 2;
+			return got;
+		}
+	}
+
+	// Nothing came while spinning, spin less next time
+	if (mb->spins > MAILBOX_SPIN_MIN)
+		mb->spins /= 2;
+
+	sleep_us = MAILBOX_SLEEP_MIN;
+	while (timeout_ms < 0 || mailbox_now_us() < deadline) {
+		usleep(sleep_us);
+		got = mailbox_drain_rings(mb, msgs, n);
+		if (got)
+			return got;
+		if (sleep_us < MAILBOX_SLEEP_MAX)
+			sleep_us *= 2;
+	}
+
+	return 0;
+}
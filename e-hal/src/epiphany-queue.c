@@ -0,0 +1,218 @@
+/*
+  File: epiphany-queue.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.	 If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Host side of the host <-> eCore streaming queues.
+ *
+ * Every queue is a bounded single-producer/single-consumer ring placed in a
+ * named shared memory region. The producer only ever writes the head index
+ * and the consumer only ever writes the tail index, so no lock is needed.
+ * Both indices are free-running 32-bit counters; the capacity is a power of
+ * two so the slot is simply (index & mask). The indices live on separate
+ * 64-byte lines so that the two sides do not fight over the same line.
+ *
+ * Each side keeps a local copy of the indices and only re-reads the remote
+ * one when the cached value says the queue is full (or empty), which keeps
+ * the number of uncached accesses to the shared region low when batching.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <stdio.h>
+
+#include "epiphany-hal.h"
+#include "epiphany-shm-manager.h"
+
+extern int e_host_verbose;
+#define diag(vN) if (e_host_verbose >= vN)
+
+
+static uint32_t queue_round_capacity(unsigned capacity)
+{
+	uint32_t cap = 1;
+
+	while ( cap < capacity )
+		cap <<= 1;
+
+	return cap;
+}
+
+static void queue_setup(e_queue_t *q, const char *name)
+{
+	q->hdr       = (e_queue_hdr_t *) q->mem.base;
+	q->data      = (uint8_t *) q->mem.base + q->hdr->data_offset;
+	q->item_size = q->hdr->item_size;
+	q->mask      = q->hdr->capacity - 1;
+	q->head      = q->hdr->head;
+	q->tail      = q->hdr->tail;
+
+	strncpy(q->name, name, sizeof(q->name) - 1);
+	q->name[sizeof(q->name) - 1] = '\0';
+}
+
+
+int e_queue_alloc(e_queue_t *q, const char *name, e_queue_dir_t dir,
+				  size_t item_size, unsigned capacity)
+{
+	e_queue_hdr_t *hdr;
+	uint32_t	   cap;
+	size_t		   size;
+
+	if ( !q || !name || !item_size || !capacity ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	cap  = queue_round_capacity(capacity);
+	size = sizeof(e_queue_hdr_t) + (size_t) cap * item_size;
+
+	if ( E_OK != e_shm_alloc(&q->mem, name, size) ) {
+		warnx("e_queue_alloc(): Failed to allocate shared region %s.", name);
+		return E_ERR;
+	}
+
+	hdr = (e_queue_hdr_t *) q->mem.base;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->dir         = dir;
+	hdr->item_size   = item_size;
+	hdr->capacity    = cap;
+	hdr->data_offset = sizeof(e_queue_hdr_t);
+
+	/* Publish the queue only once the header is complete */
+	__sync_synchronize();
+	hdr->magic       = E_QUEUE_MAGIC;
+
+	queue_setup(q, name);
+
+	diag(H_D1) { fprintf(stderr, "e_queue_alloc(): %s: %u items of %u bytes\n",
+						 name, cap, (unsigned) item_size); }
+
+	return E_OK;
+}
+
+
+int e_queue_attach(e_queue_t *q, const char *name)
+{
+	if ( !q || !name ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	if ( E_OK != e_shm_attach(&q->mem, name) )
+		return E_ERR;
+
+	if ( E_QUEUE_MAGIC != ((e_queue_hdr_t *) q->mem.base)->magic ) {
+		warnx("e_queue_attach(): Region %s does not hold a queue.", name);
+		e_shm_release(name);
+		return E_ERR;
+	}
+
+	queue_setup(q, name);
+
+	return E_OK;
+}
+
+
+int e_queue_release(e_queue_t *q)
+{
+	if ( !q )
+		return E_ERR;
+
+	return e_shm_release(q->name);
+}
+
+
+unsigned e_queue_push(e_queue_t *q, const void *items, unsigned n)
+{
+	uint32_t	cap = q->mask + 1;
+	uint32_t	slot, first;
+	const uint8_t *src = (const uint8_t *) items;
+
+	/* Only refresh the consumer index when the cached one says full */
+	if ( cap - (q->head - q->tail) < n )
+		q->tail = q->hdr->tail;
+
+	if ( n > cap - (q->head - q->tail) )
+		n = cap - (q->head - q->tail);
+
+	if ( !n )
+		return 0;
+
+	slot  = q->head & q->mask;
+	first = (n < cap - slot) ? n : cap - slot;
+
+	memcpy(q->data + slot * q->item_size, src, first * q->item_size);
+	if ( n > first )
+		memcpy(q->data, src + first * q->item_size, (n - first) * q->item_size);
+
+	/* Items must be visible before the new head */
+	__sync_synchronize();
+	q->head += n;
+	q->hdr->head = q->head;
+
+	return n;
+}
+
+
+unsigned e_queue_pop(e_queue_t *q, void *items, unsigned n)
+{
+	uint32_t	cap = q->mask + 1;
+	uint32_t	slot, first;
+	uint8_t	   *dst = (uint8_t *) items;
+
+	/* Only refresh the producer index when the cached one says empty */
+	if ( q->head - q->tail < n ) {
+		q->head = q->hdr->head;
+		__sync_synchronize();
+	}
+
+	if ( n > q->head - q->tail )
+		n = q->head - q->tail;
+
+	if ( !n )
+		return 0;
+
+	slot  = q->tail & q->mask;
+	first = (n < cap - slot) ? n : cap - slot;
+
+	memcpy(dst, q->data + slot * q->item_size, first * q->item_size);
+	if ( n > first )
+		memcpy(dst + first * q->item_size, q->data, (n - first) * q->item_size);
+
+	/* Done reading the slots before handing them back */
+	__sync_synchronize();
+	q->tail += n;
+	q->hdr->tail = q->tail;
+
+	return n;
+}
+
+
+unsigned e_queue_count(e_queue_t *q)
+{
+	return q->hdr->head - q->hdr->tail;
+}
@@ -36,6 +36,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "epiphany.h"
 #include <memman.h>
 
@@ -44,6 +45,7 @@
 #include "epiphany-shm-manager.h"
 
 #include "esim-target.h"
+#include "emu-target.h"
 
 typedef unsigned long long ulong64;
 
@@ -51,20 +53,18 @@ static e_shmtable_t    *shm_table        = 0;
 static size_t           shm_table_length = 0;
 static int              epiphany_devfd   = -1;
 static epiphany_alloc_t shm_alloc        = { 0 };
+static pthread_mutex_t  shm_mutex        = PTHREAD_MUTEX_INITIALIZER;
 
 static e_shmseg_pvt_t* shm_lookup_region(const char *name);
 static e_shmseg_pvt_t* shm_alloc_region(const char *name, size_t size);
 static int shm_table_sanity_check(e_shmtable_t *tbl);
 
-static int shm_lock_file(const int fd, const char* fn);
-static int shm_unlock_file(const int fd, const char* fn);
+static int shm_lock_table(const char* fn);
+static int shm_unlock_table(const char* fn);
 
-/* TODO: Add locking support for ESIM target */
 /* Convenience macros */
-#define LOCK_SHM_TABLE() \
-	({esim_target_p() ? E_OK : shm_lock_file(epiphany_devfd, __func__);})
-#define UNLOCK_SHM_TABLE() \
-	({esim_target_p() ? E_OK : shm_unlock_file(epiphany_devfd, __func__);})
+#define LOCK_SHM_TABLE()   shm_lock_table(__func__)
+#define UNLOCK_SHM_TABLE() shm_unlock_table(__func__)
 
 extern e_platform_t e_platform;
 extern int	 e_host_verbose;
@@ -89,6 +89,27 @@ static int e_shm_init_esim()
 	return shm_alloc.uvirt_addr != 0 ? E_OK : E_ERR;
 }
 
+static int e_shm_init_emu()
+{
+	e_memseg_t       *emem;
+
+	if (!e_platform.num_emems) {
+		warnx("e_shm_init(): No memory regions.");
+		return E_ERR;
+	}
+	emem = &e_platform.emem[0];
+	shm_alloc.size        = GLOBAL_SHM_SIZE;
+	shm_alloc.bus_addr    = emem->ephy_base + 0x01000000; /* + shared_dram offset */
+	shm_alloc.phy_addr    = emem->phy_base  + 0x01000000; /* + shared_dram offset */
+	shm_alloc.kvirt_addr  = 0;
+	shm_alloc.mmap_handle = shm_alloc.bus_addr;
+	shm_alloc.uvirt_addr  = (unsigned long) emu_map(shm_alloc.phy_addr, shm_alloc.size);
+
+	shm_table_length = shm_alloc.size;
+
+	return shm_alloc.uvirt_addr != 0 ? E_OK : E_ERR;
+}
+
 int e_shm_init_native()
 {
 	int              devfd       = 0;
@@ -140,6 +161,8 @@ int e_shm_init()
 
 	if (esim_target_p())
 		rc = e_shm_init_esim();
+	else if (emu_target_p())
+		rc = e_shm_init_emu();
 	else
 		rc = e_shm_init_native();
 
@@ -199,8 +222,11 @@ int e_shm_init()
 
 void e_shm_finalize(void)
 {
-	if (!esim_target_p())
+	if (!esim_target_p() && !emu_target_p()) {
 		munmap((void*)shm_table, shm_table_length);
+		close(epiphany_devfd);
+		epiphany_devfd = -1;
+	}
 	diag(H_D2) { fprintf(stderr, "e_shm_finalize(): teardown complete\n"); }
 }
 
@@ -475,30 +501,63 @@ static int shm_table_sanity_check(e_shmtable_t *tbl)
  * The belows two functions provide mutual exclusion to the
  * SHM table.
  *
- * lockf() is good for simple things like these, but if we ever need more
- * advanced locking features we might have to resort to fcntl().
+ * Record locks are owned by the process, so they do not keep the threads
+ * of one process apart: those are serialized by shm_mutex first. The
+ * record lock then covers the whole device file, like the lockf() of
+ * older clients. It is not placed at the table's bus address: with the
+ * 32-bit off_t of the armhf build that offset is negative and fcntl()
+ * fails with EINVAL.
+ *
+ * TODO: Add locking support for ESIM target
+ * The emulated memory only exists within this process (and its children),
+ * there is no device file to lock.
  */
 
-static int shm_lock_file(const int fd, const char* fn)
+static int shm_lock_table(const char* fn)
 {
-	diag(H_D3) { fprintf(stderr, "shm_lock_file(): Taking lock...\n"); }
-	if ( lockf(fd, F_LOCK, 0) ) {
+	struct flock fl;
+
+	diag(H_D3) { fprintf(stderr, "shm_lock_table(): Taking lock...\n"); }
+	pthread_mutex_lock(&shm_mutex);
+
+	if ( esim_target_p() || emu_target_p() )
+		return E_OK;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start  = 0;
+	fl.l_len    = 0;	/* to the end of the file */
+	while ( fcntl(epiphany_devfd, F_SETLKW, &fl) ) {
+		if ( EINTR == errno )
+			continue;
 		warnx("%s(): Failed to lock shared memory. Error is %s",
 				fn, strerror(errno));
+		pthread_mutex_unlock(&shm_mutex);
 		return E_ERR;
 	}
-	diag(H_D3) { fprintf(stderr, "shm_lock_file(): Lock acquired.\n"); }
+	diag(H_D3) { fprintf(stderr, "shm_lock_table(): Lock acquired.\n"); }
 	return E_OK;
 }
 
-static int shm_unlock_file(const int fd, const char* fn)
+static int shm_unlock_table(const char* fn)
 {
-	if ( lockf(fd, F_ULOCK, 0) ) {
-		warnx("%s(): Failed to unlock shared memory. Error is %s",
-				fn, strerror(errno));
-		return E_ERR;
+	struct flock fl;
+	int          retval = E_OK;
+
+	if ( !esim_target_p() && !emu_target_p() ) {
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type   = F_UNLCK;
+		fl.l_whence = SEEK_SET;
+		fl.l_start  = 0;
+		fl.l_len    = 0;
+		if ( fcntl(epiphany_devfd, F_SETLK, &fl) ) {
+			warnx("%s(): Failed to unlock shared memory. Error is %s",
+					fn, strerror(errno));
+			retval = E_ERR;
+		}
 	}
-	return E_OK;
-}
-
 
+	pthread_mutex_unlock(&shm_mutex);
+	return retval;
+}
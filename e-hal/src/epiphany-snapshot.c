@@ -0,0 +1,467 @@
+/*
+  File: epiphany-snapshot.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.	 If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Core state snapshots.
+ *
+ * A snapshot holds the general purpose and special core registers (which
+ * include the DMA channel state) and the local memory of every core of a
+ * workgroup. The capture threads pick cores off a shared counter and copy
+ * the local memory with one bulk read per core, so a whole chip is read in
+ * a few milliseconds. The cores keep running, which means the state of a
+ * running core is only a sample, but halted or hung cores are exact.
+ *
+ * The file starts with a header of 32-bit words, followed by one record per
+ * core: its ID and coordinates, the registers, a bitmap with one bit per
+ * E_SNAPSHOT_PAGE_SIZE page of local memory and the pages whose bit is
+ * set. Pages that are all zeroes are left out, which keeps the files of
+ * mostly empty cores small.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "epiphany-hal.h"
+
+extern int e_host_verbose;
+#define diag(vN) if (e_host_verbose >= vN)
+
+#define SNAPSHOT_HDR_WORDS  12
+#define SNAPSHOT_MAX_THREADS 64
+
+static const struct {
+	off_t		 addr;
+	const char	*name;
+} snapshot_scrs[E_SNAPSHOT_NUM_SCRS] = {
+	{ E_REG_CONFIG,       "config" },
+	{ E_REG_STATUS,       "status" },
+	{ E_REG_PC,           "pc" },
+	{ E_REG_DEBUGSTATUS,  "debugstatus" },
+	{ E_REG_LC,           "lc" },
+	{ E_REG_LS,           "ls" },
+	{ E_REG_LE,           "le" },
+	{ E_REG_IRET,         "iret" },
+	{ E_REG_IMASK,        "imask" },
+	{ E_REG_ILAT,         "ilat" },
+	{ E_REG_ILATST,       "ilatst" },
+	{ E_REG_ILATCL,       "ilatcl" },
+	{ E_REG_IPEND,        "ipend" },
+	{ E_REG_CTIMER0,      "ctimer0" },
+	{ E_REG_CTIMER1,      "ctimer1" },
+	{ E_REG_FSTATUS,      "fstatus" },
+	{ E_REG_DEBUGCMD,     "debugcmd" },
+	{ E_REG_DMA0CONFIG,   "dma0config" },
+	{ E_REG_DMA0STRIDE,   "dma0stride" },
+	{ E_REG_DMA0COUNT,    "dma0count" },
+	{ E_REG_DMA0SRCADDR,  "dma0srcaddr" },
+	{ E_REG_DMA0DSTADDR,  "dma0dstaddr" },
+	{ E_REG_DMA0AUTODMA0, "dma0autodma0" },
+	{ E_REG_DMA0AUTODMA1, "dma0autodma1" },
+	{ E_REG_DMA0STATUS,   "dma0status" },
+	{ E_REG_DMA1CONFIG,   "dma1config" },
+	{ E_REG_DMA1STRIDE,   "dma1stride" },
+	{ E_REG_DMA1COUNT,    "dma1count" },
+	{ E_REG_DMA1SRCADDR,  "dma1srcaddr" },
+	{ E_REG_DMA1DSTADDR,  "dma1dstaddr" },
+	{ E_REG_DMA1AUTODMA0, "dma1autodma0" },
+	{ E_REG_DMA1AUTODMA1, "dma1autodma1" },
+	{ E_REG_DMA1STATUS,   "dma1status" },
+	{ E_REG_MEMSTATUS,    "memstatus" },
+	{ E_REG_MEMPROTECT,   "memprotect" },
+	{ E_REG_MESHCONFIG,   "meshconfig" },
+	{ E_REG_COREID,       "coreid" },
+	{ E_REG_MULTICAST,    "multicast" },
+	{ E_REG_RESETCORE,    "resetcore" },
+	{ E_REG_CMESHROUTE,   "cmeshroute" },
+	{ E_REG_XMESHROUTE,   "xmeshroute" },
+	{ E_REG_RMESHROUTE,   "rmeshroute" },
+};
+
+typedef struct {
+	e_epiphany_t	*dev;
+	e_snapshot_t	*snap;
+	volatile unsigned next;       // next core to capture, shared by all threads
+	volatile int	 errors;
+} snapshot_job_t;
+
+
+static uint64_t snapshot_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int snapshot_alloc(e_snapshot_t *snap)
+{
+	unsigned i, n = snap->rows * snap->cols;
+
+	snap->core = (e_core_snapshot_t *) calloc(n, sizeof(e_core_snapshot_t));
+	if ( !snap->core )
+		return E_ERR;
+
+	for ( i = 0; i < n; i++ ) {
+		snap->core[i].row  = i / snap->cols;
+		snap->core[i].col  = i % snap->cols;
+		snap->core[i].sram = (uint8_t *) calloc(1, snap->sram_size);
+		if ( !snap->core[i].sram ) {
+			e_snapshot_free(snap);
+			return E_ERR;
+		}
+	}
+
+	return E_OK;
+}
+
+static int snapshot_capture_core(e_epiphany_t *dev, e_snapshot_t *snap, e_core_snapshot_t *core)
+{
+	unsigned i;
+
+	core->id = dev->core[core->row][core->col].id;
+
+	if ( snap->sram_size != e_read(dev, core->row, core->col, 0, core->sram, snap->sram_size) )
+		return E_ERR;
+
+	for ( i = 0; i < E_SNAPSHOT_NUM_GPRS; i++ )
+		e_read(dev, core->row, core->col, E_REG_R0 + 4 * i, &core->gpr[i], 4);
+
+	for ( i = 0; i < E_SNAPSHOT_NUM_SCRS; i++ )
+		e_read(dev, core->row, core->col, snapshot_scrs[i].addr, &core->scr[i], 4);
+
+	return E_OK;
+}
+
+static void *snapshot_worker(void *arg)
+{
+	snapshot_job_t *job = (snapshot_job_t *) arg;
+	unsigned		n = job->snap->rows * job->snap->cols;
+	unsigned		i;
+
+	while ( (i = __sync_fetch_and_add(&job->next, 1)) < n ) {
+		if ( E_OK != snapshot_capture_core(job->dev, job->snap, &job->snap->core[i]) ) {
+			warnx("e_snapshot_capture(): Failed to read core (%u,%u).",
+				  job->snap->core[i].row, job->snap->core[i].col);
+			__sync_fetch_and_add(&job->errors, 1);
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned snapshot_bitmap_words(e_snapshot_t *snap)
+{
+	unsigned pages = (snap->sram_size + E_SNAPSHOT_PAGE_SIZE - 1) / E_SNAPSHOT_PAGE_SIZE;
+
+	return (pages + 31) / 32;
+}
+
+static size_t snapshot_page_len(e_snapshot_t *snap, unsigned page)
+{
+	size_t off = (size_t) page * E_SNAPSHOT_PAGE_SIZE;
+
+	return (snap->sram_size - off < E_SNAPSHOT_PAGE_SIZE) ? snap->sram_size - off : E_SNAPSHOT_PAGE_SIZE;
+}
+
+static int snapshot_page_is_zero(const uint8_t *p, size_t len)
+{
+	while ( len-- )
+		if ( *p++ )
+			return 0;
+
+	return 1;
+}
+
+
+int e_snapshot_capture(e_epiphany_t *dev, e_snapshot_t *snap, size_t sram_size, unsigned threads)
+{
+	pthread_t		thread[SNAPSHOT_MAX_THREADS];
+	snapshot_job_t	job;
+	unsigned		i, started;
+	size_t			max_size;
+	uint64_t		start;
+
+	if ( !dev || !snap ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	max_size = dev->core[0][0].mems.map_size - dev->core[0][0].mems.page_offset;
+	if ( !sram_size || sram_size > max_size )
+		sram_size = max_size;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->row       = dev->row;
+	snap->col       = dev->col;
+	snap->rows      = dev->rows;
+	snap->cols      = dev->cols;
+	snap->sram_size = sram_size;
+
+	if ( E_OK != snapshot_alloc(snap) ) {
+		warnx("e_snapshot_capture(): Failed to allocate the snapshot.");
+		return E_ERR;
+	}
+
+	if ( !threads || threads > dev->num_cores )
+		threads = dev->num_cores;
+	if ( threads > SNAPSHOT_MAX_THREADS )
+		threads = SNAPSHOT_MAX_THREADS;
+
+	job.dev    = dev;
+	job.snap   = snap;
+	job.next   = 0;
+	job.errors = 0;
+
+	start = snapshot_now_us();
+	snap->timestamp = start;
+
+	/* The calling thread takes part in the capture as well */
+	for ( started = 0; started < threads - 1; started++ )
+		if ( pthread_create(&thread[started], NULL, snapshot_worker, &job) )
+			break;
+
+	snapshot_worker(&job);
+
+	for ( i = 0; i < started; i++ )
+		pthread_join(thread[i], NULL);
+
+	snap->capture_us = snapshot_now_us() - start;
+
+	diag(H_D1) { fprintf(stderr, "e_snapshot_capture(): %u cores in %u us using %u threads\n",
+						 dev->num_cores, snap->capture_us, started + 1); }
+
+	if ( job.errors ) {
+		e_snapshot_free(snap);
+		return E_ERR;
+	}
+
+	return E_OK;
+}
+
+
+int e_snapshot_save(e_snapshot_t *snap, const char *path)
+{
+	uint32_t	hdr[SNAPSHOT_HDR_WORDS];
+	uint32_t   *bitmap;
+	uint32_t	pos[3];
+	unsigned	words, pages, i, p;
+	e_core_snapshot_t *core;
+	FILE	   *fp;
+	int			ret = E_OK;
+
+	if ( !snap || !snap->core || !path ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	words  = snapshot_bitmap_words(snap);
+	pages  = (snap->sram_size + E_SNAPSHOT_PAGE_SIZE - 1) / E_SNAPSHOT_PAGE_SIZE;
+	bitmap = (uint32_t *) malloc(words * sizeof(uint32_t));
+	if ( !bitmap )
+		return E_ERR;
+
+	fp = fopen(path, "wb");
+	if ( !fp ) {
+		warn("e_snapshot_save(): Failed to open %s", path);
+		free(bitmap);
+		return E_ERR;
+	}
+
+	hdr[0]  = E_SNAPSHOT_MAGIC;
+	hdr[1]  = E_SNAPSHOT_VERSION;
+	hdr[2]  = snap->row;
+	hdr[3]  = snap->col;
+	hdr[4]  = snap->rows;
+	hdr[5]  = snap->cols;
+	hdr[6]  = snap->sram_size;
+	hdr[7]  = E_SNAPSHOT_NUM_GPRS;
+	hdr[8]  = E_SNAPSHOT_NUM_SCRS;
+	hdr[9]  = snap->capture_us;
+	hdr[10] = (uint32_t) snap->timestamp;
+	hdr[11] = (uint32_t) (snap->timestamp >> 32);
+	if ( 1 != fwrite(hdr, sizeof(hdr), 1, fp) )
+		ret = E_ERR;
+
+	for ( i = 0; i < snap->rows * snap->cols && ret == E_OK; i++ ) {
+		core = &snap->core[i];
+
+		memset(bitmap, 0, words * sizeof(uint32_t));
+		for ( p = 0; p < pages; p++ )
+			if ( !snapshot_page_is_zero(core->sram + p * E_SNAPSHOT_PAGE_SIZE, snapshot_page_len(snap, p)) )
+				bitmap[p / 32] |= 1u << (p % 32);
+
+		pos[0] = core->id;
+		pos[1] = core->row;
+		pos[2] = core->col;
+		if ( 1 != fwrite(pos, sizeof(pos), 1, fp) ||
+			 1 != fwrite(core->gpr, sizeof(core->gpr), 1, fp) ||
+			 1 != fwrite(core->scr, sizeof(core->scr), 1, fp) ||
+			 1 != fwrite(bitmap, words * sizeof(uint32_t), 1, fp) ) {
+			ret = E_ERR;
+			break;
+		}
+
+		for ( p = 0; p < pages; p++ ) {
+			if ( !(bitmap[p / 32] & (1u << (p % 32))) )
+				continue;
+			if ( 1 != fwrite(core->sram + p * E_SNAPSHOT_PAGE_SIZE, snapshot_page_len(snap, p), 1, fp) ) {
+				ret = E_ERR;
+				break;
+			}
+		}
+	}
+
+	if ( fclose(fp) )
+		ret = E_ERR;
+	if ( ret != E_OK )
+		warnx("e_snapshot_save(): Failed to write %s.", path);
+
+	free(bitmap);
+	return ret;
+}
+
+
+int e_snapshot_load(e_snapshot_t *snap, const char *path)
+{
+	uint32_t	hdr[SNAPSHOT_HDR_WORDS];
+	uint32_t   *bitmap = NULL;
+	uint32_t	pos[3];
+	unsigned	words, pages, i, p;
+	e_core_snapshot_t *core;
+	FILE	   *fp;
+	int			ret = E_OK;
+
+	if ( !snap || !path ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+	memset(snap, 0, sizeof(*snap));
+
+	fp = fopen(path, "rb");
+	if ( !fp ) {
+		warn("e_snapshot_load(): Failed to open %s", path);
+		return E_ERR;
+	}
+
+	if ( 1 != fread(hdr, sizeof(hdr), 1, fp) || hdr[0] != E_SNAPSHOT_MAGIC ||
+		 hdr[1] != E_SNAPSHOT_VERSION || hdr[7] != E_SNAPSHOT_NUM_GPRS ||
+		 hdr[8] != E_SNAPSHOT_NUM_SCRS || !hdr[4] || !hdr[5] ) {
+		warnx("e_snapshot_load(): %s is not a snapshot file.", path);
+		fclose(fp);
+		return E_ERR;
+	}
+
+	snap->row        = hdr[2];
+	snap->col        = hdr[3];
+	snap->rows       = hdr[4];
+	snap->cols       = hdr[5];
+	snap->sram_size  = hdr[6];
+	snap->capture_us = hdr[9];
+	snap->timestamp  = ((uint64_t) hdr[11] << 32) | hdr[10];
+
+	words  = snapshot_bitmap_words(snap);
+	pages  = (snap->sram_size + E_SNAPSHOT_PAGE_SIZE - 1) / E_SNAPSHOT_PAGE_SIZE;
+	bitmap = (uint32_t *) malloc(words * sizeof(uint32_t));
+	if ( !bitmap || E_OK != snapshot_alloc(snap) ) {
+		free(bitmap);
+		fclose(fp);
+		return E_ERR;
+	}
+
+	for ( i = 0; i < snap->rows * snap->cols && ret == E_OK; i++ ) {
+		core = &snap->core[i];
+
+		if ( 1 != fread(pos, sizeof(pos), 1, fp) ||
+			 1 != fread(core->gpr, sizeof(core->gpr), 1, fp) ||
+			 1 != fread(core->scr, sizeof(core->scr), 1, fp) ||
+			 1 != fread(bitmap, words * sizeof(uint32_t), 1, fp) ||
+			 pos[1] != core->row || pos[2] != core->col ) {
+			ret = E_ERR;
+			break;
+		}
+		core->id = pos[0];
+
+		for ( p = 0; p < pages; p++ ) {
+			if ( !(bitmap[p / 32] & (1u << (p % 32))) )
+				continue;
+			if ( 1 != fread(core->sram + p * E_SNAPSHOT_PAGE_SIZE, snapshot_page_len(snap, p), 1, fp) ) {
+				ret = E_ERR;
+				break;
+			}
+		}
+	}
+
+	fclose(fp);
+	free(bitmap);
+
+	if ( ret != E_OK ) {
+		warnx("e_snapshot_load(): %s is truncated or corrupt.", path);
+		e_snapshot_free(snap);
+	}
+
+	return ret;
+}
+
+
+void e_snapshot_free(e_snapshot_t *snap)
+{
+	unsigned i;
+
+	if ( !snap || !snap->core )
+		return;
+
+	for ( i = 0; i < snap->rows * snap->cols; i++ )
+		free(snap->core[i].sram);
+
+	free(snap->core);
+	snap->core = NULL;
+}
+
+
+e_core_snapshot_t *e_snapshot_core(e_snapshot_t *snap, unsigned row, unsigned col)
+{
+	if ( !snap || !snap->core || row >= snap->rows || col >= snap->cols )
+		return NULL;
+
+	return &snap->core[row * snap->cols + col];
+}
+
+
+off_t e_snapshot_scr_addr(unsigned idx)
+{
+	return (idx < E_SNAPSHOT_NUM_SCRS) ? snapshot_scrs[idx].addr : 0;
+}
+
+
+const char *e_snapshot_scr_name(unsigned idx)
+{
+	return (idx < E_SNAPSHOT_NUM_SCRS) ? snapshot_scrs[idx].name : NULL;
+}
@@ -0,0 +1,389 @@
+/*
+  File: epiphany-task.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.	 If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Host side of the task runtime.
+ *
+ * The cores keep their kernels resident and serve a mailbox of
+ * E_TASK_SLOTS descriptors in local memory (see the e-lib e_task.h). Like
+ * the streaming queues the mailbox is a ring with free-running indices:
+ * the host only writes head and the core only writes tail.
+ *
+ * Submitted tasks go into a host side queue per core. e_task_poll() visits
+ * every core, reads its tail to collect the results of finished tasks and
+ * posts up to batch queued tasks into the free slots with one write for
+ * the descriptors and one for head. A core whose queue is empty steals the
+ * newer half of the longest queue, so a core that gets short tasks is not
+ * left idle while another one has a backlog. Reading the tail is the only
+ * read from the core and it is skipped for cores that have nothing posted.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <stdio.h>
+
+#include "epiphany-hal.h"
+#include "e-loader.h"
+
+extern int e_host_verbose;
+#define diag(vN) if (e_host_verbose >= vN)
+
+#define TASK_INIT_TIMEOUT_MS 2000
+#define TASK_QUEUE_MIN       64
+#define TASK_SPIN_POLLS      1000     // polls before e_task_wait() starts sleeping
+
+
+static uint64_t task_now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static unsigned task_queued(e_task_core_t *c)
+{
+	return c->qtail - c->qhead;
+}
+
+static int task_queue_grow(e_task_core_t *c)
+{
+	unsigned  size = c->qsize ? 2 * c->qsize : TASK_QUEUE_MIN;
+	e_task_t *queue;
+	unsigned  i, n = task_queued(c);
+
+	queue = (e_task_t *) malloc(size * sizeof(e_task_t));
+	if ( !queue )
+		return E_ERR;
+
+	for ( i = 0; i < n; i++ )
+		queue[i] = c->queue[(c->qhead + i) & (c->qsize - 1)];
+
+	free(c->queue);
+	c->queue = queue;
+	c->qsize = size;
+	c->qhead = 0;
+	c->qtail = n;
+
+	return E_OK;
+}
+
+static int task_push(e_task_core_t *c, const e_task_t *task)
+{
+	if ( task_queued(c) == c->qsize && E_OK != task_queue_grow(c) )
+		return E_ERR;
+
+	c->queue[c->qtail++ & (c->qsize - 1)] = *task;
+
+	return E_OK;
+}
+
+/* Move the newer half of the longest queue to the queue of core thief */
+static void task_steal(e_task_rt_t *rt, unsigned thief)
+{
+	e_task_core_t *c = &rt->core[thief], *victim = NULL;
+	unsigned	   i, n, most = 0;
+
+	for ( i = 0; i < rt->num_cores; i++ ) {
+		if ( i != thief && task_queued(&rt->core[i]) > most ) {
+			victim = &rt->core[i];
+			most   = task_queued(victim);
+		}
+	}
+
+	if ( !victim )
+		return;
+
+	for ( n = (most + 1) / 2; n; n-- ) {
+		if ( E_OK != task_push(c, &victim->queue[(victim->qtail - 1) & (victim->qsize - 1)]) )
+			break;
+		victim->qtail--;
+		c->stolen++;
+	}
+}
+
+/* Collect the results of the tasks a core finished since the last visit */
+static void task_collect(e_task_rt_t *rt, unsigned i)
+{
+	e_task_core_t *c = &rt->core[i];
+	e_task_desc_t  desc[E_TASK_SLOTS];
+	unsigned	   row = i / rt->dev->cols, col = i % rt->dev->cols;
+	unsigned	   tail, slot, n, first, k;
+	uint32_t	   word;
+
+	if ( c->head == c->tail )
+		return;
+
+	if ( sizeof(word) != e_read(rt->dev, row, col, c->mbox + offsetof(e_task_mbox_t, tail), &word, sizeof(word)) )
+		return;
+
+	tail = word;
+	n	 = tail - c->tail;
+	if ( !n || n > c->head - c->tail )
+		return;
+
+	for ( k = 0; k < n; k++ )
+		if ( c->inflight[(c->tail + k) & (E_TASK_SLOTS - 1)] )
+			break;
+
+	if ( k < n ) {
+		// Read the finished descriptors in at most two bursts
+		slot  = c->tail & (E_TASK_SLOTS - 1);
+		first = (n < E_TASK_SLOTS - slot) ? n : E_TASK_SLOTS - slot;
+		e_read(rt->dev, row, col, c->mbox + offsetof(e_task_mbox_t, slot[slot]),
+			   desc, first * sizeof(e_task_desc_t));
+		if ( n > first )
+			e_read(rt->dev, row, col, c->mbox + offsetof(e_task_mbox_t, slot[0]),
+				   &desc[first], (n - first) * sizeof(e_task_desc_t));
+
+		for ( k = 0; k < n; k++ ) {
+			slot = (c->tail + k) & (E_TASK_SLOTS - 1);
+			if ( c->inflight[slot] )
+				*c->inflight[slot] = desc[k].ret;
+		}
+	}
+
+	for ( k = 0; k < n; k++ )
+		c->inflight[(c->tail + k) & (E_TASK_SLOTS - 1)] = NULL;
+
+	c->tail		 = tail;
+	c->finished += n;
+	rt->pending -= n;
+}
+
+/* Post queued tasks into the free mailbox slots of a core */
+static void task_post(e_task_rt_t *rt, unsigned i)
+{
+	e_task_core_t *c = &rt->core[i];
+	e_task_desc_t  desc[E_TASK_SLOTS];
+	unsigned	   row = i / rt->dev->cols, col = i % rt->dev->cols;
+	unsigned	   n, k, slot, first;
+	e_task_t	  *task;
+	uint32_t	   word;
+
+	n = E_TASK_SLOTS - (c->head - c->tail);
+	if ( n > rt->batch )
+		n = rt->batch;
+	if ( !n )
+		return;
+
+	if ( !task_queued(c) )
+		task_steal(rt, i);
+	if ( n > task_queued(c) )
+		n = task_queued(c);
+	if ( !n )
+		return;
+
+	for ( k = 0; k < n; k++ ) {
+		task = &c->queue[c->qhead++ & (c->qsize - 1)];
+		desc[k].kernel = task->kernel;
+		desc[k].ret	   = 0;
+		memcpy(desc[k].arg, task->arg, sizeof(desc[k].arg));
+		c->inflight[(c->head + k) & (E_TASK_SLOTS - 1)] = task->ret;
+	}
+
+	slot  = c->head & (E_TASK_SLOTS - 1);
+	first = (n < E_TASK_SLOTS - slot) ? n : E_TASK_SLOTS - slot;
+	e_write(rt->dev, row, col, c->mbox + offsetof(e_task_mbox_t, slot[slot]),
+			desc, first * sizeof(e_task_desc_t));
+	if ( n > first )
+		e_write(rt->dev, row, col, c->mbox + offsetof(e_task_mbox_t, slot[0]),
+				&desc[first], (n - first) * sizeof(e_task_desc_t));
+
+	// The core starts on the new descriptors once it sees head move
+	c->head += n;
+	word = c->head;
+	e_write(rt->dev, row, col, c->mbox + offsetof(e_task_mbox_t, head), &word, sizeof(word));
+}
+
+
+int e_task_init(e_task_rt_t *rt, e_epiphany_t *dev, const char *executable, unsigned batch)
+{
+	volatile uint32_t *dir;
+	uint64_t		   deadline;
+	uint32_t		   magic;
+	unsigned		   i, ready;
+
+	if ( !rt || !dev || !executable ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	memset(rt, 0, sizeof(*rt));
+	rt->dev		  = dev;
+	rt->num_cores = dev->rows * dev->cols;
+	rt->batch	  = (batch && batch < E_TASK_SLOTS) ? batch : E_TASK_SLOTS;
+
+	rt->core = (e_task_core_t *) calloc(rt->num_cores, sizeof(e_task_core_t));
+	if ( !rt->core )
+		return E_ERR;
+
+	if ( E_OK != e_shm_alloc(&rt->dir, E_TASK_SHM_NAME, rt->num_cores * sizeof(uint32_t)) ) {
+		warnx("e_task_init(): Failed to allocate shared region %s.", E_TASK_SHM_NAME);
+		free(rt->core);
+		return E_ERR;
+	}
+	dir = (volatile uint32_t *) rt->dir.base;
+	memset((void *) dir, 0, rt->num_cores * sizeof(uint32_t));
+
+	if ( E_OK != e_load_group(executable, dev, 0, 0, dev->rows, dev->cols, E_TRUE) ) {
+		warnx("e_task_init(): Failed to load %s.", executable);
+		goto err;
+	}
+
+	// Wait for every core to publish its mailbox
+	deadline = task_now_ms() + TASK_INIT_TIMEOUT_MS;
+	do {
+		for ( i = 0, ready = 0; i < rt->num_cores; i++ )
+			ready += (0 != dir[i]);
+		if ( ready == rt->num_cores )
+			break;
+		usleep(1000);
+	} while ( task_now_ms() < deadline );
+
+	for ( i = 0; i < rt->num_cores; i++ ) {
+		rt->core[i].mbox = dir[i];
+		if ( !dir[i] ||
+			 sizeof(magic) != e_read(dev, i / dev->cols, i % dev->cols, dir[i], &magic, sizeof(magic)) ||
+			 E_TASK_MAGIC != magic ) {
+			warnx("e_task_init(): Core (%u,%u) does not serve tasks.", i / dev->cols, i % dev->cols);
+			goto err;
+		}
+	}
+
+	diag(H_D1) { fprintf(stderr, "e_task_init(): %u cores serving %s, batch %u\n",
+						 rt->num_cores, executable, rt->batch); }
+
+	return E_OK;
+
+ err:
+	e_reset_group(dev);
+	e_shm_release(E_TASK_SHM_NAME);
+	free(rt->core);
+	rt->core = NULL;
+	return E_ERR;
+}
+
+int e_task_submit(e_task_rt_t *rt, int core, unsigned kernel,
+				  const uint32_t *args, unsigned nargs, int32_t *ret)
+{
+	e_task_t task;
+	unsigned i, load, least = ~0U;
+
+	if ( !rt || !rt->core || kernel >= E_TASK_MAX_KERNELS || nargs > E_TASK_NUM_ARGS ||
+		 (nargs && !args) || (core != E_TASK_ANY && (core < 0 || (unsigned) core >= rt->num_cores)) ) {
+		errno = EINVAL;
+		return E_ERR;
+	}
+
+	if ( E_TASK_ANY == core ) {
+		for ( i = 0; i < rt->num_cores; i++ ) {
+			load = task_queued(&rt->core[i]) + rt->core[i].head - rt->core[i].tail;
+			if ( load < least ) {
+				least = load;
+				core  = i;
+			}
+		}
+	}
+
+	memset(&task, 0, sizeof(task));
+	task.kernel = kernel;
+	task.ret	= ret;
+	if ( nargs )
+		memcpy(task.arg, args, nargs * sizeof(uint32_t));
+
+	if ( E_OK != task_push(&rt->core[core], &task) ) {
+		errno = ENOMEM;
+		return E_ERR;
+	}
+
+	rt->pending++;
+
+	return E_OK;
+}
+
+unsigned e_task_poll(e_task_rt_t *rt)
+{
+	unsigned i;
+
+	if ( !rt || !rt->core )
+		return 0;
+
+	for ( i = 0; i < rt->num_cores; i++ ) {
+		task_collect(rt, i);
+		task_post(rt, i);
+	}
+
+	return rt->pending;
+}
+
+int e_task_wait(e_task_rt_t *rt, unsigned timeout_ms)
+{
+	uint64_t deadline = task_now_ms() + timeout_ms;
+	unsigned polls	  = 0;
+
+	while ( e_task_poll(rt) ) {
+		if ( timeout_ms && task_now_ms() >= deadline ) {
+			errno = ETIMEDOUT;
+			return E_ERR;
+		}
+		// Short tasks finish within a few polls, don't sleep on those
+		if ( ++polls > TASK_SPIN_POLLS )
+			usleep(100);
+	}
+
+	return E_OK;
+}
+
+int e_task_finalize(e_task_rt_t *rt)
+{
+	unsigned i;
+
+	if ( !rt || !rt->core )
+		return E_ERR;
+
+	diag(H_D1) {
+		for ( i = 0; i < rt->num_cores; i++ )
+			fprintf(stderr, "e_task_finalize(): core %u ran %llu tasks, stole %llu\n", i,
+					(unsigned long long) rt->core[i].finished,
+					(unsigned long long) rt->core[i].stolen);
+	}
+
+	e_reset_group(rt->dev);
+	e_shm_release(E_TASK_SHM_NAME);
+
+	for ( i = 0; i < rt->num_cores; i++ )
+		free(rt->core[i].queue);
+	free(rt->core);
+	rt->core = NULL;
+
+	return E_OK;
+}
@@ -0,0 +1,84 @@
+/*
+  File: e_coll.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_COLL_H_
+#define E_COLL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "e_common.h"
+#include "e_types.h"
+
+/* Arrays are split into chunks of this many bytes so that a core can
+ * forward one chunk while its parent is already sending the next one. */
+#define E_COLL_CHUNK          256
+
+/* Copies of at least this many bytes go through DMA instead of memcpy */
+#define E_COLL_DMA_THRESHOLD  256
+
+typedef enum {
+	E_COLL_INT      = 0,
+	E_COLL_UNSIGNED = 1,
+	E_COLL_FLOAT    = 2,
+} e_coll_type_t;
+
+typedef enum {
+	E_COLL_SUM = 0,
+	E_COLL_MIN = 1,
+	E_COLL_MAX = 2,
+} e_coll_op_t;
+
+/*
+ * Per-core collective state. Every core of the workgroup must pass an
+ * instance located at the same local address (e.g. a global variable),
+ * statically zero-initialized. The arrays are indexed by mesh direction.
+ */
+typedef struct {
+	volatile unsigned rx[4];      // messages delivered by the neighbour
+	volatile unsigned credit[4];  // messages the neighbour accepts from us
+	unsigned          seen[4];    // messages consumed from the neighbour
+	unsigned          sent[4];    // messages sent to the neighbour
+	unsigned          granted[4]; // credit given to the neighbour
+	unsigned          slot[4][E_COLL_CHUNK / sizeof(unsigned)] ALIGN(8);
+} e_coll_t;
+
+/*
+ * All collectives must be called by every core of the workgroup with the
+ * same arguments, and the buffers must sit at the same local address on
+ * every core.
+ */
+void e_coll_bcast(e_coll_t *coll, void *buf, size_t n, unsigned root_row, unsigned root_col);
+void e_coll_reduce(e_coll_t *coll, void *dst, const void *src, unsigned count,
+		e_coll_type_t type, e_coll_op_t op, unsigned root_row, unsigned root_col);
+void e_coll_allgather(e_coll_t *coll, void *dst, const void *src, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_COLL_H_ */
@@ -36,6 +36,13 @@
 #include "e_mutex.h"
 #include "e_coreid.h"
 #include "e_shm.h"
+#include "e_queue.h"
+#include "e_task.h"
+#include "e_mailbox.h"
+#include "e_overlay.h"
+#include "e_coll.h"
+#include "e_multicast.h"
+#include "e_prof.h"
 
 #endif /* __ELIB_H__ */
 
@@ -0,0 +1,76 @@
+/*
+  File: e_mailbox.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_MAILBOX_H_
+#define E_MAILBOX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "e_common.h"
+#include "e_types.h"
+
+#define E_MAILBOX_MAGIC    0x584f424d // "MBOX"
+#define E_MAILBOX_SHM_NAME "e_mailbox"
+#define E_MAILBOX_RING     8          // messages per core ring, a power of two
+
+/**
+ * NOTE: The message, ring and header layouts must match the ones defined
+ * in the e-hal.
+ */
+typedef struct {
+	uint32_t		  from;       // core ID of the sender
+	uint32_t		  data;
+} e_mailbox_msg_t;
+
+typedef struct ALIGN(8) e_mailbox_ring {
+	volatile uint32_t head;       // free-running, written by the core
+	volatile uint32_t tail;       // free-running, written by the host
+	e_mailbox_msg_t	  msg[E_MAILBOX_RING];
+} e_mailbox_ring_t;
+
+typedef struct ALIGN(8) e_mailbox_hdr {
+	volatile uint32_t magic;      // E_MAILBOX_MAGIC once the host listens
+	volatile uint32_t gen;        // changes each time the host opens the mailbox
+	uint32_t		  hw_addr;    // mailbox register to post to, 0 for the rings
+	uint32_t		  row;        // platform origin and size, one ring per core
+	uint32_t		  col;
+	uint32_t		  rows;
+	uint32_t		  cols;
+	e_mailbox_ring_t  ring[];
+} e_mailbox_hdr_t;
+
+/** Send data to the host, tagged with the core ID. Waits while the ring
+ *  of this core is full. Fails if the host has not opened the mailbox or
+ *  closes it while the core waits. */
+int e_mailbox_post(uint32_t data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_MAILBOX_H_ */
@@ -0,0 +1,62 @@
+/*
+  File: e_multicast.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_MULTICAST_H_
+#define E_MULTICAST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "e_types.h"
+#include "e_coreid.h"
+
+/* MESHCFG transmit mode field */
+#define E_MESHCFG_TXMODE_MASK      0x000000f0
+#define E_MESHCFG_TXMODE_MULTICAST 0x00000030
+
+typedef enum {
+	E_MULTICAST_HW      = 0,  // one mesh multicast transaction
+	E_MULTICAST_UNICAST = 1,  // one write per workgroup core
+} e_multicast_mode_t;
+
+/*
+ * Every core of the workgroup calls e_multicast_init() with the same
+ * 12-bit multicast ID before any core multicasts. With E_MULTICAST_HW the
+ * core starts listening on mcast_id; E_MULTICAST_UNICAST is the fallback
+ * for targets without mesh multicast and only records the mode.
+ */
+void  e_multicast_init(e_coreid_t mcast_id, e_multicast_mode_t mode);
+
+/* Write n bytes from src to dst on every core of the workgroup, including
+ * the calling one. dst is a local address. */
+void *e_multicast_write(void *dst, const void *src, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_MULTICAST_H_ */
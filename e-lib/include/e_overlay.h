@@ -0,0 +1,69 @@
+/*
+  File: e_overlay.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_OVERLAY_H_
+#define E_OVERLAY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "e_common.h"
+#include "e_types.h"
+
+/**
+ * NOTE: The overlay configuration must match struct overlay_cfg in the
+ * e-hal loader. It is placed in the overlay_cfg section, at 0x68.
+ */
+typedef struct {
+	void			 *base;       // start of the overlay region
+	unsigned		  size;       // size of the overlay region
+	volatile unsigned seq;        // bumped by the host after it loaded an overlay
+	volatile unsigned done;       // seq of the last overlay that returned
+	void   (* volatile entry)(void); // entry point of the loaded overlay, read after seq
+	unsigned		  __pad;
+} e_overlay_cfg_t;
+
+extern e_overlay_cfg_t e_overlay_cfg;
+
+/**
+ * Reserve a size bytes overlay region in the resident program. Use it
+ * once, at file scope. Overlays are linked to load at e_overlay_area.
+ */
+#define E_OVERLAY_REGION(size)                                             \
+	uint8_t e_overlay_area[size] ALIGN(8);                                 \
+	e_overlay_cfg_t e_overlay_cfg SECTION("overlay_cfg") =                 \
+		{ e_overlay_area, (size), 0, 0, 0, 0 }
+
+/** Idle until the host loads an overlay with e_load_overlay(), run it and
+ *  go back to idle when it returns. Never returns. */
+void e_overlay_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_OVERLAY_H_ */
@@ -0,0 +1,92 @@
+/*
+  File: e_prof.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_PROF_H_
+#define E_PROF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file e_prof.h
+ * @brief Region profiling on top of the core timers
+ *
+ * @section DESCRIPTION
+ * Code regions are bracketed with e_prof_begin()/e_prof_end() and may be
+ * nested. CTIMER0 counts clock cycles and CTIMER1 counts the event chosen
+ * at e_prof_init() (idle cycles, one of the stall classes, ...). The
+ * per-region totals of every core are published into the shared memory
+ * region E_PROF_SHM_NAME, which the host allocates and reads with e-prof
+ * while the program keeps running.
+ *
+ * Pass E_CTIMER_OFF as the event to leave CTIMER1 alone, e.g. when
+ * e-trace is used at the same time.
+ */
+
+#include <stdint.h>
+#include "e_common.h"
+#include "e_ctimers.h"
+
+#define E_PROF_SHM_NAME     "e_prof_table"
+#define E_PROF_MAGIC        0xe9f0f001
+#define E_PROF_MAX_REGIONS  16
+#define E_PROF_NAME_LEN     16
+#define E_PROF_MAX_DEPTH    8
+
+/**
+ * NOTE: The table layout must match the one used by the
+ * e-prof host utility.
+ */
+typedef struct ALIGN(8) {
+	char              name[E_PROF_NAME_LEN];
+	volatile uint32_t seq;      // odd while the entry is being updated
+	uint32_t          count;    // completed begin/end pairs
+	uint64_t          cycles;   // clock cycles spent inside the region
+	uint64_t          events;   // CTIMER1 events counted inside the region
+} e_prof_entry_t;
+
+typedef struct ALIGN(8) {
+	uint32_t          coreid;   // 0 if no core uses this slot
+	uint32_t          event;    // e_ctimer_config_t counted in 'events'
+	e_prof_entry_t    region[E_PROF_MAX_REGIONS];
+} e_prof_core_t;
+
+typedef struct ALIGN(8) {
+	uint32_t          magic;
+	uint32_t          num_cores; // number of per-core slots that follow
+	e_prof_core_t     core[];    // indexed by core number in the workgroup
+} e_prof_table_t;
+
+int  e_prof_init(e_ctimer_config_t event);
+void e_prof_name(unsigned region, const char *name);
+void e_prof_begin(unsigned region);
+void e_prof_end(unsigned region);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_PROF_H_ */
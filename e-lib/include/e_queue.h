@@ -0,0 +1,90 @@
+/*
+  File: e_queue.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_QUEUE_H_
+#define E_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "e_common.h"
+#include "e_types.h"
+
+#define E_QUEUE_MAGIC     0x5155e001
+#define E_QUEUE_LINE_SIZE 64
+
+/* Batches of at least this many bytes are moved with DMA instead of memcpy */
+#define E_QUEUE_DMA_THRESHOLD 64
+
+typedef enum {
+	E_QUEUE_H2D = 0,          // host produces, eCore consumes
+	E_QUEUE_D2H = 1,          // eCore produces, host consumes
+} e_queue_dir_t;
+
+/**
+ * NOTE: The queue header must match the one defined
+ * in the e-hal.
+ */
+typedef struct ALIGN(8) e_queue_hdr {
+	uint32_t		 magic;       // E_QUEUE_MAGIC once initialized
+	uint32_t		 dir;         // e_queue_dir_t
+	uint32_t		 item_size;   // size of a single item in bytes
+	uint32_t		 capacity;    // number of items, always a power of two
+	uint32_t		 data_offset; // offset of item storage from header
+	uint8_t			 __pad0[E_QUEUE_LINE_SIZE - 5 * sizeof(uint32_t)];
+	volatile uint32_t head;       // free-running write index, producer only
+	uint8_t			 __pad1[E_QUEUE_LINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t tail;       // free-running read index, consumer only
+	uint8_t			 __pad2[E_QUEUE_LINE_SIZE - sizeof(uint32_t)];
+} e_queue_hdr_t;
+
+typedef struct {
+	e_queue_hdr_t	*hdr;         // global address of the shared header
+	uint8_t			*data;        // global address of item storage
+	unsigned		 item_size;   // size of a single item in bytes
+	unsigned		 mask;        // capacity - 1
+	unsigned		 head;        // local copy of the write index
+	unsigned		 tail;        // local copy of the read index
+} e_queue_t;
+
+/** Attach to a queue allocated on the host with e_queue_alloc() */
+int e_queue_attach(e_queue_t *q, const char *name);
+
+/** Push up to n items into an E_QUEUE_D2H queue, returns the number queued */
+unsigned e_queue_push(e_queue_t *q, const void *items, unsigned n);
+
+/** Pop up to n items from an E_QUEUE_H2D queue, returns the number copied */
+unsigned e_queue_pop(e_queue_t *q, void *items, unsigned n);
+
+/** Return the number of items currently held by the queue */
+unsigned e_queue_count(e_queue_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_QUEUE_H_ */
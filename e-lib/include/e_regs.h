@@ -149,6 +149,7 @@ typedef enum {
 	// Node Registers
 	E_REG_MESHCFG          = E_CORE_SP_REG_BASE + 0x0700,
 	E_REG_COREID           = E_CORE_SP_REG_BASE + 0x0704,
+	E_REG_MULTICAST        = E_CORE_SP_REG_BASE + 0x0708,
 	E_REG_CORE_RESET       = E_CORE_SP_REG_BASE + 0x070c,
 } e_core_reg_id_t;
 
@@ -0,0 +1,77 @@
+/*
+  File: e_task.h
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef E_TASK_H_
+#define E_TASK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "e_common.h"
+#include "e_types.h"
+
+#define E_TASK_MAGIC       0x4b534154 // "TASK"
+#define E_TASK_SLOTS       8          // descriptors per mailbox, a power of two
+#define E_TASK_NUM_ARGS    6
+#define E_TASK_MAX_KERNELS 32
+#define E_TASK_SHM_NAME    "e_task_rt"
+
+/* Result of a task whose kernel is not registered */
+#define E_TASK_NO_KERNEL   ((int32_t) 0x80000000)
+
+/**
+ * NOTE: The descriptor and mailbox layouts must match the ones defined
+ * in the e-hal.
+ */
+typedef struct ALIGN(8) e_task_desc {
+	uint32_t		  kernel;     // kernel ID given to e_task_register()
+	int32_t			  ret;        // return value of the kernel
+	uint32_t		  arg[E_TASK_NUM_ARGS];
+} e_task_desc_t;
+
+typedef struct ALIGN(8) e_task_mbox {
+	uint32_t		  magic;      // E_TASK_MAGIC once the core serves tasks
+	volatile uint32_t head;       // free-running count of posted tasks, host only
+	volatile uint32_t tail;       // free-running count of finished tasks, core only
+	uint32_t		  __pad;
+	e_task_desc_t	  slot[E_TASK_SLOTS];
+} e_task_mbox_t;
+
+typedef int32_t (*e_task_kernel_t)(const uint32_t *args);
+
+/** Make fn the kernel run for tasks with ID kernel */
+int e_task_register(unsigned kernel, e_task_kernel_t fn);
+
+/** Publish the mailbox to the host and run the posted tasks. Only returns
+ *  if the host did not set up the task runtime. */
+int e_task_serve(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* E_TASK_H_ */
@@ -60,10 +60,27 @@ extern "C" {
 #define T_BP_15 (15 <<20)
 
 #define TRACE_FILE_MAGIC (0xE3ACE)
+
+/**
+ * Events per half of the local SRAM buffer in buffered mode, each full
+ * half is sent to the host with one DMA burst (two halves of 256 bytes).
+ * Fixed: traceLocalBuf is sized with it when e-lib is built.
+ */
+#define TRACE_LOCAL_EVENTS 32
+
 /**
  * Initialize data structures, call this first before using trace functions
  */
 int trace_init();
+/**
+ * Initialize in buffered mode, events are collected in local SRAM and sent
+ * to the host in DMA0 bursts; DMA0 must not be used by the application
+ */
+int trace_init_buffered();
+/**
+ * Send buffered events to the host and wait until they are visible there
+ */
+int trace_flush();
 /**
  * This function starts the clock counter, tracing can be used after this call
  */
@@ -80,6 +97,8 @@ int trace_start_wait_all();
  * @param event - event id
  * @param breakpoint - place in user code that we hit
  * @param data - data associated with the event
+ * @return 0 on success, -1 if the ring was full and the event was dropped
+ * (in buffered mode drops are counted per burst and 0 is returned)
  */
 int trace_write(unsigned severity, unsigned event, unsigned breakpoint, unsigned data);
 
@@ -88,6 +107,67 @@ int trace_write(unsigned severity, unsigned event, unsigned breakpoint, unsigned
  */
 int trace_stop();
 
+/**
+ * Compile-time filtering of trace points
+ *
+ * E_TRACE_LEVEL is the least severe level that is kept: 0 keeps errors only,
+ * 3 (default) keeps everything up to debug, -1 removes all trace points.
+ * E_TRACE_EVENT_MASK has one bit per event id (bit n for event id n) and
+ * removes the event classes whose bit is clear.
+ *
+ * E_TRACE() with constant severity and event compiles to nothing when
+ * filtered out. When kept it is inlined; in buffered mode (see
+ * trace_init_buffered) an event costs a timer read and one local store,
+ * only a full half of the local buffer calls out to trace_write().
+ *
+ *   E_TRACE(T_SEVERITY_DEBUG, T_EVENT_PROCESSING_START, T_BP_1, i);
+ */
+#ifndef E_TRACE_LEVEL
+#define E_TRACE_LEVEL 3
+#endif
+
+#ifndef E_TRACE_EVENT_MASK
+#define E_TRACE_EVENT_MASK 0xFFFFFFFFFFFFFFFFULL
+#endif
+
+#define E_TRACE_ENABLED(severity, event) \
+	((int)(((unsigned)(severity) >> 30) & 0x3) <= (E_TRACE_LEVEL) && \
+	 (((E_TRACE_EVENT_MASK) >> (((unsigned)(event) >> 24) & 0x3F)) & 1))
+
+#define E_TRACE(severity, event, breakpoint, data) \
+	do { \
+		if (E_TRACE_ENABLED(severity, event)) \
+			trace_write_inline((severity) | (event) | (breakpoint), (data) & 0xFF); \
+	} while (0)
+
+/* State of the trace module, only for the inline fast path below */
+extern unsigned logCoreid;
+extern unsigned traceLocal;
+extern unsigned traceLocalCnt;
+extern unsigned long long *traceLocalWrPtr;
+
+/**
+ * Inline fast path of trace_write(), use through E_TRACE()
+ * @param tag - severity | event | breakpoint
+ * @param data - data associated with the event (8 bits)
+ * @return 0 on success, -1 if the event was dropped
+ */
+static inline int trace_write_inline(unsigned tag, unsigned data)
+{
+	unsigned dta[2];
+
+	if (traceLocal && traceLocalCnt < TRACE_LOCAL_EVENTS - 1)
+	{
+		__asm__ __volatile__ ("movfs %0, ctimer1" : "=r" (dta[0]));
+		dta[1] = tag | logCoreid | data;
+		*traceLocalWrPtr++ = *(unsigned long long *) dta;
+		traceLocalCnt++;
+		return 0;
+	}
+
+	return trace_write(tag, 0, 0, data);
+}
+
 #ifdef __cplusplus
 }
 #endif
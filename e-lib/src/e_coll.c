@@ -0,0 +1,301 @@
+/*
+  File: e_coll.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Workgroup collectives.
+ *
+ * All traffic goes between mesh neighbours only. Every core owns a set of
+ * counters per direction: "rx" is bumped by the neighbour after it has
+ * written a message into our memory, and "credit" is bumped by the
+ * neighbour to tell us how many messages it is ready to accept. A sender
+ * never writes before it holds a credit, so receive buffers are never
+ * overwritten while still in use and no barrier is needed between calls.
+ *
+ * Broadcast and reduce use a tree rooted at (root_row, root_col): the
+ * root column forms a vertical chain and every row forms a horizontal
+ * chain hanging off it. Data is pipelined through the chains in chunks of
+ * E_COLL_CHUNK bytes. Allgather runs a bidirectional chain along every row
+ * followed by one along every column.
+ */
+
+#include <string.h>
+#include "e_coreid.h"
+#include "e_dma.h"
+#include "e_coll.h"
+
+enum {
+	DIR_N    = 0,
+	DIR_S    = 1,
+	DIR_W    = 2,
+	DIR_E    = 3,
+	DIR_NONE = -1,
+};
+
+#define OPPOSITE(dir) ((dir) ^ 1)
+
+
+static void *coll_remote(int dir, const void *ptr)
+{
+	unsigned row = e_group_config.core_row;
+	unsigned col = e_group_config.core_col;
+
+	switch (dir) {
+	case DIR_N: row--; break;
+	case DIR_S: row++; break;
+	case DIR_W: col--; break;
+	case DIR_E: col++; break;
+	}
+
+	return e_get_global_address(row, col, ptr);
+}
+
+static void coll_copy(void *dst, const void *src, size_t n)
+{
+	if (n >= E_COLL_DMA_THRESHOLD)
+		e_dma_copy(dst, (void *) src, n);
+	else
+		memcpy(dst, src, n);
+}
+
+static void coll_grant(e_coll_t *coll, int dir, unsigned n)
+{
+	volatile unsigned *credit;
+
+	if (dir == DIR_NONE || n == 0)
+		return;
+
+	coll->granted[dir] += n;
+	credit  = (volatile unsigned *) coll_remote(dir, (const void *) &coll->credit[OPPOSITE(dir)]);
+	*credit = coll->granted[dir];
+}
+
+/* Write n bytes from src to the location of ptr in the neighbour's memory */
+static void coll_send(e_coll_t *coll, int dir, void *ptr, const void *src, size_t n)
+{
+	volatile unsigned *rx;
+
+	while ((int) (coll->credit[dir] - coll->sent[dir]) <= 0) ;
+
+	coll_copy(coll_remote(dir, ptr), src, n);
+
+	/* Writes to the same core arrive in order, so the data lands first */
+	coll->sent[dir]++;
+	rx  = (volatile unsigned *) coll_remote(dir, (const void *) &coll->rx[OPPOSITE(dir)]);
+	*rx = coll->sent[dir];
+}
+
+static void coll_wait(e_coll_t *coll, int dir)
+{
+	while (coll->rx[dir] == coll->seen[dir]) ;
+	coll->seen[dir]++;
+}
+
+static int coll_parent(unsigned root_row, unsigned root_col)
+{
+	unsigned row = e_group_config.core_row;
+	unsigned col = e_group_config.core_col;
+
+	if (col < root_col) return DIR_E;
+	if (col > root_col) return DIR_W;
+	if (row < root_row) return DIR_S;
+	if (row > root_row) return DIR_N;
+
+	return DIR_NONE;
+}
+
+static unsigned coll_children(unsigned root_row, unsigned root_col, int *child)
+{
+	unsigned row  = e_group_config.core_row;
+	unsigned col  = e_group_config.core_col;
+	unsigned num  = 0;
+
+	if (col == root_col && row <= root_row && row > 0)
+		child[num++] = DIR_N;
+	if (col == root_col && row >= root_row && row < e_group_config.group_rows - 1)
+		child[num++] = DIR_S;
+	if (col <= root_col && col > 0)
+		child[num++] = DIR_W;
+	if (col >= root_col && col < e_group_config.group_cols - 1)
+		child[num++] = DIR_E;
+
+	return num;
+}
+
+#define COLL_COMBINE(T, d, s, count, op)                              \
+	do {                                                              \
+		T *_d = (T *) (d);                                            \
+		const T *_s = (const T *) (s);                                \
+		unsigned _i;                                                  \
+		switch (op) {                                                 \
+		case E_COLL_SUM:                                              \
+			for (_i = 0; _i < (count); _i++) _d[_i] += _s[_i];        \
+			break;                                                    \
+		case E_COLL_MIN:                                              \
+			for (_i = 0; _i < (count); _i++)                          \
+				if (_s[_i] < _d[_i]) _d[_i] = _s[_i];                 \
+			break;                                                    \
+		case E_COLL_MAX:                                              \
+			for (_i = 0; _i < (count); _i++)                          \
+				if (_s[_i] > _d[_i]) _d[_i] = _s[_i];                 \
+			break;                                                    \
+		}                                                             \
+	} while (0)
+
+static void coll_combine(void *dst, const void *src, unsigned count,
+		e_coll_type_t type, e_coll_op_t op)
+{
+	switch (type) {
+	case E_COLL_INT:
+		COLL_COMBINE(int, dst, src, count, op);
+		break;
+	case E_COLL_UNSIGNED:
+		COLL_COMBINE(unsigned, dst, src, count, op);
+		break;
+	case E_COLL_FLOAT:
+		COLL_COMBINE(float, dst, src, count, op);
+		break;
+	}
+}
+
+
+void e_coll_bcast(e_coll_t *coll, void *buf, size_t n, unsigned root_row, unsigned root_col)
+{
+	char     *p = (char *) buf;
+	int       parent, child[4];
+	unsigned  nchild, nchunks, i, j;
+	size_t    off, len;
+
+	parent  = coll_parent(root_row, root_col);
+	nchild  = coll_children(root_row, root_col, child);
+	nchunks = (n + E_COLL_CHUNK - 1) / E_COLL_CHUNK;
+
+	/* The whole buffer is ours to receive into */
+	coll_grant(coll, parent, nchunks);
+
+	for (i = 0, off = 0; i < nchunks; i++, off += len) {
+		len = (n - off < E_COLL_CHUNK) ? n - off : E_COLL_CHUNK;
+
+		if (parent != DIR_NONE)
+			coll_wait(coll, parent);
+
+		for (j = 0; j < nchild; j++)
+			coll_send(coll, child[j], p + off, p + off, len);
+	}
+}
+
+
+void e_coll_reduce(e_coll_t *coll, void *dst, const void *src, unsigned count,
+		e_coll_type_t type, e_coll_op_t op, unsigned root_row, unsigned root_col)
+{
+	const unsigned  per_chunk = E_COLL_CHUNK / sizeof(unsigned);
+	unsigned       *d = (unsigned *) dst;
+	const unsigned *s = (const unsigned *) src;
+	int             parent, child[4];
+	unsigned        nchild, nchunks, i, j, off, len;
+
+	parent  = coll_parent(root_row, root_col);
+	nchild  = coll_children(root_row, root_col, child);
+	nchunks = (count + per_chunk - 1) / per_chunk;
+
+	/* Each child gets a single landing slot, handed back after use */
+	for (j = 0; j < nchild; j++)
+		coll_grant(coll, child[j], nchunks ? 1 : 0);
+
+	for (i = 0, off = 0; i < nchunks; i++, off += len) {
+		len = (count - off < per_chunk) ? count - off : per_chunk;
+
+		if (d != s)
+			memcpy(d + off, s + off, len * sizeof(unsigned));
+
+		for (j = 0; j < nchild; j++) {
+			coll_wait(coll, child[j]);
+			coll_combine(d + off, coll->slot[child[j]], len, type, op);
+			if (i + 1 < nchunks)
+				coll_grant(coll, child[j], 1);
+		}
+
+		if (parent != DIR_NONE)
+			coll_send(coll, parent, coll->slot[OPPOSITE(parent)],
+					d + off, len * sizeof(unsigned));
+	}
+}
+
+
+void e_coll_allgather(e_coll_t *coll, void *dst, const void *src, size_t n)
+{
+	char     *p    = (char *) dst;
+	unsigned  row  = e_group_config.core_row;
+	unsigned  col  = e_group_config.core_col;
+	unsigned  rows = e_group_config.group_rows;
+	unsigned  cols = e_group_config.group_cols;
+	size_t    seg  = cols * n;
+	unsigned  k, r, c;
+
+	/* Every block we are going to receive lands at its own offset */
+	coll_grant(coll, (col > 0)        ? DIR_W : DIR_NONE, col);
+	coll_grant(coll, (col < cols - 1) ? DIR_E : DIR_NONE, cols - 1 - col);
+	coll_grant(coll, (row > 0)        ? DIR_N : DIR_NONE, row);
+	coll_grant(coll, (row < rows - 1) ? DIR_S : DIR_NONE, rows - 1 - row);
+
+	coll_copy(p + row * seg + col * n, src, n);
+
+	/* Row phase: own block both ways, then pass through the other blocks */
+	if (col < cols - 1)
+		coll_send(coll, DIR_E, p + row * seg + col * n, p + row * seg + col * n, n);
+	if (col > 0)
+		coll_send(coll, DIR_W, p + row * seg + col * n, p + row * seg + col * n, n);
+
+	for (k = 0; k < col; k++) {
+		c = col - 1 - k;
+		coll_wait(coll, DIR_W);
+		if (col < cols - 1)
+			coll_send(coll, DIR_E, p + row * seg + c * n, p + row * seg + c * n, n);
+	}
+	for (k = 0; k < cols - 1 - col; k++) {
+		c = col + 1 + k;
+		coll_wait(coll, DIR_E);
+		if (col > 0)
+			coll_send(coll, DIR_W, p + row * seg + c * n, p + row * seg + c * n, n);
+	}
+
+	/* Column phase: same again with whole row segments */
+	if (row < rows - 1)
+		coll_send(coll, DIR_S, p + row * seg, p + row * seg, seg);
+	if (row > 0)
+		coll_send(coll, DIR_N, p + row * seg, p + row * seg, seg);
+
+	for (k = 0; k < row; k++) {
+		r = row - 1 - k;
+		coll_wait(coll, DIR_N);
+		if (row < rows - 1)
+			coll_send(coll, DIR_S, p + r * seg, p + r * seg, seg);
+	}
+	for (k = 0; k < rows - 1 - row; k++) {
+		r = row + 1 + k;
+		coll_wait(coll, DIR_S);
+		if (row > 0)
+			coll_send(coll, DIR_N, p + r * seg, p + r * seg, seg);
+	}
+}
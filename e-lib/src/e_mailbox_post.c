@@ -0,0 +1,89 @@
+/*
+  File: e_mailbox_post.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include "e_coreid.h"
+#include "e_shm.h"
+#include "e_mailbox.h"
+
+
+static e_mailbox_hdr_t	*e_mailbox_hdr;
+static e_mailbox_ring_t *e_mailbox_ring;
+static unsigned			 e_mailbox_head;
+static unsigned			 e_mailbox_tail;
+static uint64_t			 e_mailbox_id;	/* magic and gen when attached */
+
+int e_mailbox_post(uint32_t data)
+{
+	e_memseg_t		 mem;
+	e_mailbox_msg_t *msg;
+	unsigned		 row, col;
+
+	/* magic and gen, the first doubleword of the header, in one read.
+	 * After a close or reopen by the host the cached header, ring and
+	 * head/tail are stale, so attach again. */
+	if ( !e_mailbox_hdr || *(volatile uint64_t *) e_mailbox_hdr != e_mailbox_id ) {
+		e_mailbox_hdr = 0;
+		if ( E_OK != e_shm_attach(&mem, E_MAILBOX_SHM_NAME) )
+			return E_ERR;
+		e_mailbox_hdr = (e_mailbox_hdr_t *) mem.ephy_base;
+		e_mailbox_id  = *(volatile uint64_t *) e_mailbox_hdr;
+		if ( (uint32_t) e_mailbox_id != E_MAILBOX_MAGIC ) {
+			e_mailbox_hdr = 0;
+			return E_ERR;
+		}
+
+		row = e_group_config.group_row + e_group_config.core_row - e_mailbox_hdr->row;
+		col = e_group_config.group_col + e_group_config.core_col - e_mailbox_hdr->col;
+		if ( row >= e_mailbox_hdr->rows || col >= e_mailbox_hdr->cols ) {
+			e_mailbox_hdr = 0;
+			return E_ERR;
+		}
+		e_mailbox_ring = &e_mailbox_hdr->ring[row * e_mailbox_hdr->cols + col];
+		e_mailbox_head = e_mailbox_ring->head;
+		e_mailbox_tail = e_mailbox_ring->tail;
+	}
+
+	/* One doubleword write, the e-link queues it in the mailbox FIFO */
+	if ( e_mailbox_hdr->hw_addr ) {
+		*(volatile uint64_t *) e_mailbox_hdr->hw_addr =
+			((uint64_t) data << 32) | e_get_coreid();
+		return E_OK;
+	}
+
+	/* Only read the host's tail back when the ring looks full */
+	while ( e_mailbox_head - e_mailbox_tail >= E_MAILBOX_RING ) {
+		if ( *(volatile uint64_t *) e_mailbox_hdr != e_mailbox_id )
+			return E_ERR;	/* closed while waiting */
+		e_mailbox_tail = e_mailbox_ring->tail;
+	}
+
+	msg = &e_mailbox_ring->msg[e_mailbox_head & (E_MAILBOX_RING - 1)];
+	msg->from = e_get_coreid();
+	msg->data = data;
+
+	e_mailbox_ring->head = ++e_mailbox_head;
+
+	return E_OK;
+}
@@ -0,0 +1,42 @@
+/*
+  File: e_multicast_init.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include "e_regs.h"
+#include "e_multicast.h"
+
+e_coreid_t         _e_multicast_id_   = 0;
+e_multicast_mode_t _e_multicast_mode_ = E_MULTICAST_UNICAST;
+
+
+void e_multicast_init(e_coreid_t mcast_id, e_multicast_mode_t mode)
+{
+	_e_multicast_id_   = mcast_id & 0xfff;
+	_e_multicast_mode_ = mode;
+
+	if (mode == E_MULTICAST_HW)
+		e_reg_write(E_REG_MULTICAST, _e_multicast_id_);
+
+	return;
+}
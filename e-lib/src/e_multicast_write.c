@@ -0,0 +1,70 @@
+/*
+  File: e_multicast_write.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "e_regs.h"
+#include "e_coreid.h"
+#include "e_ic.h"
+#include "e_multicast.h"
+
+extern e_coreid_t         _e_multicast_id_;
+extern e_multicast_mode_t _e_multicast_mode_;
+
+#define E_STATUS_GID (1 << 1) // interrupts globally disabled
+
+
+void *e_multicast_write(void *dst, const void *src, size_t n)
+{
+	unsigned meshcfg, irq_off, row, col;
+	void    *gdst;
+
+	if (_e_multicast_mode_ == E_MULTICAST_HW)
+	{
+		gdst = (void *) ((_e_multicast_id_ << 20) | ((unsigned) dst & 0x000fffff));
+
+		// While in multicast mode every remote store fans out, so keep
+		// the window as small as the copy itself and keep ISRs (the trace
+		// and profiling timers among them) from storing during it.
+		irq_off = e_reg_read(E_REG_STATUS) & E_STATUS_GID;
+		e_irq_global_mask(E_TRUE);
+		meshcfg = e_reg_read(E_REG_MESHCFG);
+		e_reg_write(E_REG_MESHCFG, (meshcfg & ~E_MESHCFG_TXMODE_MASK) | E_MESHCFG_TXMODE_MULTICAST);
+		memcpy(gdst, src, n);
+		e_reg_write(E_REG_MESHCFG, meshcfg);
+		if ( !irq_off )
+			e_irq_global_mask(E_FALSE);
+	} else {
+		for (row = 0; row < e_group_config.group_rows; row++)
+			for (col = 0; col < e_group_config.group_cols; col++)
+				if ((row != e_group_config.core_row) || (col != e_group_config.core_col))
+					memcpy(e_get_global_address(row, col, dst), src, n);
+	}
+
+	// The sender is not a receiver of its own multicast
+	if (dst != src)
+		memcpy(dst, src, n);
+
+	return dst;
+}
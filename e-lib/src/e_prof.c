@@ -0,0 +1,187 @@
+/*
+  File: e_prof.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include "e_coreid.h"
+#include "e_ctimers.h"
+#include "e_ic.h"
+#include "e_shm.h"
+#include "e_prof.h"
+
+void __attribute__((interrupt)) timer0_prof_isr();
+void __attribute__((interrupt)) timer1_prof_isr();
+
+typedef struct {
+	unsigned region;
+	unsigned clk;
+	unsigned evt;
+} prof_frame_t;
+
+static e_prof_core_t     *prof_slot;
+static e_ctimer_config_t  prof_event;
+static prof_frame_t       prof_stack[E_PROF_MAX_DEPTH];
+static unsigned           prof_depth;
+
+/* Local copies, so that publishing never has to read external memory */
+static unsigned           prof_seq[E_PROF_MAX_REGIONS];
+static unsigned           prof_count[E_PROF_MAX_REGIONS];
+static uint64_t           prof_cycles[E_PROF_MAX_REGIONS];
+static uint64_t           prof_events[E_PROF_MAX_REGIONS];
+
+
+/**
+ * Attach to the profiling table and start the counters
+ * @param event - what CTIMER1 counts, or E_CTIMER_OFF to leave it alone
+ */
+int e_prof_init(e_ctimer_config_t event)
+{
+	e_memseg_t      mem;
+	e_prof_table_t *table;
+	unsigned        corenum, i;
+
+	if ( E_OK != e_shm_attach(&mem, E_PROF_SHM_NAME) )
+		return E_ERR;
+
+	table   = (e_prof_table_t *) mem.ephy_base;
+	corenum = e_group_config.core_row * e_group_config.group_cols + e_group_config.core_col;
+	if ( table->magic != E_PROF_MAGIC || corenum >= table->num_cores )
+		return E_ERR;
+
+	prof_slot  = &table->core[corenum];
+	prof_event = event;
+	prof_depth = 0;
+
+	for (i = 0; i < E_PROF_MAX_REGIONS; i++) {
+		prof_seq[i]    = 0;
+		prof_count[i]  = 0;
+		prof_cycles[i] = 0;
+		prof_events[i] = 0;
+
+		prof_slot->region[i].name[0] = '\0';
+		prof_slot->region[i].seq     = 0;
+		prof_slot->region[i].count   = 0;
+		prof_slot->region[i].cycles  = 0;
+		prof_slot->region[i].events  = 0;
+	}
+	prof_slot->event  = event;
+	prof_slot->coreid = e_get_coreid();
+
+	// The timers count down and stop at zero, reload them from the ISRs
+	e_irq_global_mask(E_FALSE);
+
+	e_irq_attach(E_TIMER0_INT, timer0_prof_isr);
+	e_irq_mask(E_TIMER0_INT, E_FALSE);
+	e_ctimer_stop(E_CTIMER_0);
+	e_ctimer_set(E_CTIMER_0, E_CTIMER_MAX);
+	e_ctimer_start(E_CTIMER_0, E_CTIMER_CLK);
+
+	if (event != E_CTIMER_OFF) {
+		e_irq_attach(E_TIMER1_INT, timer1_prof_isr);
+		e_irq_mask(E_TIMER1_INT, E_FALSE);
+		e_ctimer_stop(E_CTIMER_1);
+		e_ctimer_set(E_CTIMER_1, E_CTIMER_MAX);
+		e_ctimer_start(E_CTIMER_1, event);
+	}
+
+	return E_OK;
+}
+
+/**
+ * Give a region a name that the host tool will show
+ */
+void e_prof_name(unsigned region, const char *name)
+{
+	char    *dst;
+	unsigned i;
+
+	// Without a slot from e_prof_init() there is nowhere to write to
+	if (!prof_slot || region >= E_PROF_MAX_REGIONS)
+		return;
+
+	dst = prof_slot->region[region].name;
+	for (i = 0; i < E_PROF_NAME_LEN - 1 && name[i]; i++)
+		dst[i] = name[i];
+	dst[i] = '\0';
+}
+
+void e_prof_begin(unsigned region)
+{
+	prof_frame_t *f;
+
+	if (prof_depth >= E_PROF_MAX_DEPTH)
+		return;
+
+	f = &prof_stack[prof_depth++];
+	f->region = region;
+	f->evt    = (prof_event != E_CTIMER_OFF) ? e_ctimer_get(E_CTIMER_1) : 0;
+	f->clk    = e_ctimer_get(E_CTIMER_0);
+}
+
+void e_prof_end(unsigned region)
+{
+	unsigned        clk, evt;
+	prof_frame_t   *f;
+	e_prof_entry_t *entry;
+
+	clk = e_ctimer_get(E_CTIMER_0);
+	evt = (prof_event != E_CTIMER_OFF) ? e_ctimer_get(E_CTIMER_1) : 0;
+
+	// Unbalanced end markers are dropped rather than corrupting the stack
+	if (prof_depth == 0 || prof_stack[prof_depth - 1].region != region)
+		return;
+	f = &prof_stack[--prof_depth];
+
+	if (region >= E_PROF_MAX_REGIONS)
+		return;
+
+	// Counting down, and a single reload wraps correctly in 32 bits
+	prof_count[region]++;
+	prof_cycles[region] += (unsigned) (f->clk - clk);
+	prof_events[region] += (unsigned) (f->evt - evt);
+
+	if (!prof_slot)
+		return;
+
+	// Publish with a sequence count so the host never sees a torn entry
+	entry = &prof_slot->region[region];
+	entry->seq    = ++prof_seq[region];
+	entry->count  = prof_count[region];
+	entry->cycles = prof_cycles[region];
+	entry->events = prof_events[region];
+	entry->seq    = ++prof_seq[region];
+}
+
+void __attribute__((interrupt)) timer0_prof_isr()
+{
+	e_ctimer_set(E_CTIMER_0, E_CTIMER_MAX);
+	e_ctimer_start(E_CTIMER_0, E_CTIMER_CLK);
+	return;
+}
+
+void __attribute__((interrupt)) timer1_prof_isr()
+{
+	e_ctimer_set(E_CTIMER_1, E_CTIMER_MAX);
+	e_ctimer_start(E_CTIMER_1, prof_event);
+	return;
+}
@@ -0,0 +1,50 @@
+/*
+  File: e_queue_attach.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include "e_shm.h"
+#include "e_queue.h"
+
+
+int e_queue_attach(e_queue_t *q, const char *name)
+{
+	e_memseg_t     mem;
+	e_queue_hdr_t *hdr;
+
+	if ( !q || E_OK != e_shm_attach(&mem, name) )
+		return E_ERR;
+
+	hdr = (e_queue_hdr_t *) mem.ephy_base;
+	if ( E_QUEUE_MAGIC != hdr->magic )
+		return E_ERR;
+
+	q->hdr       = hdr;
+	q->data      = (uint8_t *) hdr + hdr->data_offset;
+	q->item_size = hdr->item_size;
+	q->mask      = hdr->capacity - 1;
+	q->head      = hdr->head;
+	q->tail      = hdr->tail;
+
+	return E_OK;
+}
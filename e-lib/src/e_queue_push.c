@@ -0,0 +1,68 @@
+/*
+  File: e_queue_push.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "e_dma.h"
+#include "e_queue.h"
+
+
+static void queue_copy_out(void *dst, const void *src, size_t n)
+{
+	if ( n >= E_QUEUE_DMA_THRESHOLD )
+		e_dma_copy(dst, (void *) src, n);
+	else
+		memcpy(dst, src, n);
+}
+
+unsigned e_queue_push(e_queue_t *q, const void *items, unsigned n)
+{
+	unsigned       cap = q->mask + 1;
+	unsigned       slot, first;
+	const uint8_t *src = (const uint8_t *) items;
+
+	/* Reading the remote tail stalls the core, so only do it when full */
+	if ( cap - (q->head - q->tail) < n )
+		q->tail = q->hdr->tail;
+
+	if ( n > cap - (q->head - q->tail) )
+		n = cap - (q->head - q->tail);
+
+	if ( !n )
+		return 0;
+
+	slot  = q->head & q->mask;
+	first = (n < cap - slot) ? n : cap - slot;
+
+	queue_copy_out(q->data + slot * q->item_size, src, first * q->item_size);
+	if ( n > first )
+		queue_copy_out(q->data, src + first * q->item_size, (n - first) * q->item_size);
+
+	/* Writes to the same destination arrive in order, so the items
+	 * are in place before the host sees the new head. */
+	q->head += n;
+	q->hdr->head = q->head;
+
+	return n;
+}
@@ -0,0 +1,39 @@
+/*
+  File: e_task_register.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include "e_task.h"
+
+
+e_task_kernel_t e_task_kernels[E_TASK_MAX_KERNELS];
+
+int e_task_register(unsigned kernel, e_task_kernel_t fn)
+{
+	if ( kernel >= E_TASK_MAX_KERNELS )
+		return E_ERR;
+
+	e_task_kernels[kernel] = fn;
+
+	return E_OK;
+}
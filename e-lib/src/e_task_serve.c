@@ -0,0 +1,68 @@
+/*
+  File: e_task_serve.c
+
+  This file is part of the Epiphany Software Development Kit.
+
+  Copyright (C) 2014 Adapteva, Inc.
+  See AUTHORS for list of contributors.
+  Support e-mail: <support@adapteva.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License (LGPL)
+  as published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  and the GNU Lesser General Public License along with this program,
+  see the files COPYING and COPYING.LESSER.  If not, see
+  <http://www.gnu.org/licenses/>.
+*/
+
+#include "e_coreid.h"
+#include "e_shm.h"
+#include "e_task.h"
+
+
+extern e_task_kernel_t e_task_kernels[E_TASK_MAX_KERNELS];
+
+e_task_mbox_t e_task_mbox;
+
+int e_task_serve(void)
+{
+	e_memseg_t		   mem;
+	volatile uint32_t *dir;
+	e_task_desc_t	  *desc;
+	e_task_kernel_t	   fn;
+	unsigned		   tail = 0;
+
+	if ( E_OK != e_shm_attach(&mem, E_TASK_SHM_NAME) )
+		return E_ERR;
+
+	e_task_mbox.head  = 0;
+	e_task_mbox.tail  = 0;
+	e_task_mbox.magic = E_TASK_MAGIC;
+
+	/* The host finds the mailbox in the directory, one entry per core */
+	dir = (volatile uint32_t *) mem.ephy_base;
+	dir[e_group_config.core_row * e_group_config.group_cols + e_group_config.core_col] =
+		(uint32_t) &e_task_mbox;
+
+	/* Spinning on the local mailbox does not load the mesh */
+	while ( 1 ) {
+		while ( e_task_mbox.head == tail )
+			;
+
+		desc = &e_task_mbox.slot[tail & (E_TASK_SLOTS - 1)];
+		fn   = (desc->kernel < E_TASK_MAX_KERNELS) ? e_task_kernels[desc->kernel] : 0;
+		desc->ret = fn ? fn(desc->arg) : E_TASK_NO_KERNEL;
+
+		e_task_mbox.tail = ++tail;
+	}
+
+	return E_OK;
+}
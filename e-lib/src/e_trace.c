@@ -53,6 +53,24 @@ unsigned logCoreid; //core-id shifted to enable fast trace
  */
 unsigned traceBufSize, traceBufStart, traceBufEnd;
 unsigned long long *traceBufWrPtr;
+trace_ring_hdr_t *traceRing;            // our ring header in the shared buffer
+unsigned traceCap;                      // ring size in events
+unsigned traceHead;                     // local copy of traceRing->head
+unsigned traceTail;                     // last seen value of traceRing->tail
+unsigned traceDropped;                  // local copy of traceRing->dropped
+
+/**
+ * Buffered mode: events go to a double-buffered ring in local SRAM and
+ * every full half is sent to the host ring with one DMA0 transfer.
+ * traceHead counts the events handed to the DMA, the shared head is
+ * only advanced once the DMA engine is known to be done with them.
+ */
+unsigned long long traceLocalBuf[2 * TRACE_LOCAL_EVENTS] ALIGN(8);
+e_dma_desc_t traceDmaDesc;              // must stay valid while the DMA runs
+unsigned traceLocal;                    // buffered mode on
+unsigned traceLocalCnt;                 // events in the half being filled
+unsigned long long *traceLocalWrPtr;    // next free slot in that half
+unsigned traceLocalHalf;                // half being filled, 0 or 1
 #define TIMER_WRAP_BIT (1<<26)
 
 /**
@@ -61,20 +79,39 @@ unsigned long long *traceBufWrPtr;
 int trace_init()
 {
     e_memseg_t emem;
-	unsigned coreIdx, totCores;
-
-	coreIdx = e_group_config.core_row * e_group_config.group_cols + e_group_config.core_col; //0 .. 16
-	totCores = e_group_config.group_rows * e_group_config.group_cols;
+	trace_layout_t *layout;
+	unsigned coreid, numCores, idx;
 
     // Attach to the shm segment
     if ( E_OK != e_shm_attach(&emem, HOST_TRACE_SHM_NAME) ) {
 	    return E_ERR;
     }
 
-	traceBufSize = HOST_TRACE_BUF_SIZE / totCores;
-	traceBufStart = emem.ephy_base + (coreIdx * traceBufSize);
-	traceBufEnd = traceBufStart + traceBufSize;
-	traceBufWrPtr = (unsigned long long*)traceBufStart;
+	// Find our slice in the layout table the host put at the start of the region
+	layout = (trace_layout_t *)emem.ephy_base;
+	if(layout->magic != TRACE_LAYOUT_MAGIC)
+		return E_ERR;
+
+	coreid = e_get_coreid();
+	numCores = layout->numCores;
+	for(idx=0; idx<numCores; idx++)
+		if(layout->core[idx].coreId == coreid)
+			break;
+	if(idx == numCores)
+		return E_ERR;
+
+	traceBufSize = layout->core[idx].size;
+	traceRing = (trace_ring_hdr_t *)(emem.ephy_base + layout->core[idx].offset);
+	traceCap = TRACE_RING_EVENTS(traceBufSize);
+	traceBufStart = (unsigned)traceRing + sizeof(trace_ring_hdr_t);
+	traceBufEnd = traceBufStart + traceCap * sizeof(unsigned long long);
+
+	// Pick up where a previous run on this core left off
+	traceHead = traceRing->head;
+	traceTail = traceRing->tail;
+	traceDropped = traceRing->dropped;
+	traceBufWrPtr = (unsigned long long*)traceBufStart + (traceHead % traceCap);
+	traceLocal = 0;
 
 #ifdef IRQ_WRAP_TIMER
 	unsigned regConfig;
@@ -98,6 +135,80 @@ int trace_init()
 	return E_OK;
 }
 
+/**
+ * Initialize tracing in buffered mode, events are collected in local SRAM
+ * and sent to the host in bursts of TRACE_LOCAL_EVENTS with DMA0. The
+ * application must not use DMA0 itself in this mode.
+ */
+int trace_init_buffered()
+{
+	if(E_OK != trace_init())
+		return E_ERR;
+
+	traceLocalHalf = 0;
+	traceLocalCnt = 0;
+	traceLocalWrPtr = traceLocalBuf;
+	traceLocal = 1;
+	return E_OK;
+}
+
+/**
+ * Send cnt events from local memory to the host ring. The transfer is left
+ * running; the events are published to the host by the next call.
+ */
+static void trace_send(unsigned long long *src, unsigned cnt)
+{
+	unsigned slot, idx;
+
+	// The previous burst has landed once DMA0 is idle, publish it
+	e_dma_wait(E_DMA_0);
+	traceRing->head = traceHead;
+
+	if(cnt == 0)
+		return;
+
+	// Reading external memory is slow, only refresh the tail when full
+	if(traceCap - (traceHead - traceTail) < cnt) {
+		traceTail = traceRing->tail;
+		if(traceCap - (traceHead - traceTail) < cnt) {
+			traceDropped += cnt; // the host is behind, lose the whole burst
+			traceRing->dropped = traceDropped;
+			return;
+		}
+	}
+
+	slot = traceHead % traceCap;
+	if(slot + cnt <= traceCap) {
+		e_dma_set_desc(E_DMA_0, E_DMA_MASTER | E_DMA_ENABLE | E_DMA_DWORD, 0,
+				8, 8, cnt, 1, 8, 8, src, (unsigned long long *)traceBufStart + slot,
+				&traceDmaDesc);
+		e_dma_start(&traceDmaDesc, E_DMA_0);
+	} else {
+		// The burst wraps around the end of the ring, rare enough for plain stores
+		for(idx=0; idx<cnt; idx++)
+			((unsigned long long *)traceBufStart)[(traceHead + idx) % traceCap] = src[idx];
+	}
+	traceHead += cnt;
+	traceBufWrPtr = (unsigned long long*)traceBufStart + (traceHead % traceCap);
+}
+
+/**
+ * Send buffered events to the host now and wait until they are visible
+ * there. Call before the host reads the trace and before trace_stop().
+ */
+int trace_flush()
+{
+	if(!traceLocal)
+		return E_OK;
+
+	trace_send(traceLocalBuf + traceLocalHalf * TRACE_LOCAL_EVENTS, traceLocalCnt);
+	trace_send(0, 0); // wait for the DMA and publish the head
+
+	traceLocalCnt = 0;
+	traceLocalWrPtr = traceLocalBuf + traceLocalHalf * TRACE_LOCAL_EVENTS;
+	return E_OK;
+}
+
 /**
  * This function starts the clock counter, tracing can be used after this call
  */
@@ -126,10 +237,13 @@ int trace_start_wait_all()
 
 /**
  * Write the event "event" to  log with data
+ * If the host has not drained the ring the event is dropped and counted
+ * instead of overwriting unread events.
  * @param severity - 0 .. 3
  * @param event - event id
  * @param breakpoint - place in user code that we hit
  * @param data - data associated with the event
+ * @return 0 on success, -1 if the event was dropped
  */
 int trace_write(unsigned severity, unsigned event, unsigned breakpoint, unsigned data)
 {
@@ -137,8 +251,32 @@ int trace_write(unsigned severity, unsigned event, unsigned breakpoint, unsigned
 	dta[1] = severity | event | breakpoint | logCoreid | data;
 	dta[0] = e_ctimer_get(E_CTIMER_1);
 
+	if(traceLocal) {
+		*traceLocalWrPtr++ = *(unsigned long long *)dta;
+		if(++traceLocalCnt == TRACE_LOCAL_EVENTS) {
+			// Send the full half and carry on in the other one meanwhile
+			trace_send(traceLocalBuf + traceLocalHalf * TRACE_LOCAL_EVENTS, TRACE_LOCAL_EVENTS);
+			traceLocalHalf ^= 1;
+			traceLocalCnt = 0;
+			traceLocalWrPtr = traceLocalBuf + traceLocalHalf * TRACE_LOCAL_EVENTS;
+		}
+		return 0;
+	}
+
+	// Reading external memory is slow, only refresh the tail when full
+	if(traceHead - traceTail >= traceCap) {
+		traceTail = traceRing->tail;
+		if(traceHead - traceTail >= traceCap) {
+			traceRing->dropped = ++traceDropped;
+			return -1;
+		}
+	}
+
 	*traceBufWrPtr++ = *(unsigned long long *)dta;
 	if((unsigned)traceBufWrPtr >= traceBufEnd) traceBufWrPtr = (unsigned long long*)traceBufStart;
+
+	// Same destination, so the event lands before the new head
+	traceRing->head = ++traceHead;
 	return 0;
 }
 
@@ -159,6 +297,7 @@ void __attribute__((interrupt)) timer1_trace_isr()
  */
 int trace_stop()
 {
+	trace_flush();
 	e_ctimer_stop(E_CTIMER_1);
 	e_irq_mask(E_TIMER1_INT, E_TRUE);
 	return 0;
@@ -40,8 +40,8 @@
 #include "GdbServer.h"
 #include "ServerInfo.h"
 #include "TargetControlHardware.h"
-#include "epiphany_xml.h"
-#include "epiphany-hal-data.h"
+#include "epiphany_platform.h"
+#include "e-hal.h"
 
 
 // Up to the builder to specify a revision.
@@ -122,9 +122,11 @@ usage_full (ostream& s)
   s << endl;
   s << "    Specify a platform definition file. This parameter is mandatory and"
     << endl;
-  s << "    should be the XML equivalent of the text file specified by the "
+  s << "    should describe the same platform as the file specified by the"
     << endl;
-  s << "    EPIPHANY_HDF environment variable." << endl;
+  s << "    EPIPHANY_HDF environment variable. Text, XML and compiled (see"
+    << endl;
+  s << "    e-hdf-compile) files are accepted." << endl;
   s << endl;
   s << "  -p <port-number>" << endl;
   s << endl;
@@ -222,13 +224,102 @@ copyright ()
   cout << "e-server revision " << REVSTR << " (compiled on "
        << __DATE__ << ")" << endl;
   cout << "Copyright (C) 2010-2013 Adapteva Inc." << endl;
-  cout << "The Epiphany XML Parser uses the XML library developed by Michael "
-       << "Chourdakis." << endl;
   cout << "Please report bugs to: support-sdk@adapteva.com" << endl;
 
 }	// copyright ()
 
 
+//! Convert a platform description to the platform definition
+
+//! The description has to stay loaded, the strings point into it.
+
+//! @param[in] desc  The platform description.
+//! @return  The platform definition.
+static platform_definition_t*
+platformFromHdf (const e_hdf_t *desc)
+{
+  const e_hdf_chip_t *chips = E_HDF_CHIPS (desc);
+  const e_hdf_emem_t *emems = E_HDF_EMEMS (desc);
+  platform_definition_t *platform = new platform_definition_t;
+
+  platform->version = desc->format;
+  platform->name = (char *) desc->name;
+  platform->lib = (char *) desc->lib;
+  platform->libinitargs = (char *) desc->libinitargs;
+
+  platform->num_chips = desc->num_chips;
+  platform->chips = new chip_def_t[desc->num_chips];
+  for (unsigned int i = 0; i < desc->num_chips; i++)
+    {
+      chip_def_t *chip = &platform->chips[i];
+
+      chip->version = (char *) chips[i].version;
+      chip->yid = chips[i].row;
+      chip->xid = chips[i].col;
+      chip->ioreg_row = chips[i].ioreg_row;
+      chip->ioreg_col = chips[i].ioreg_col;
+      chip->num_rows = chips[i].rows;
+      chip->num_cols = chips[i].cols;
+      chip->host_base = chips[i].host_base;
+      chip->core_memory_size = chips[i].sram_size;
+    }
+
+  // The cores' view of external memory is what addresses are checked against
+  platform->num_banks = desc->num_emems;
+  platform->ext_mem = new mem_def_t[desc->num_emems];
+  for (unsigned int i = 0; i < desc->num_emems; i++)
+    {
+      platform->ext_mem[i].name = (char *) emems[i].name;
+      platform->ext_mem[i].base = emems[i].ephy_base;
+      platform->ext_mem[i].size = emems[i].size;
+    }
+
+  return platform;
+
+}	// platformFromHdf ()
+
+
+//! Print out the platform definition
+static void
+printPlatform (platform_definition_t *platform)
+{
+  cout << "Struct version: " << platform->version << endl;
+  cout << "name: " << platform->name << endl;
+  cout << "lib: " << platform->lib << endl;
+  cout << "libinitargs: " << platform->libinitargs << endl;
+
+  for (unsigned int i = 0; i < platform->num_chips; i++)
+    {
+      chip_def_t *chip = &platform->chips[i];
+
+      cout << "chip[" << i << "]" << endl;
+      cout << "\tversion: " << chip->version << endl;
+      cout << "\tyid: " << chip->yid << endl;
+      cout << "\txid: " << chip->xid << endl;
+      if ((chip->ioreg_row == NO_IOREG) || (chip->ioreg_col == NO_IOREG))
+	cout << "\tNo I/O registers" << endl;
+      else
+	{
+	  cout << "\tioreg_row: " << chip->ioreg_row << endl;
+	  cout << "\tioreg_col: " << chip->ioreg_col << endl;
+	}
+      cout << "\tnum_rows: " << chip->num_rows << endl;
+      cout << "\tnum_cols: " << chip->num_cols << endl;
+      cout << "\thost_base: 0x" << hex << chip->host_base << endl;
+      cout << "\tcore_memory_size: 0x" << chip->core_memory_size << dec
+	   << endl;
+    }
+
+  for (unsigned int i = 0; i < platform->num_banks; i++)
+    {
+      cout << "ext_mem[" << i << "]" << endl;
+      cout << "\tname: " << platform->ext_mem[i].name << endl;
+      cout << "\tbase: 0x" << hex << platform->ext_mem[i].base << endl;
+      cout << "\tsize: 0x" << platform->ext_mem[i].size << dec << endl;
+    }
+}	// printPlatform ()
+
+
 //! Initialize the hardware platform
 
 //! @todo Contrary to previous advice, the system will
@@ -254,21 +345,15 @@ initPlatform (ServerInfo *si,
       exit (EXIT_FAILURE);
     }
 
-  EpiphanyXML *xml = new EpiphanyXML ((char *) hdfFile);
-  if (xml->Parse ())
+  // Kept for the life of the server, the platform definition points into it
+  e_hdf_t *desc = e_hdf_load (hdfFile);
+  if (!desc)
     {
       cerr << "Can't parse Epiphany HDF file: " << hdfFile << "." << endl;
-      delete xml;
       exit (EXIT_FAILURE);
     }
 
-  platform_definition_t *platform = xml->GetPlatform ();
-  if (!platform)
-    {
-      cerr << "Can't extract platform info from " << hdfFile << "." << endl;
-      delete xml;
-      exit (EXIT_FAILURE);
-    }
+  platform_definition_t *platform = platformFromHdf (desc);
 
   // prepare args list to hardware driver library
   string initArgs = platformArgs + " " + platform->libinitargs;
@@ -282,7 +367,7 @@ initPlatform (ServerInfo *si,
   tCntrl->initMaps (platform);
   if (si->showMemoryMap ())
     {
-      xml->PrintPlatform ();
+      printPlatform (platform);
       cout << endl;
       tCntrl->showMaps ();
     }
@@ -290,9 +375,6 @@ initPlatform (ServerInfo *si,
   // initialize the device
   tCntrl->initHwPlatform (platform);
 
-  //! @todo. The XML is somehow corrupted. If we delete this, then the stack
-  //!        will be corrupted. Needs some valgrind work.
-  // delete xml;
   return tCntrl;
 
 }	// initPlatform ()
@@ -8,6 +8,7 @@
 #ifndef A_TRACE_H_
 #define A_TRACE_H_
 
+#include <stdio.h>
 
 
 typedef struct trace_event_s {
@@ -19,6 +20,21 @@ typedef struct trace_event_s {
 	unsigned timestamp;
 } trace_event_t;
 
+/* Reload value of the core timer that stamps the events */
+#ifndef E_CTIMER_MAX
+#define E_CTIMER_MAX 0xffffffffU
+#endif
+
+/**
+ * Per-core state to rebuild 64-bit time from the 32-bit timestamps
+ * (zero it before the first event of the core)
+ */
+typedef struct trace_clock_s {
+	int started;                 // seen at least one event
+	unsigned lastRaw;            // last raw countdown value
+	unsigned long long wraps;    // counter wraps seen so far
+} trace_clock_t;
+
 
 
 
@@ -29,6 +45,36 @@ typedef struct trace_event_s {
  */
 int trace_init();
 
+/**
+ * Trace buffer configuration
+ */
+typedef struct trace_cfg_s {
+	unsigned totalSize;      // bytes for all cores, 0 for the default
+	unsigned numWeights;     // entries in weight
+	const unsigned *weight;  // relative size per core, row major over the platform
+	                         // (NULL for equal sizes, 0 gives a core the minimum)
+} trace_cfg_t;
+
+/**
+ * trace_init_cfg - trace_init() with a buffer size and per-core weights
+ * The layout is published in a table at the start of the buffer where
+ * the cores look up their own slice
+ * @param cfg - buffer configuration or NULL for the defaults
+ * @return 0 on success
+ */
+int trace_init_cfg(trace_cfg_t *cfg);
+
+/**
+ * trace_cfg_group_weight - set the weight of a workgroup of cores
+ * @param weight - weights of all cores, row major over the platform
+ * @param platformCols - number of columns of the platform
+ * @param row, col - first core of the group, relative to the platform
+ * @param rows, cols - size of the group
+ * @param w - weight to give every core of the group
+ */
+void trace_cfg_group_weight(unsigned *weight, unsigned platformCols, unsigned row, unsigned col,
+		unsigned rows, unsigned cols, unsigned w);
+
 /**
  * trace_finalize - teardown and release resources. 
  */
@@ -69,6 +115,20 @@ int trace_read_n(unsigned long long *buffer, unsigned max_data);
  */
 int trace_read_coreNo_n(unsigned long long *buffer, unsigned max_data, unsigned coreNo);
 
+/**
+ * trace_dropped - number of events a core had to drop because
+ * its trace buffer was full
+ * @param coreNo - this cores buffer 0 .. max-cores
+ * @return number of dropped events
+ */
+unsigned trace_dropped(unsigned coreNo);
+
+/**
+ * trace_dropped_total - number of events dropped by all cores
+ * @return number of dropped events
+ */
+unsigned long long trace_dropped_total();
+
 /**
  * trace_event_to_string - creates a string from a trace event
  * @param buf - buffer to put the string
@@ -77,6 +137,16 @@ int trace_read_coreNo_n(unsigned long long *buffer, unsigned max_data, unsigned
  */
 int trace_event_to_string(char *buf, unsigned long long event);
 
+/**
+ * trace_event_to_json - creates a Chrome/Perfetto trace event (JSON object)
+ * start/stop event pairs become slices on the core's track
+ * @param buf - buffer to put the JSON object
+ * @param time - event time in timer ticks (see trace_merge_push)
+ * @param event - the event to convert
+ * @return 0 on success
+ */
+int trace_event_to_json(char *buf, unsigned long long time, unsigned long long event);
+
 /**
  * trace_event_to_struct - takes an event and converts
  * to an event structure
@@ -86,6 +156,15 @@ int trace_event_to_string(char *buf, unsigned long long event);
  */
 int trace_event_to_struct(trace_event_t *e_struct, unsigned long long event);
 
+/**
+ * trace_clock_ticks - timer ticks since the core started its timer
+ * (events of one core must be passed in order)
+ * @param clock - the state of the core that stamped the event
+ * @param raw - the timestamp of the event
+ * @return wraps * 2^32 + (E_CTIMER_MAX - raw)
+ */
+unsigned long long trace_clock_ticks(trace_clock_t *clock, unsigned raw);
+
 /**
  * trace_struct_to_event - Converts a trace structure to a binary event
  * @param e_struct - the event as struct
@@ -146,6 +225,284 @@ int trace_file_write_n(unsigned long long *event, int cnt);
  */
 int trace_file_read_open(char *inFileName, char *outFileName);
 
+/**
+ * trace_get_num_cores - number of cores with a trace buffer
+ * @return 0 before trace_init
+ */
+unsigned trace_get_num_cores();
+
+#define TRACE_CAPTURE_BLOCK_EVENTS 4096 // default events per capture block
+#define TRACE_CAPTURE_NUM_BLOCKS   32   // default blocks per capture ring
+
+/**
+ * Called on the consumer thread with a copy of every captured block
+ */
+typedef void (*trace_capture_consumer_t)(const unsigned long long *events, unsigned cnt, void *arg);
+
+/**
+ * Capture options, fields left 0 take the defaults
+ */
+typedef struct trace_capture_opts_s {
+	unsigned numDrainThreads;          // threads reading core buffers (default one per 16 cores)
+	unsigned blockEvents;              // events per block
+	unsigned numBlocks;                // blocks per drain thread
+	trace_capture_consumer_t consumer; // optional, may miss blocks if slow
+	void *consumerArg;
+	int blockFile;                     // write with trace_block_file_write_n()
+} trace_capture_opts_t;
+
+/**
+ * trace_capture_start - start draining all core buffers to the trace file
+ * on background threads. trace_init() and trace_file_open() (or
+ * trace_block_file_open() with opts->blockFile set) must have been called
+ * before; do not use trace_read*() while the capture is running
+ * @param opts - capture options or NULL for the defaults
+ * @return 0 on success
+ */
+int trace_capture_start(trace_capture_opts_t *opts);
+
+/**
+ * trace_capture_stop - drain what is left in the core buffers, write it
+ * and stop the capture threads
+ * @return 0 on success, -1 if writing the trace file failed
+ */
+int trace_capture_stop();
+
+/**
+ * trace_capture_stats - events captured so far
+ * @param events - events handed to the file writer
+ * @param skipped - events the consumer missed because it was behind
+ */
+void trace_capture_stats(unsigned long long *events, unsigned long long *skipped);
+
+/**
+ * An event with its core clock rebuilt to 64 bits and aligned with the
+ * other cores (ticks since the trace_start_wait_all() sync point)
+ */
+typedef struct trace_merged_event_s {
+	unsigned long long time;
+	unsigned long long event;
+} trace_merged_event_t;
+
+/**
+ * trace_merge_init - reset the time-ordered merger
+ * @return 0 on success
+ */
+int trace_merge_init();
+
+/**
+ * trace_merge_finalize - free all merger state
+ */
+void trace_merge_finalize();
+
+/**
+ * trace_merge_set_offset - correct the clock of one core, call after trace_merge_init
+ * @param coreId - core id as found in the events
+ * @param ticks - added to every rebuilt timestamp of that core
+ * @return 0 on success
+ */
+int trace_merge_set_offset(unsigned coreId, long long ticks);
+
+/**
+ * trace_merge_push - add raw events in the order they were read
+ * (events of one core must stay in order, cores may be interleaved freely)
+ * @param events - raw trace events
+ * @param cnt - number of events
+ * @return number of events taken, -1 on allocation failure
+ */
+int trace_merge_push(const unsigned long long *events, unsigned cnt);
+
+/**
+ * trace_merge_pop - take events that are safe to emit in global time order,
+ * i.e. no core can still deliver an earlier one
+ * @param out - buffer for merged events
+ * @param max - max number of events
+ * @return number of events returned
+ */
+int trace_merge_pop(trace_merged_event_t *out, unsigned max);
+
+/**
+ * trace_merge_flush - take all pending events in global time order (end of trace)
+ * @param out - buffer for merged events
+ * @param max - max number of events
+ * @return number of events returned
+ */
+int trace_merge_flush(trace_merged_event_t *out, unsigned max);
+
+/**
+ * trace_merged_event_to_string - creates a string from a merged event
+ * @param buf - buffer to put the string
+ * @param me - the merged event
+ * @return 0 on success
+ */
+int trace_merged_event_to_string(char *buf, trace_merged_event_t *me);
+
+/**
+ * Read a trace file and write its events as text in global time order
+ * @param inFileName - name of trace file to read
+ * @param outFileName - name of textual trace file to write
+ */
+int trace_file_merge(char *inFileName, char *outFileName);
+
+#define TRACE_FILE_VERSION_BLOCK 0x02         // header file version of block files (.etb)
+#define TRACE_BLOCK_EVENTS       4096         // max events per block
+#define TRACE_BLOCK_ANY_CORE     0xFFFFFFFFU  // query all cores
+
+/**
+ * Index entry of one block, one core and a time range (rebuilt ticks)
+ */
+typedef struct trace_block_index_s {
+	unsigned coreId;
+	unsigned nEvents;
+	unsigned long long offset;    // file offset of the block
+	unsigned long long firstTime;
+	unsigned long long lastTime;
+	unsigned bytes;               // encoded size of the block
+	unsigned reserved;
+} trace_block_index_t;
+
+typedef struct trace_block_reader_s trace_block_reader_t;
+
+/**
+ * Position of a query in a block file
+ */
+typedef struct trace_block_iter_s {
+	trace_block_reader_t *reader;
+	unsigned coreId;
+	unsigned long long tStart, tEnd;
+	unsigned block;               // next index entry to look at
+	const unsigned char *pos, *end;
+	unsigned left;                // events left in the current block
+	unsigned blockCore;
+	unsigned payload;
+	unsigned long long time;
+} trace_block_iter_t;
+
+/**
+ * trace_block_file_open - create a block file (.etb), named like trace_file_open()
+ * @param optionField - the optional text field to filename
+ * @return 0 on success
+ */
+int trace_block_file_open(char *optionField);
+
+/**
+ * trace_block_file_write_n - add raw events to the block file
+ * (events of one core must stay in order, cores may be interleaved freely)
+ * @param events - raw trace events
+ * @param cnt - number of events
+ * @return number of events written, -1 on error
+ */
+int trace_block_file_write_n(unsigned long long *events, int cnt);
+
+/**
+ * trace_block_file_close - write the pending blocks, the index and the footer
+ * @return 0 on success
+ */
+int trace_block_file_close();
+
+/**
+ * trace_block_reader_open - map a block file for reading
+ * @param fileName - the .etb file
+ * @return reader or NULL if the file is not a complete block file
+ */
+trace_block_reader_t *trace_block_reader_open(const char *fileName);
+
+/**
+ * trace_block_reader_close - unmap and free the reader
+ */
+void trace_block_reader_close(trace_block_reader_t *r);
+
+/**
+ * trace_block_reader_index - the block index, sorted by core and time
+ * @param nBlocks - set to the number of blocks
+ * @return the index entries
+ */
+const trace_block_index_t *trace_block_reader_index(trace_block_reader_t *r, unsigned *nBlocks);
+
+/**
+ * trace_block_reader_num_events - number of events in the file
+ */
+unsigned long long trace_block_reader_num_events(trace_block_reader_t *r);
+
+/**
+ * trace_block_query - set up an iterator over a core and time window,
+ * only the blocks that overlap the window are decoded
+ * @param coreId - core to read or TRACE_BLOCK_ANY_CORE
+ * @param tStart - first time to include (ticks)
+ * @param tEnd - last time to include (ticks)
+ * @return 0 on success
+ */
+int trace_block_query(trace_block_reader_t *r, trace_block_iter_t *it, unsigned coreId,
+		unsigned long long tStart, unsigned long long tEnd);
+
+/**
+ * trace_block_iter_next - decode the next events of the query
+ * Events of one core come in time order; with TRACE_BLOCK_ANY_CORE the
+ * cores follow each other (feed them to trace_merge_push() for global order)
+ * @param out - buffer for the events, time holds the rebuilt ticks
+ * @param max - max number of events
+ * @return number of events returned, 0 at the end
+ */
+int trace_block_iter_next(trace_block_iter_t *it, trace_merged_event_t *out, unsigned max);
+
+/**
+ * Write the events of a block file as text, core by core
+ * @param inFileName - name of trace file to read
+ * @param outFileName - name of textual trace file to write
+ */
+int trace_block_file_to_text(char *inFileName, char *outFileName);
+
+/**
+ * Convert a trace file (.etr or .etb) to Chrome/Perfetto JSON
+ * The file is streamed, memory use does not depend on its size
+ * @param inFileName - name of trace file to read
+ * @param outFileName - name of JSON file to write
+ * @return 0 on success
+ */
+int trace_file_to_json(char *inFileName, char *outFileName);
+
+/**
+ * trace_stats_init - clear the live statistics
+ * @return 0 on success
+ */
+int trace_stats_init();
+
+/**
+ * trace_stats_add - aggregate raw events: per-core and per-event counts,
+ * rates and latency histograms between start/stop pairs per breakpoint
+ * (events of one core must stay in order, cores may be interleaved freely)
+ * @param events - raw trace events
+ * @param cnt - number of events
+ * @return 0 on success, -1 if events were lost on allocation failure
+ */
+int trace_stats_add(const unsigned long long *events, unsigned cnt);
+
+/**
+ * trace_stats_consumer - capture consumer that calls trace_stats_add(),
+ * pass it in trace_capture_opts_t.consumer
+ */
+void trace_stats_consumer(const unsigned long long *events, unsigned cnt, void *arg);
+
+/**
+ * trace_stats_print - write the current statistics as text
+ * @param fp - stream to write to
+ * @return 0 on success
+ */
+int trace_stats_print(FILE *fp);
+
+/**
+ * trace_stats_serve - answer every connection on a Unix socket with the
+ * current statistics as text
+ * @param socketPath - path of the socket, replaced if it exists
+ * @return 0 on success
+ */
+int trace_stats_serve(const char *socketPath);
+
+/**
+ * trace_stats_stop_serving - close the Unix socket endpoint
+ */
+void trace_stats_stop_serving();
+
 
 
 
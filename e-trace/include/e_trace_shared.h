@@ -35,9 +35,57 @@
  * Offset on parallella 16 should be 16+8M = 24M (0x0010 0000 x 0x18) = 0x0180 0000
  *
  */
-#define HOST_TRACE_BUF_SIZE	(0x200000) /* 1024 by 256 by 8 byte buffer (2M) */
+#define HOST_TRACE_BUF_SIZE	(0x200000) /* default size, 1024 by 256 by 8 byte buffer (2M) */
 #define HOST_TRACE_SHM_NAME "trace_buffer"   /* Shared memory region name */
 
+/**
+ * Every core owns an equal slice of the trace buffer. The slice starts with
+ * this header and the rest of it holds a ring of 8 byte events.
+ * head and dropped are only written by the core, tail only by the host.
+ * head and tail count events since the buffer was cleared (mod 2^32), so
+ * the ring never needs a sentinel value and a full ring is detectable.
+ */
+typedef struct trace_ring_hdr_s {
+	volatile unsigned head;     /* events written by the core */
+	volatile unsigned dropped;  /* events lost because the ring was full */
+	unsigned          __pad0[6];
+	volatile unsigned tail;     /* events consumed by the host */
+	unsigned          __pad1[7];
+} trace_ring_hdr_t;
+
+/** Number of events that fit in a per-core slice of sliceSize bytes */
+#define TRACE_RING_EVENTS(sliceSize) (((sliceSize) - sizeof(trace_ring_hdr_t)) / 8)
+
+/**
+ * The trace region starts with a layout table written by the host. It
+ * holds one descriptor per core with the place and size of the core's
+ * slice, so the host can give busy cores more room than idle ones. The
+ * cores look themselves up by coreid instead of computing the layout.
+ * Offsets are from the start of the region and slices are 64 byte aligned.
+ */
+#define TRACE_LAYOUT_MAGIC   (0xE3ACE10C)
+#define TRACE_SLICE_ALIGN    (64)
+#define TRACE_SLICE_MIN      (sizeof(trace_ring_hdr_t) + 64 * 8) /* smallest slice handed out */
+
+typedef struct trace_core_desc_s {
+	unsigned coreId;            /* coreid of the owner */
+	unsigned offset;            /* slice offset in the region */
+	unsigned size;              /* slice size in bytes */
+	unsigned __pad0;
+} trace_core_desc_t;
+
+typedef struct trace_layout_s {
+	unsigned magic;             /* TRACE_LAYOUT_MAGIC once the table is valid */
+	unsigned numCores;          /* descriptors that follow */
+	unsigned totalSize;         /* size of the whole region */
+	unsigned __pad0[5];
+	trace_core_desc_t core[];
+} trace_layout_t;
+
+/** Bytes taken by a layout table of numCores descriptors, rounded up to a slice boundary */
+#define TRACE_LAYOUT_SIZE(numCores) \
+	((sizeof(trace_layout_t) + (numCores) * sizeof(trace_core_desc_t) + TRACE_SLICE_ALIGN - 1) & ~(TRACE_SLICE_ALIGN - 1))
+
 /**
  * Define the data types and structures contained in the shared buffer
  */
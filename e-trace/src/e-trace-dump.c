@@ -8,20 +8,31 @@
 
 #include "e-trace.h"
 #include <stdio.h>
+#include <string.h>
 
 int main(int argc, char** argv)
 {
 	char *infile;
 	char *outfile;
+	int merge = 0;
 	int retval;
+	if(argc == 4 && strcmp(argv[1], "-m") == 0) {
+		merge = 1; // globally time-ordered output
+		argv++;
+		argc--;
+	}
 	fprintf(stdout,"Converting Binary trace file to text\n");
 	if(argc == 3) {
 		infile = argv[1];
 		outfile = argv[2];
 		fprintf(stdout,"Reading from %s Writing to %s \n", infile, outfile);
-		retval = trace_file_read_open(infile, outfile);
+		if(merge)
+			retval = trace_file_merge(infile, outfile);
+		else
+			retval = trace_file_read_open(infile, outfile);
 	} else {
-			fprintf(stdout, "Call with %s <infile> <outfile> \n", argv[0]);
+			fprintf(stdout, "Call with %s [-m] <infile> <outfile> \n", argv[0]);
+			fprintf(stdout, "  -m  merge the cores into one time-ordered stream\n");
 		retval = -1;
 	}
 	return retval;
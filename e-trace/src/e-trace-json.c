@@ -0,0 +1,23 @@
+/*
+ * e-trace-json.c
+ *
+ *  Converts a binary trace file to Chrome/Perfetto JSON
+ */
+
+
+#include "e-trace.h"
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+	int retval;
+	if(argc == 3) {
+		fprintf(stdout,"Reading from %s Writing to %s \n", argv[1], argv[2]);
+		retval = trace_file_to_json(argv[1], argv[2]);
+	} else {
+		fprintf(stdout, "Call with %s <infile.etr|infile.etb> <outfile.json> \n", argv[0]);
+		fprintf(stdout, "Load the output in chrome://tracing or https://ui.perfetto.dev\n");
+		retval = -1;
+	}
+	return retval;
+}
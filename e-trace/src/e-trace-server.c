@@ -8,71 +8,176 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <e-trace.h>
 
-char *traceVersion = "0.90";
+char *traceVersion = "0.91";
 
+static volatile sig_atomic_t stopRequested = 0;
+static sigset_t stopSignals;   // SIGTERM and SIGINT, blocked outside the waits
+static sigset_t waitMask;      // the mask to wait with, stop signals unblocked
+static int showText = 0;
+static int keepStats = 0;
+
+static void usage()
+{
+	fprintf(stderr,"Usage: e-trace-server [-d] [-p pidfile] [-t] [-j threads] [-b] [-s socket] <trace file>\n");
+	fprintf(stderr,"  -d          run as a daemon, capture until SIGTERM or SIGINT\n");
+	fprintf(stderr,"  -p pidfile  write the daemon pid to pidfile\n");
+	fprintf(stderr,"  -t          print the captured events as text on stderr\n");
+	fprintf(stderr,"  -j threads  number of threads draining the core buffers\n");
+	fprintf(stderr,"  -b          write an indexed, compressed block file (.etb)\n");
+	fprintf(stderr,"  -s socket   keep live statistics, served as text on a Unix socket\n");
+}
+
+static void on_stop_signal(int sig)
+{
+	(void)sig;
+	stopRequested = 1;
+}
 
 /**
- * Starts the arm software to log trace events from e-cores
+ * Capture consumer that prints the events as text and/or keeps statistics
  */
-int run_log_daemon()
+static void server_consumer(const unsigned long long *events, unsigned cnt, void *arg)
 {
-	int done = 0;
-	char inBuf[10]; // some dummy input
-	int nInCh; // how much we did read
-	unsigned long long tb[1024]; // trace event buffer 8k
-	unsigned nEvent;
 	char eString[1024];
-	// change how stdin is used ..
-
-	// DEBUG
-	fcntl(fileno(stdin), F_SETFL,O_NONBLOCK);
-	fflush(stdin);
-	fprintf(stdout,"Waiting to start press <return> key to start capture\n");
-	while(!done) {
-		nInCh = read(fileno(stdin), inBuf, 10);
-		if(nInCh > 0) {
+	unsigned idx;
+
+	if(keepStats) trace_stats_consumer(events, cnt, arg);
+	if(!showText) return;
+	for(idx=0;idx<cnt;idx++){
+		trace_event_to_string(eString, events[idx]);
+		fprintf(stderr,"%s\n", eString);
+	}
+}
+
+/**
+ * Wait until the user presses return
+ */
+static void wait_for_return()
+{
+	char inBuf[10]; // some dummy input
+	int done = 0;
+
+	// Only this thread takes the stop signals, and only while it waits
+	pthread_sigmask(SIG_SETMASK, &waitMask, NULL);
+	while(!done && !stopRequested) {
+		if(read(fileno(stdin), inBuf, 10) > 0) {
 			done = 1;
-			fflush(stdout);
 		} else {
 			usleep(10000);
 		}
 	}
+	pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+}
+
+/**
+ * Starts the arm software to log trace events from e-cores
+ */
+int run_log_daemon(trace_capture_opts_t *opts, int interactive)
+{
+	unsigned long long nCaptured, nSkipped;
+	int retVal = 0;
+
+	if(interactive) {
+		fcntl(fileno(stdin), F_SETFL,O_NONBLOCK);
+		fprintf(stdout,"Waiting to start press <return> key to start capture\n");
+		fflush(stdout);
+		wait_for_return();
+	}
 
-	fprintf(stdout,"Starting capture - press <return> key to stop \n");
-	done = 0;
-	while(!done) {
-		nEvent = trace_read_n(tb,1024);
-		if(nEvent > 0) {
-		    unsigned cnt;
+	if(trace_capture_start(opts) != 0) {
+		fprintf(stderr,"Failed to start the capture\n");
+		return -1;
+	}
 
-			for(cnt=0;cnt<nEvent;cnt++){
-				trace_event_to_string(eString, tb[cnt]);
-				fprintf(stderr,"cnt=%d, %s\n", cnt,eString);
-			}
-			trace_file_write_n(tb, nEvent);
-		} else {
-			// No events yet, sleep a little
-			usleep(100000); // 100ms before trying again
-		}
-		nInCh = read(fileno(stdin), inBuf, 10);
-		if(nInCh > 0) {
-			done = 1;
-		}
+	if(interactive) {
+		fprintf(stdout,"Starting capture - press <return> key to stop \n");
+		fflush(stdout);
+		wait_for_return();
+	} else {
+		// Blocked until sigsuspend() so a signal between the check and the
+		// wait is not lost
+		while(!stopRequested) sigsuspend(&waitMask);
+	}
+
+	if(trace_capture_stop() != 0) {
+		fprintf(stderr,"Writing the trace file failed, it is incomplete\n");
+		retVal = -1;
 	}
-	fprintf(stdout,"Ending capture\n");
-	return 0;
+	trace_capture_stats(&nCaptured, &nSkipped);
+	fprintf(stdout,"Ending capture, %llu events captured, %llu events dropped by the cores\n",
+			nCaptured, trace_dropped_total());
+	if(nSkipped)
+		fprintf(stdout,"%llu events were not shown, the text output fell behind\n", nSkipped);
+	return retVal;
 }
 
 int main(int argc, char **argv)
 {
-    if ( argc < 2 ) {
-	    fprintf(stderr,"invalid arguments\n");
+	trace_capture_opts_t opts;
+	struct sigaction sa;
+	char *pidFile = NULL;
+	char *statsSocket = NULL;
+	int daemonize = 0;
+	int exitCode = 0;
+	int opt;
+	FILE *fp;
+
+	memset(&opts, 0, sizeof(opts));
+	while((opt = getopt(argc, argv, "dp:tj:bs:h")) != -1) {
+		switch(opt) {
+		case 'd':
+			daemonize = 1;
+			break;
+		case 'p':
+			pidFile = optarg;
+			break;
+		case 't':
+			showText = 1;
+			opts.consumer = server_consumer;
+			break;
+		case 'j':
+			opts.numDrainThreads = atoi(optarg);
+			break;
+		case 'b':
+			opts.blockFile = 1;
+			break;
+		case 's':
+			keepStats = 1;
+			statsSocket = optarg;
+			opts.consumer = server_consumer;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if ( optind >= argc ) {
+		fprintf(stderr,"invalid arguments\n");
+		usage();
 		return -1;
 	}
 
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	// Threads started from here on inherit the blocked stop signals
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGTERM);
+	sigaddset(&stopSignals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &stopSignals, &waitMask);
+	sigdelset(&waitMask, SIGTERM);
+	sigdelset(&waitMask, SIGINT);
+
 	fprintf(stdout,"Initializing the trace server v%s\n", traceVersion);
 
 	if(trace_init() != 0) {
@@ -87,17 +192,45 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	fprintf(stdout,"Opening the trace file at %s\n", argv[1]);
+	fprintf(stdout,"Opening the trace file at %s\n", argv[optind]);
 
-	if(trace_file_open(argv[1]) != 0) {
+	if((opts.blockFile ? trace_block_file_open(argv[optind]) : trace_file_open(argv[optind])) != 0) {
 		fprintf(stderr,"Failed to open the trace file\n");
 		return -1;
 	}
 
-	run_log_daemon(); // Run data capture to the log file until we are done
+	if(daemonize) {
+		fflush(stdout);
+		// keep the working directory, the trace file may be relative
+		if(daemon(1, showText) != 0) {
+			perror("daemon");
+			return -1;
+		}
+		if(pidFile) {
+			fp = fopen(pidFile, "w");
+			if(fp) {
+				fprintf(fp, "%d\n", (int)getpid());
+				fclose(fp);
+			}
+		}
+	}
+
+	if(keepStats) {
+		trace_stats_init();
+		if(trace_stats_serve(statsSocket) != 0) fprintf(stderr,"Statistics are not served\n");
+	}
+
+	// Run data capture to the log file until we are done
+	if(run_log_daemon(&opts, !daemonize) != 0) exitCode = 1;
 
-	if(trace_file_close() != 0) { 
+	if((opts.blockFile ? trace_block_file_close() : trace_file_close()) != 0) {
 	  fprintf(stderr,"Close Trace File Failed\n");
+	  exitCode = 1;
+	}
+
+	if(keepStats) {
+		trace_stats_stop_serving();
+		trace_stats_print(stdout);
 	}
 
 	trace_stop();
@@ -107,5 +240,7 @@ int main(int argc, char **argv)
     // Cleanup
 	trace_finalize();
 
-	return 0;
+	if(daemonize && pidFile) unlink(pidFile);
+
+	return exitCode;
 }
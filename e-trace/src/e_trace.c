@@ -38,9 +38,11 @@ int test_setup_e_cores();
  * Global hidden variables used in the trace module
  */
 static int traceFileHdl; // handle to our trace file
-static volatile unsigned long long **traceBufRdPtr = 0; // first unread position in trace buffer
+static trace_ring_hdr_t **traceRing = 0; // per core ring header in the trace buffer
+static unsigned long long **traceBufRdPtr = 0; // first unread position in trace buffer
 static unsigned long long **traceBufStart = 0; // start of trace buffer
 static unsigned long long **traceBufEnd = 0;   // end address of trace buffer
+static unsigned *traceBufRdCnt = 0; // events consumed per core, mirrors ring tail
 static 	struct timeval traceStartTime = { 0, 0 };    // when we called start
 static unsigned long long traceEventCnt = 0; // how many events have we written
 static unsigned traceNumCores = 0;
@@ -56,16 +58,91 @@ static e_mem_t      traceBufMem;
  *
  * ******************************************************************************************************* */
 
+/**
+ * Lay out the per-core slices in the layout table, sizes proportional to the weights
+ * @return 0 on success
+ */
+static int trace_layout(trace_layout_t *layout, e_platform_t *platform, unsigned totalSize,
+		const unsigned *weight, unsigned numWeights)
+{
+	unsigned long long avail, sumW = 0;
+	unsigned cnt, w, size, offset, numMin = 0;
+
+	offset = TRACE_LAYOUT_SIZE(traceNumCores);
+	if(totalSize < offset + traceNumCores * TRACE_SLICE_MIN) {
+		fprintf(stderr, "Trace buffer of %u bytes is too small for %u cores\n", totalSize, traceNumCores);
+		return -1;
+	}
+
+	// cores with weight 0 only get the smallest slice, the rest is shared out by weight
+	for(cnt=0;cnt<traceNumCores;cnt++) {
+		w = (cnt < numWeights) ? weight[cnt] : (numWeights ? 0 : 1);
+		if(w) sumW += w; else numMin++;
+	}
+	avail = totalSize - offset - numMin * TRACE_SLICE_MIN;
+
+	layout->numCores = traceNumCores;
+	layout->totalSize = totalSize;
+	for(cnt=0;cnt<traceNumCores;cnt++) {
+		w = (cnt < numWeights) ? weight[cnt] : (numWeights ? 0 : 1);
+		size = w ? (unsigned)((avail * w / sumW) & ~(unsigned long long)(TRACE_SLICE_ALIGN - 1)) : 0;
+		if(size < TRACE_SLICE_MIN) size = TRACE_SLICE_MIN;
+		if(offset + size > totalSize) {
+			fprintf(stderr, "Trace buffer of %u bytes is too small for the weights\n", totalSize);
+			return -1;
+		}
+		layout->core[cnt].coreId = ((platform->row + cnt / platform->cols) << 6) |
+								   (platform->col + cnt % platform->cols);
+		layout->core[cnt].offset = offset;
+		layout->core[cnt].size = size;
+		offset += size;
+	}
+	return 0;
+}
+
 /**
  * trace_init - Initializes shared memory areas and local variables
  * This function must have completed before any calls to trace
  * functions are done in e-cores
+ * The buffer is HOST_TRACE_BUF_SIZE bytes unless E_TRACE_BUF_SIZE is set
+ * in the environment, split evenly over the cores
  */
 int trace_init()
+{
+	return trace_init_cfg(NULL);
+}
+
+/**
+ * trace_cfg_group_weight - set the weight of a workgroup of cores
+ * @param weight - weights of all cores, row major over the platform
+ * @param platformCols - number of columns of the platform
+ * @param row, col - first core of the group, relative to the platform
+ * @param rows, cols - size of the group
+ * @param w - weight to give every core of the group
+ */
+void trace_cfg_group_weight(unsigned *weight, unsigned platformCols, unsigned row, unsigned col,
+		unsigned rows, unsigned cols, unsigned w)
+{
+	unsigned r, c;
+
+	for(r=row;r<row+rows;r++)
+		for(c=col;c<col+cols;c++)
+			weight[r * platformCols + c] = w;
+}
+
+/**
+ * trace_init_cfg - Initializes the trace buffer with a given size and
+ * per-core weights, and publishes the layout for the cores
+ * @param cfg - buffer configuration or NULL for the defaults
+ * @return E_OK on success
+ */
+int trace_init_cfg(trace_cfg_t *cfg)
 {
 	unsigned     cnt;
-	unsigned     coreTraceBufSz;
+	unsigned     totalSize = HOST_TRACE_BUF_SIZE;
+	char        *env;
 	e_platform_t platform; // platform information
+	trace_layout_t *layout;
 
 	e_set_host_verbosity(H_D0);
 
@@ -74,30 +151,44 @@ int trace_init()
 		return E_ERR;
 	}
 
+	env = getenv("E_TRACE_BUF_SIZE");
+	if(env && strtoul(env, NULL, 0) > 0) totalSize = strtoul(env, NULL, 0);
+	if(cfg && cfg->totalSize) totalSize = cfg->totalSize;
+
     if ( E_OK != e_shm_alloc(&traceBufMem, HOST_TRACE_SHM_NAME,
-							 HOST_TRACE_BUF_SIZE) ) {
+							 totalSize) ) {
 	    fprintf(stderr, "Failed to allocate shared memory. Error is %s\n",
 				strerror(errno));
 		return E_ERR;
 	}
 
-	memset((void *)traceBufMem.base, 0, HOST_TRACE_BUF_SIZE); // zero memory
+	memset((void *)traceBufMem.base, 0, totalSize); // zero memory
 
 	// figure out how many cores we have
 	e_get_platform_info(&platform);
 	traceNumCores = platform.rows * platform.cols;
 
+	layout = (trace_layout_t *)traceBufMem.base;
+	if(trace_layout(layout, &platform, totalSize,
+					cfg ? cfg->weight : NULL, cfg && cfg->weight ? cfg->numWeights : 0) != 0) {
+		e_shm_release(HOST_TRACE_SHM_NAME);
+		traceNumCores = 0;
+		return E_ERR;
+	}
+
 	/*
 	 * Get pointers to all traceNumCores buffers
 	 */
+	traceRing     = (trace_ring_hdr_t **)malloc(traceNumCores * sizeof(trace_ring_hdr_t *));
 	traceBufStart = (unsigned long long **)malloc(traceNumCores * sizeof(unsigned long long *));
 	traceBufEnd   = (unsigned long long **)malloc(traceNumCores * sizeof(unsigned long long *));
-	traceBufRdPtr = (volatile unsigned long long **)malloc(traceNumCores * sizeof(unsigned long long *));
-	coreTraceBufSz = HOST_TRACE_BUF_SIZE/traceNumCores; // 16 cores
+	traceBufRdPtr = (unsigned long long **)malloc(traceNumCores * sizeof(unsigned long long *));
+	traceBufRdCnt = (unsigned *)calloc(traceNumCores, sizeof(unsigned));
 
 	for(cnt=0;cnt<traceNumCores;cnt++){
-		traceBufStart[cnt] = traceBufMem.base + (coreTraceBufSz*cnt); // start mapped space
-		traceBufEnd[cnt] = traceBufStart[cnt] + coreTraceBufSz;  //pointer to past end of buffer
+		traceRing[cnt] = (trace_ring_hdr_t *)((char *)traceBufMem.base + layout->core[cnt].offset);
+		traceBufStart[cnt] = (unsigned long long *)(traceRing[cnt] + 1); // events follow the header
+		traceBufEnd[cnt] = traceBufStart[cnt] + TRACE_RING_EVENTS(layout->core[cnt].size);  //pointer to past end of buffer
 		traceBufRdPtr[cnt] = traceBufStart[cnt]; // initialize read ptr to start of buffer
 	}
 	traceEventCnt = 0;        // initialize event counter
@@ -105,6 +196,10 @@ int trace_init()
 	traceSingleNextCore = 0;  // initialize where to start
 	traceMultiNextCore = 0;   // where to start reading multiple
 
+	// The table is complete, let the cores use it
+	__sync_synchronize();
+	layout->magic = TRACE_LAYOUT_MAGIC;
+
 	return E_OK;
 }
 
@@ -154,14 +249,8 @@ unsigned long long trace_read(unsigned timeout_millis)
 	while(!done){
 		coreCnt = 0;
 		while(!done && coreCnt < traceNumCores){
-			if(*traceBufRdPtr[traceSingleNextCore] != 0){
-				dta = *traceBufRdPtr[traceSingleNextCore];
-				*traceBufRdPtr[traceSingleNextCore] = 0;
-				traceBufRdPtr[traceSingleNextCore]++;
-				if(traceBufRdPtr[traceSingleNextCore] >= traceBufEnd[traceSingleNextCore])
-					traceBufRdPtr[traceSingleNextCore] = traceBufStart[traceSingleNextCore];
+			if(trace_read_coreNo_n(&dta, 1, traceSingleNextCore) == 1)
 				done = 1;
-			}
 			// check next core, or if we are done make sure the next core will be
 			// checked next time (fairness)
 			traceSingleNextCore++;
@@ -229,22 +318,66 @@ int trace_read_n(unsigned long long *buffer, unsigned max_data)
  */
 int trace_read_coreNo_n(unsigned long long *buffer, unsigned max_data, unsigned coreNo)
 {
-	unsigned cnt; //number of data read
-	cnt = 0;
-	while(cnt < max_data && *traceBufRdPtr[coreNo] != 0) {
-		// make a small delay so that e-core can finish its write if it is the middle
+	unsigned head, avail, first;
 
-		// Debugging output
-		//fprintf(stderr,"RD_Core %d: Ptr=%p Data %016llx\n", coreNo, traceBufRdPtr[coreNo], *traceBufRdPtr[coreNo]);
+	head = traceRing[coreNo]->head;
+	__sync_synchronize(); // read the head before the events it covers
 
-		*buffer = *traceBufRdPtr[coreNo];
-		*traceBufRdPtr[coreNo] = 0; //make sure it is 0x0
-		cnt++;
-		buffer++;
-		traceBufRdPtr[coreNo]++;
-		if(traceBufRdPtr[coreNo] >= traceBufEnd[coreNo]) traceBufRdPtr[coreNo] = traceBufStart[coreNo];
-	}
-	return cnt;
+	avail = head - traceBufRdCnt[coreNo];
+	if(avail > max_data) avail = max_data;
+	if(avail == 0) return 0;
+
+	// at most two bulk copies, the second one when the ring wraps
+	first = traceBufEnd[coreNo] - traceBufRdPtr[coreNo];
+	if(first > avail) first = avail;
+	memcpy(buffer, traceBufRdPtr[coreNo], first * sizeof(unsigned long long));
+	if(avail > first)
+		memcpy(buffer + first, traceBufStart[coreNo], (avail - first) * sizeof(unsigned long long));
+
+	traceBufRdPtr[coreNo] += avail;
+	if(traceBufRdPtr[coreNo] >= traceBufEnd[coreNo])
+		traceBufRdPtr[coreNo] -= traceBufEnd[coreNo] - traceBufStart[coreNo];
+
+	// hand the slots back to the core only once they have been copied
+	__sync_synchronize();
+	traceBufRdCnt[coreNo] += avail;
+	traceRing[coreNo]->tail = traceBufRdCnt[coreNo];
+
+	return avail;
+}
+
+/**
+ * trace_dropped - number of events a core had to drop because
+ * its trace buffer was full
+ * @param coreNo - this cores buffer 0 .. max-cores
+ * @return number of dropped events
+ */
+unsigned trace_dropped(unsigned coreNo)
+{
+	if(traceRing == NULL || coreNo >= traceNumCores) return 0;
+	return traceRing[coreNo]->dropped;
+}
+
+/**
+ * trace_get_num_cores - number of cores with a trace buffer
+ * @return 0 before trace_init
+ */
+unsigned trace_get_num_cores()
+{
+	return traceNumCores;
+}
+
+/**
+ * trace_dropped_total - number of events dropped by all cores
+ * @return number of dropped events
+ */
+unsigned long long trace_dropped_total()
+{
+	unsigned long long total = 0;
+	unsigned cnt;
+	if(traceRing == NULL) return 0;
+	for(cnt=0;cnt<traceNumCores;cnt++) total += traceRing[cnt]->dropped;
+	return total;
 }
 
 
@@ -264,6 +397,46 @@ int trace_event_to_string(char *buf, unsigned long long event)
 	return 0;
 }
 
+static const char *traceSeverityName[4] = { "error", "warning", "notice", "debug" };
+static const char *traceEventName[10] = {
+	"program", "program", "processing", "processing", "write", "write", "read", "read", "user1", "user1"
+};
+
+/**
+ * trace_event_to_json - creates a Chrome/Perfetto trace event (JSON object)
+ * Events 0 .. 9 come in start/stop pairs and become slice begin/end on the
+ * core's track, the other events become instant events. The severity is
+ * used as category.
+ * @param buf[255] - buffer to put the JSON object
+ * @param time - event time in timer ticks (see trace_merge_push)
+ * @param event - the event to convert
+ * @return 0 on success
+ */
+int trace_event_to_json(char *buf, unsigned long long time, unsigned long long event)
+{
+	trace_event_t te;
+	unsigned long long ns;
+	char name[32];
+	char phase;
+
+	trace_event_to_struct(&te, event);
+	ns = time * 1000 / TRACE_TIMER_FREQ; // ticks at TRACE_TIMER_FREQ MHz
+
+	if(te.eventId < 10) {
+		phase = (te.eventId & 1) ? 'E' : 'B';
+		sprintf(name, "%s bp%u", traceEventName[te.eventId], te.breakpoint);
+	} else {
+		phase = 'i';
+		sprintf(name, "event%u bp%u", te.eventId, te.breakpoint);
+	}
+
+	sprintf(buf, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",%s\"ts\":%llu.%03u,"
+			"\"pid\":0,\"tid\":%u,\"args\":{\"data\":%u}}",
+			name, traceSeverityName[te.severity], phase, phase == 'i' ? "\"s\":\"t\"," : "",
+			ns / 1000, (unsigned)(ns % 1000), te.coreId, te.data);
+	return 0;
+}
+
 /**
  * trace_event_to_struct - takes an event and converts
  * to an event structure
@@ -284,6 +457,21 @@ int trace_event_to_struct(trace_event_t *e_struct, unsigned long long event)
 	return 0;
 }
 
+/**
+ * trace_clock_ticks - timer ticks since the core started its timer
+ * @param clock - the state of the core that stamped the event
+ * @param raw - the timestamp of the event
+ * @return the ticks
+ */
+unsigned long long trace_clock_ticks(trace_clock_t *clock, unsigned raw)
+{
+	// The timer counts down, a step up means it was reloaded
+	if(clock->started && raw > clock->lastRaw) clock->wraps++;
+	clock->started = 1;
+	clock->lastRaw = raw;
+	return (clock->wraps << 32) + (E_CTIMER_MAX - raw);
+}
+
 
 /**
  * trace_struct_to_event - Converts a trace structure to a binary event
@@ -329,13 +517,17 @@ unsigned long long trace_to_event(unsigned severity, unsigned eventId,
  */
 void trace_stop()
 {
+	free(traceRing);
 	free(traceBufStart);
 	free(traceBufEnd);
 	free(traceBufRdPtr);
+	free(traceBufRdCnt);
 
+	traceRing = NULL;
 	traceBufStart = NULL;
 	traceBufEnd = NULL;
 	traceBufRdPtr = NULL;
+	traceBufRdCnt = NULL;
 }
 
 /**
@@ -431,34 +623,26 @@ int trace_file_write(unsigned long long event)
 int trace_file_write_n(unsigned long long *event, int cnt)
 {
 	int bWr, bytesToWrite;
-	int done;
-	int retryCnt;
+	char *wrPtr = (char *)event;
 	if(traceFileHdl < 0) {
 		fprintf(stderr,"Error tried writing to file %d\n", traceFileHdl );
 		return -1;
 	}
 	bytesToWrite = sizeof(unsigned long long) * cnt; // total bytes to write
-	bWr = 0;
-	retryCnt = 0;
-	done = 0;
-	while(!done && retryCnt < 5) {
-		bWr = write(traceFileHdl, event, sizeof(unsigned long long)*cnt);
-		if(bWr < 0 ) {
-			// we got an error just return with -1;
-			fprintf(stderr,"Error write failed with %s\n", strerror(errno));
+	while(bytesToWrite > 0) {
+		bWr = write(traceFileHdl, wrPtr, bytesToWrite);
+		if(bWr < 0 && errno == EINTR) continue;
+		if(bWr <= 0) {
+			// An error (or a disk that takes nothing), just return with -1
+			fprintf(stderr,"Error write failed with %s\n", bWr < 0 ? strerror(errno) : "no progress");
 			return -1;
 		}
-		if(bWr < bytesToWrite) {
-			fprintf(stderr,"short write");
-			bytesToWrite -=bWr; // this is how many we have left to write
-			retryCnt++; // limit retries a bit
-			usleep(1000); // sleep a ms just to be nice to disk
-		} else {
-			done = 1; // we are done
-		}
+		// Keep going after a short write
+		bytesToWrite -= bWr;
+		wrPtr += bWr;
 	}
-	traceEventCnt += (bWr/8); // Number of 64 bit events written
-	return ((sizeof(unsigned long long)*cnt) - bytesToWrite);
+	traceEventCnt += cnt; // Number of 64 bit events written
+	return cnt;
 }
 
 /**
@@ -519,6 +703,12 @@ int trace_file_read_open(char *inFileName, char *outFileName)
 		fclose(oFile);
 		return -1;
 	}
+	if(hdr[2] == TRACE_FILE_VERSION_BLOCK) {
+		// Indexed block file, decoded through the block reader
+		fclose(iFile);
+		fclose(oFile);
+		return trace_block_file_to_text(inFileName, outFileName);
+	}
 	wrCnt = fprintf(oFile,"Header: %08x %08x %08x %08x %08x %08x\n", hdr[0],hdr[1],hdr[2],hdr[3],hdr[4],hdr[5]);
 	if(wrCnt < 0) {
 		fprintf(stderr,"Error writing file header \n");
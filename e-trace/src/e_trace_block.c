@@ -0,0 +1,620 @@
+/*
+ * e_trace_block.c
+ *
+ *  Indexed, block-compressed trace files (.etb)
+ *
+ *  The file keeps the 128 byte header of the plain format (with file
+ *  version TRACE_FILE_VERSION_BLOCK) followed by blocks, an index and a
+ *  footer:
+ *
+ *      header | block | block | ... | pad | index[nBlocks] | footer
+ *
+ *  The pad (up to 7 zero bytes) puts the index and the footer on an 8 byte
+ *  boundary, so a reader can use them in place in the mapping.
+ *
+ *  Every block holds up to TRACE_BLOCK_EVENTS events of a single core. The
+ *  core's ctimer1 countdown is rebuilt to 64-bit ticks (as in the merger)
+ *  and each event is stored as LEB128 varints:
+ *
+ *      (timeDelta << 1) | samePayload   [payload if not samePayload]
+ *
+ *  where payload is severity, event id, breakpoint and data packed into 20
+ *  bits; the core id is implied by the block. Typical events take 2 - 4
+ *  bytes instead of 8. The index holds core, time range, offset and size of
+ *  every block, sorted by core and time, so a reader can mmap the file and
+ *  go straight to the blocks of a core and time window.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <e-trace.h>
+
+#define BLOCK_MAX_COREID    0x1000
+#define BLOCK_HDR_BYTES     128
+#define BLOCK_MAX_EV_BYTES  14           /* worst case varint time + payload */
+#define BLOCK_FOOTER_MAGIC  0xE3ACE00B
+#define BLOCK_ALIGN         8            /* index and footer hold u64 fields */
+#define BLOCK_COREID_MASK   (0xFFFU << 8)
+
+/**
+ * Last 32 bytes of the file
+ */
+typedef struct block_footer_s {
+	unsigned magic;
+	unsigned nBlocks;
+	unsigned long long indexOffset;
+	unsigned long long nEvents;
+	unsigned reserved;
+	unsigned magic2;
+} block_footer_t;
+
+/**
+ * Events of one core waiting to be written as a block
+ */
+typedef struct block_core_s {
+	trace_clock_t clock;
+	unsigned cnt;
+	unsigned long long time[TRACE_BLOCK_EVENTS];
+	unsigned payload[TRACE_BLOCK_EVENTS];
+} block_core_t;
+
+/**
+ * An open .etb file
+ */
+struct trace_block_reader_s {
+	int fd;
+	unsigned char *base;
+	size_t size;
+	const trace_block_index_t *index;
+	unsigned nBlocks;
+	unsigned long long nEvents;
+};
+
+static int blockFileHdl = -1;
+static unsigned long long blockFileOffset = 0;
+static unsigned long long blockEventCnt = 0;
+static block_core_t *blockCores[BLOCK_MAX_COREID];
+static trace_block_index_t *blockIndex = 0;
+static unsigned blockIndexCnt = 0;
+static unsigned blockIndexSize = 0;
+static unsigned char *blockEncBuf = 0;
+
+/* ********************************************************************************************************
+ *
+ *  Internal helpers
+ *
+ * ******************************************************************************************************* */
+
+static unsigned char *varint_put(unsigned char *p, unsigned long long v)
+{
+	while(v >= 0x80) {
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+static const unsigned char *varint_get(const unsigned char *p, const unsigned char *end, unsigned long long *v)
+{
+	unsigned long long val = 0;
+	unsigned shift = 0;
+
+	while(p < end && shift < 64) {
+		val |= (unsigned long long)(*p & 0x7F) << shift;
+		if(!(*p++ & 0x80)) {
+			*v = val;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL; // truncated block
+}
+
+/** severity, event id, breakpoint and data of the high word in 20 bits */
+static unsigned block_payload(unsigned hi)
+{
+	return ((hi >> 12) & 0xFFF00) | (hi & 0xFF);
+}
+
+static unsigned long long block_event(unsigned coreId, unsigned payload, unsigned long long time)
+{
+	unsigned hi = ((payload & 0xFFF00) << 12) | (coreId << 8) | (payload & 0xFF);
+	unsigned raw = E_CTIMER_MAX - (unsigned)(time & 0xFFFFFFFFULL);
+	return ((unsigned long long)hi << 32) | raw;
+}
+
+static int block_write_all(const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	ssize_t wr;
+
+	while(len > 0) {
+		wr = write(blockFileHdl, p, len);
+		if(wr < 0) {
+			if(errno == EINTR) continue;
+			fprintf(stderr,"Error write failed with %s\n", strerror(errno));
+			return -1;
+		}
+		p += wr;
+		len -= wr;
+	}
+	return 0;
+}
+
+/**
+ * Encode the pending events of a core as one block and write it
+ */
+static int block_flush_core(unsigned coreId)
+{
+	block_core_t *core = blockCores[coreId];
+	trace_block_index_t *entry;
+	unsigned char *p = blockEncBuf;
+	unsigned long long prevTime;
+	unsigned prevPayload, cnt;
+
+	if(core == NULL || core->cnt == 0) return 0;
+
+	if(blockIndexCnt == blockIndexSize) {
+		unsigned newSize = blockIndexSize ? blockIndexSize * 2 : 1024;
+		trace_block_index_t *newIndex = (trace_block_index_t *)realloc(blockIndex, newSize * sizeof(trace_block_index_t));
+		if(newIndex == NULL) return -1;
+		blockIndex = newIndex;
+		blockIndexSize = newSize;
+	}
+
+	// The first event is stored relative to the block start time in the index
+	prevTime = core->time[0];
+	prevPayload = ~0U;
+	for(cnt=0;cnt<core->cnt;cnt++) {
+		if(core->payload[cnt] == prevPayload) {
+			p = varint_put(p, ((core->time[cnt] - prevTime) << 1) | 1);
+		} else {
+			p = varint_put(p, (core->time[cnt] - prevTime) << 1);
+			p = varint_put(p, core->payload[cnt]);
+		}
+		prevTime = core->time[cnt];
+		prevPayload = core->payload[cnt];
+	}
+
+	if(block_write_all(blockEncBuf, p - blockEncBuf) != 0) return -1;
+
+	entry = &blockIndex[blockIndexCnt++];
+	memset(entry, 0, sizeof(*entry));
+	entry->coreId = coreId;
+	entry->nEvents = core->cnt;
+	entry->offset = blockFileOffset;
+	entry->bytes = p - blockEncBuf;
+	entry->firstTime = core->time[0];
+	entry->lastTime = core->time[core->cnt - 1];
+
+	blockFileOffset += entry->bytes;
+	core->cnt = 0;
+	return 0;
+}
+
+static int block_index_compare(const void *a, const void *b)
+{
+	const trace_block_index_t *ia = (const trace_block_index_t *)a;
+	const trace_block_index_t *ib = (const trace_block_index_t *)b;
+
+	if(ia->coreId != ib->coreId) return ia->coreId < ib->coreId ? -1 : 1;
+	if(ia->firstTime != ib->firstTime) return ia->firstTime < ib->firstTime ? -1 : 1;
+	return 0;
+}
+
+/* ********************************************************************************************************
+ *
+ *  Writer
+ *
+ * ******************************************************************************************************* */
+
+/**
+ * trace_block_file_open - create a block file, in the same way as trace_file_open()
+ * the name is built from the time and the option field, with extension .etb
+ * @param optionField - the optional text field to filename
+ * @return 0 on success
+ */
+int trace_block_file_open(char *optionField)
+{
+	unsigned hdrBuf[32]; // 128 byte file header
+	char fName[1024];
+	char timeStr[255];
+	time_t tNow = time(0);
+	struct tm *calTime = localtime(&tNow);
+	struct timeval startTime;
+
+	if(blockFileHdl >= 0) {
+		fprintf(stderr,"Block file is already open\n");
+		return -1;
+	}
+
+	strftime(timeStr, 255, "%Y%m%d_%H%M%S", calTime);
+	if(optionField == 0 || strlen(optionField)==0 || strlen(optionField) > 100) {
+		snprintf(fName,1024,"trace_%s.etb", timeStr);
+	} else {
+		snprintf(fName,1024,"trace_%s_%s.etb", timeStr, optionField);
+	}
+
+	blockEncBuf = (unsigned char *)malloc(TRACE_BLOCK_EVENTS * BLOCK_MAX_EV_BYTES);
+	if(blockEncBuf == NULL) return -1;
+
+	blockFileHdl = open(fName, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+	if(blockFileHdl < 0) {
+		fprintf(stderr,"Error opening file %s: %s\n", fName, strerror(errno));
+		free(blockEncBuf);
+		blockEncBuf = NULL;
+		return -1;
+	}
+
+	gettimeofday(&startTime, 0);
+	memset(hdrBuf,0,sizeof(hdrBuf));
+	hdrBuf[0] = 0xE3ACE001;
+	hdrBuf[1] = BLOCK_HDR_BYTES;          // start data offset
+	hdrBuf[2] = TRACE_FILE_VERSION_BLOCK; // trace file version
+	hdrBuf[3] = 0x02;                     // trace definition version
+	hdrBuf[4] = 0xE3ACE002;
+	hdrBuf[5] = startTime.tv_sec;
+	hdrBuf[6] = startTime.tv_usec;
+	hdrBuf[7] = TRACE_BLOCK_EVENTS;
+
+	memset(blockCores, 0, sizeof(blockCores));
+	blockIndexCnt = 0;
+	blockEventCnt = 0;
+	blockFileOffset = 0;
+	if(block_write_all(hdrBuf, sizeof(hdrBuf)) != 0) {
+		trace_block_file_close();
+		return -1;
+	}
+	blockFileOffset = BLOCK_HDR_BYTES;
+	return 0;
+}
+
+/**
+ * trace_block_file_write_n - add raw events to the block file
+ * (events of one core must stay in order, cores may be interleaved freely)
+ * @param events - raw trace events
+ * @param cnt - number of events
+ * @return number of events written, -1 on error
+ */
+int trace_block_file_write_n(unsigned long long *events, int cnt)
+{
+	block_core_t *core;
+	unsigned hi, raw, coreId;
+	int idx;
+
+	if(blockFileHdl < 0) {
+		fprintf(stderr,"Error tried writing to block file %d\n", blockFileHdl);
+		return -1;
+	}
+
+	for(idx=0;idx<cnt;idx++) {
+		hi = (unsigned)(events[idx] >> 32);
+		raw = (unsigned)(events[idx] & 0xFFFFFFFFULL);
+		coreId = (hi & BLOCK_COREID_MASK) >> 8;
+
+		core = blockCores[coreId];
+		if(core == NULL) {
+			core = blockCores[coreId] = (block_core_t *)calloc(1, sizeof(block_core_t));
+			if(core == NULL) return -1;
+		}
+
+		core->time[core->cnt] = trace_clock_ticks(&core->clock, raw);
+		core->payload[core->cnt] = block_payload(hi);
+		if(++core->cnt == TRACE_BLOCK_EVENTS && block_flush_core(coreId) != 0) return -1;
+	}
+	blockEventCnt += cnt;
+	return cnt;
+}
+
+/**
+ * trace_block_file_close - write the pending blocks, the index and the footer
+ * @return 0 on success
+ */
+int trace_block_file_close()
+{
+	static const char pad[BLOCK_ALIGN] = { 0 };
+	block_footer_t ftr;
+	unsigned coreId, padBytes;
+	int retVal = 0;
+
+	if(blockFileHdl < 0) return -1;
+
+	for(coreId=0;coreId<BLOCK_MAX_COREID;coreId++) {
+		if(blockCores[coreId] == NULL) continue;
+		if(block_flush_core(coreId) != 0) retVal = -1;
+		free(blockCores[coreId]);
+		blockCores[coreId] = NULL;
+	}
+
+	qsort(blockIndex, blockIndexCnt, sizeof(trace_block_index_t), block_index_compare);
+
+	padBytes = (unsigned)(-blockFileOffset & (BLOCK_ALIGN - 1));
+	if(padBytes && block_write_all(pad, padBytes) != 0) retVal = -1;
+	blockFileOffset += padBytes;
+
+	memset(&ftr, 0, sizeof(ftr));
+	ftr.magic = BLOCK_FOOTER_MAGIC;
+	ftr.nBlocks = blockIndexCnt;
+	ftr.indexOffset = blockFileOffset;
+	ftr.nEvents = blockEventCnt;
+	ftr.magic2 = BLOCK_FOOTER_MAGIC;
+
+	if(blockIndexCnt && block_write_all(blockIndex, blockIndexCnt * sizeof(trace_block_index_t)) != 0) retVal = -1;
+	if(block_write_all(&ftr, sizeof(ftr)) != 0) retVal = -1;
+
+	close(blockFileHdl);
+	blockFileHdl = -1;
+	free(blockIndex);
+	blockIndex = NULL;
+	blockIndexCnt = 0;
+	blockIndexSize = 0;
+	free(blockEncBuf);
+	blockEncBuf = NULL;
+	return retVal;
+}
+
+/* ********************************************************************************************************
+ *
+ *  Reader
+ *
+ * ******************************************************************************************************* */
+
+/**
+ * trace_block_reader_open - map a block file for reading
+ * @param fileName - the .etb file
+ * @return reader or NULL if the file is not a complete block file
+ */
+trace_block_reader_t *trace_block_reader_open(const char *fileName)
+{
+	trace_block_reader_t *r;
+	const unsigned *hdr;
+	const block_footer_t *ftr;
+	struct stat st;
+	unsigned i;
+
+	r = (trace_block_reader_t *)calloc(1, sizeof(trace_block_reader_t));
+	if(r == NULL) return NULL;
+
+	r->fd = open(fileName, O_RDONLY);
+	if(r->fd < 0 || fstat(r->fd, &st) != 0 ||
+	   (size_t)st.st_size < BLOCK_HDR_BYTES + sizeof(block_footer_t)) {
+		if(r->fd >= 0) close(r->fd);
+		free(r);
+		return NULL;
+	}
+
+	r->size = st.st_size;
+	r->base = (unsigned char *)mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+	if(r->base == MAP_FAILED) {
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+
+	// The writer aligns the index and the footer, only then they can be
+	// used in place
+	if(r->size % BLOCK_ALIGN != 0) {
+		trace_block_reader_close(r);
+		return NULL;
+	}
+
+	hdr = (const unsigned *)r->base;
+	ftr = (const block_footer_t *)(r->base + r->size - sizeof(block_footer_t));
+	if(hdr[0] != 0xE3ACE001 || hdr[2] != TRACE_FILE_VERSION_BLOCK ||
+	   ftr->magic != BLOCK_FOOTER_MAGIC || ftr->magic2 != BLOCK_FOOTER_MAGIC ||
+	   ftr->indexOffset + (unsigned long long)ftr->nBlocks * sizeof(trace_block_index_t)
+			!= r->size - sizeof(block_footer_t) ||
+	   ftr->indexOffset < BLOCK_HDR_BYTES || ftr->indexOffset > r->size ||
+	   ftr->indexOffset % BLOCK_ALIGN != 0) {
+		trace_block_reader_close(r);
+		return NULL;
+	}
+
+	// Every block must lie between the header and the index
+	r->index = (const trace_block_index_t *)(r->base + ftr->indexOffset);
+	for(i = 0; i < ftr->nBlocks; i++) {
+		if(r->index[i].offset < BLOCK_HDR_BYTES || r->index[i].offset > ftr->indexOffset ||
+		   r->index[i].bytes > ftr->indexOffset - r->index[i].offset) {
+			trace_block_reader_close(r);
+			return NULL;
+		}
+	}
+	r->nBlocks = ftr->nBlocks;
+	r->nEvents = ftr->nEvents;
+	madvise(r->base, r->size, MADV_RANDOM);
+	return r;
+}
+
+/**
+ * trace_block_reader_close - unmap and free the reader
+ */
+void trace_block_reader_close(trace_block_reader_t *r)
+{
+	if(r == NULL) return;
+	munmap(r->base, r->size);
+	close(r->fd);
+	free(r);
+}
+
+/**
+ * trace_block_reader_index - the block index, sorted by core and time
+ * @param r - the reader
+ * @param nBlocks - set to the number of blocks
+ * @return the index entries
+ */
+const trace_block_index_t *trace_block_reader_index(trace_block_reader_t *r, unsigned *nBlocks)
+{
+	if(nBlocks) *nBlocks = r->nBlocks;
+	return r->index;
+}
+
+/**
+ * trace_block_reader_num_events - number of events in the file
+ */
+unsigned long long trace_block_reader_num_events(trace_block_reader_t *r)
+{
+	return r->nEvents;
+}
+
+/**
+ * trace_block_query - set up an iterator over a core and time window
+ * @param r - the reader
+ * @param it - iterator to set up
+ * @param coreId - core to read or TRACE_BLOCK_ANY_CORE
+ * @param tStart - first time to include (ticks)
+ * @param tEnd - last time to include (ticks)
+ * @return 0 on success
+ */
+int trace_block_query(trace_block_reader_t *r, trace_block_iter_t *it, unsigned coreId,
+		unsigned long long tStart, unsigned long long tEnd)
+{
+	unsigned lo = 0, hi = r->nBlocks, mid;
+
+	memset(it, 0, sizeof(*it));
+	it->reader = r;
+	it->coreId = coreId;
+	it->tStart = tStart;
+	it->tEnd = tEnd;
+
+	if(coreId != TRACE_BLOCK_ANY_CORE) {
+		// First block of the core that ends at or after tStart
+		while(lo < hi) {
+			mid = (lo + hi) / 2;
+			if(r->index[mid].coreId < coreId ||
+			   (r->index[mid].coreId == coreId && r->index[mid].lastTime < tStart))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+	}
+	it->block = lo;
+	it->left = 0;
+	return 0;
+}
+
+/**
+ * trace_block_iter_next - decode the next events of the query
+ * Events of one core come in time order; with TRACE_BLOCK_ANY_CORE the
+ * cores follow each other (feed them to trace_merge_push() for global order)
+ * @param it - the iterator
+ * @param out - buffer for the events, time holds the rebuilt ticks
+ * @param max - max number of events
+ * @return number of events returned, 0 at the end
+ */
+int trace_block_iter_next(trace_block_iter_t *it, trace_merged_event_t *out, unsigned max)
+{
+	trace_block_reader_t *r = it->reader;
+	const trace_block_index_t *entry;
+	unsigned long long v;
+	unsigned n = 0;
+
+	while(n < max) {
+		if(it->left == 0) {
+			// Find the next block that overlaps the query
+			for(; it->block < r->nBlocks; it->block++) {
+				entry = &r->index[it->block];
+				if(it->coreId != TRACE_BLOCK_ANY_CORE && entry->coreId != it->coreId) {
+					it->block = r->nBlocks; // sorted by core, nothing more to find
+					break;
+				}
+				if(entry->lastTime < it->tStart) continue;
+				if(entry->firstTime > it->tEnd) {
+					if(it->coreId != TRACE_BLOCK_ANY_CORE) it->block = r->nBlocks;
+					continue;
+				}
+				break;
+			}
+			if(it->block >= r->nBlocks) break;
+
+			entry = &r->index[it->block++];
+			it->pos = r->base + entry->offset;
+			it->end = it->pos + entry->bytes;
+			it->left = entry->nEvents;
+			it->time = entry->firstTime;
+			it->payload = 0;
+			it->blockCore = entry->coreId;
+		}
+
+		it->pos = varint_get(it->pos, it->end, &v);
+		if(it->pos == NULL) {
+			fprintf(stderr,"Corrupt block in trace file\n");
+			it->left = 0;
+			it->block = r->nBlocks;
+			break;
+		}
+		it->time += v >> 1;
+		if(!(v & 1)) {
+			it->pos = varint_get(it->pos, it->end, &v);
+			if(it->pos == NULL) {
+				fprintf(stderr,"Corrupt block in trace file\n");
+				it->left = 0;
+				it->block = r->nBlocks;
+				break;
+			}
+			it->payload = (unsigned)v;
+		}
+		it->left--;
+
+		if(it->time > it->tEnd) {
+			it->left = 0; // rest of this block is past the window
+			continue;
+		}
+		if(it->time < it->tStart) continue;
+
+		out[n].time = it->time;
+		out[n].event = block_event(it->blockCore, it->payload, it->time);
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Write the events of a block file as text, core by core
+ * @param inFileName - name of trace file to read
+ * @param outFileName - name of textual trace file to write
+ * @return 0 on success
+ */
+int trace_block_file_to_text(char *inFileName, char *outFileName)
+{
+	trace_block_reader_t *r;
+	trace_block_iter_t it;
+	trace_merged_event_t mBuf[1024];
+	char eventBuf[1024];
+	unsigned long long evNo = 0;
+	FILE *oFile;
+	int n, cnt;
+
+	r = trace_block_reader_open(inFileName);
+	if(r == NULL) {
+		fprintf(stderr,"%s is not a block trace file\n", inFileName);
+		return -1;
+	}
+	oFile = fopen(outFileName,"wb");
+	if(oFile == NULL) {
+		fprintf(stderr,"Could not open output file %s for writing \n", outFileName);
+		trace_block_reader_close(r);
+		return -1;
+	}
+
+	fprintf(oFile,"Blocks: %u Events: %llu\n", r->nBlocks, r->nEvents);
+	trace_block_query(r, &it, TRACE_BLOCK_ANY_CORE, 0, ~0ULL);
+	while((n = trace_block_iter_next(&it, mBuf, 1024)) > 0) {
+		for(cnt=0;cnt<n;cnt++) {
+			trace_merged_event_to_string(eventBuf, &mBuf[cnt]);
+			fprintf(oFile,"E-No: %llu: %s\n", evNo++, eventBuf);
+		}
+	}
+
+	fclose(oFile);
+	trace_block_reader_close(r);
+	return 0;
+}
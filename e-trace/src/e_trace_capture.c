@@ -0,0 +1,418 @@
+/*
+ * e_trace_capture.c
+ *
+ *  Multi-threaded capture engine for the host trace library
+ *
+ *  Drain threads each own a group of cores and move events out of the
+ *  shared trace buffer into blocks. Full blocks are handed to a single
+ *  writer thread through one lock-free single-producer/single-consumer
+ *  ring per drain thread. The writer packs blocks into a large aligned
+ *  buffer and writes it to the trace file in big chunks. An optional
+ *  consumer (e.g. text formatting) runs on its own thread and gets copies
+ *  of the blocks; if it falls behind it misses blocks, the file does not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <e-hal.h>
+#include <e-trace.h>
+
+#define CAPTURE_WRITE_BUF_SIZE  (1024 * 1024)   /* bytes per file write */
+#define CAPTURE_ALIGN           4096
+#define CAPTURE_IDLE_MIN_NS     50000           /* first idle back-off */
+#define CAPTURE_IDLE_MAX_NS     10000000        /* longest idle back-off */
+
+/**
+ * A block of events handed from one thread to another
+ */
+typedef struct capture_block_s {
+	unsigned cnt;
+	unsigned long long *events;
+} capture_block_t;
+
+/**
+ * Single-producer/single-consumer ring of blocks. Only the producer
+ * writes head, only the consumer writes tail.
+ */
+typedef struct capture_ring_s {
+	volatile unsigned head;
+	char __pad0[60];
+	volatile unsigned tail;
+	char __pad1[60];
+	unsigned numBlocks;
+	capture_block_t *blocks;
+} capture_ring_t;
+
+typedef struct capture_drain_s {
+	pthread_t thread;
+	unsigned firstCore;
+	unsigned numCores;
+	capture_ring_t ring;
+} capture_drain_t;
+
+static trace_capture_opts_t captureOpts;
+static capture_drain_t *captureDrain = 0;
+static unsigned captureNumDrain = 0;
+static capture_ring_t captureConsumerRing;
+static pthread_t captureWriter;
+static pthread_t captureConsumer;
+static volatile int captureRunning = 0;
+static volatile int captureWriterDone = 0;
+static volatile unsigned captureDrainDone = 0;
+static volatile unsigned long long captureEvents = 0;
+static volatile unsigned long long captureSkipped = 0;
+static volatile int captureWriteError = 0;
+static unsigned long long *captureBuf = 0;   // writer's aligned file buffer
+
+/* ********************************************************************************************************
+ *
+ *  Internal helpers
+ *
+ * ******************************************************************************************************* */
+
+static int ring_init(capture_ring_t *ring, unsigned numBlocks, unsigned blockEvents)
+{
+	unsigned cnt;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->numBlocks = numBlocks;
+	ring->blocks = (capture_block_t *)calloc(numBlocks, sizeof(capture_block_t));
+	if(ring->blocks == NULL) return -1;
+	for(cnt=0;cnt<numBlocks;cnt++){
+		ring->blocks[cnt].events = (unsigned long long *)malloc(blockEvents * sizeof(unsigned long long));
+		if(ring->blocks[cnt].events == NULL) return -1;
+	}
+	return 0;
+}
+
+static void ring_free(capture_ring_t *ring)
+{
+	unsigned cnt;
+
+	if(ring->blocks == NULL) return;
+	for(cnt=0;cnt<ring->numBlocks;cnt++) free(ring->blocks[cnt].events);
+	free(ring->blocks);
+	ring->blocks = NULL;
+}
+
+/** Next free block for the producer, or NULL if the ring is full */
+static capture_block_t *ring_produce_begin(capture_ring_t *ring)
+{
+	if(ring->head - ring->tail >= ring->numBlocks) return NULL;
+	return &ring->blocks[ring->head % ring->numBlocks];
+}
+
+static void ring_produce_end(capture_ring_t *ring)
+{
+	__sync_synchronize(); // block contents before the new head
+	ring->head++;
+}
+
+/** Oldest filled block for the consumer, or NULL if the ring is empty */
+static capture_block_t *ring_consume_begin(capture_ring_t *ring)
+{
+	if(ring->head == ring->tail) return NULL;
+	__sync_synchronize(); // head before the block contents
+	return &ring->blocks[ring->tail % ring->numBlocks];
+}
+
+static void ring_consume_end(capture_ring_t *ring)
+{
+	__sync_synchronize(); // done with the block before handing it back
+	ring->tail++;
+}
+
+/** Sleep with exponential back-off while there is nothing to do */
+static void capture_idle(unsigned *idleNs)
+{
+	struct timespec ts;
+
+	if(*idleNs < CAPTURE_IDLE_MIN_NS) *idleNs = CAPTURE_IDLE_MIN_NS;
+	ts.tv_sec = 0;
+	ts.tv_nsec = *idleNs;
+	nanosleep(&ts, NULL);
+	*idleNs *= 2;
+	if(*idleNs > CAPTURE_IDLE_MAX_NS) *idleNs = CAPTURE_IDLE_MAX_NS;
+}
+
+/**
+ * Drain thread: moves events of its cores into blocks
+ */
+static void *capture_drain_thread(void *arg)
+{
+	capture_drain_t *drain = (capture_drain_t *)arg;
+	capture_block_t *blk;
+	unsigned idleNs = 0, core, cnt, total;
+	unsigned nextCore = 0;
+	int stopping = 0;
+
+	while(1) {
+		blk = ring_produce_begin(&drain->ring);
+		if(blk == NULL) {
+			// Only a capture that failed to start stops without a writer
+			if(!captureRunning && captureWriterDone) break;
+			// The writer is behind, the cores keep buffering meanwhile
+			capture_idle(&idleNs);
+			continue;
+		}
+
+		// Start at a different core every time so none is starved
+		total = 0;
+		for(cnt=0; cnt<drain->numCores && total<captureOpts.blockEvents; cnt++) {
+			core = drain->firstCore + (nextCore + cnt) % drain->numCores;
+			total += trace_read_coreNo_n(&blk->events[total], captureOpts.blockEvents - total, core);
+		}
+		nextCore = (nextCore + 1) % drain->numCores;
+
+		if(total > 0) {
+			blk->cnt = total;
+			ring_produce_end(&drain->ring);
+			idleNs = 0;
+		} else if(stopping) {
+			break;
+		} else if(!captureRunning) {
+			stopping = 1; // one more pass so nothing is left behind
+		} else {
+			capture_idle(&idleNs);
+		}
+	}
+
+	__sync_fetch_and_add(&captureDrainDone, 1);
+	return NULL;
+}
+
+/** Write the buffer to the trace file, a failure is kept for trace_capture_stop() */
+static int capture_flush(unsigned long long *buf, unsigned *fill)
+{
+	int retVal = 0;
+
+	if(*fill == 0) return 0;
+	if(captureOpts.blockFile) {
+		if(trace_block_file_write_n(buf, *fill) != (int)*fill) retVal = -1;
+	} else {
+		if(trace_file_write_n(buf, *fill) != (int)*fill) retVal = -1;
+	}
+	if(retVal != 0 && !captureWriteError) {
+		fprintf(stderr,"Capture could not write the trace file, events are lost\n");
+		captureWriteError = 1;
+	}
+	*fill = 0;
+	return retVal;
+}
+
+/**
+ * Writer thread: collects blocks from all drain threads and writes
+ * them to the trace file in large aligned chunks
+ */
+static void *capture_writer_thread(void *arg)
+{
+	unsigned long long *buf = captureBuf;
+	capture_block_t *blk, *cblk;
+	unsigned bufEvents = CAPTURE_WRITE_BUF_SIZE / sizeof(unsigned long long);
+	unsigned fill = 0, idleNs = 0, cnt, busy;
+	(void)arg;
+
+	while(1) {
+		busy = 0;
+		for(cnt=0;cnt<captureNumDrain;cnt++) {
+			while((blk = ring_consume_begin(&captureDrain[cnt].ring)) != NULL) {
+				if(fill + blk->cnt > bufEvents) capture_flush(buf, &fill);
+				memcpy(&buf[fill], blk->events, blk->cnt * sizeof(unsigned long long));
+				fill += blk->cnt;
+				captureEvents += blk->cnt;
+
+				if(captureOpts.consumer) {
+					cblk = ring_produce_begin(&captureConsumerRing);
+					if(cblk) {
+						memcpy(cblk->events, blk->events, blk->cnt * sizeof(unsigned long long));
+						cblk->cnt = blk->cnt;
+						ring_produce_end(&captureConsumerRing);
+					} else {
+						captureSkipped += blk->cnt;
+					}
+				}
+
+				ring_consume_end(&captureDrain[cnt].ring);
+				busy = 1;
+			}
+		}
+
+		if(!busy) {
+			if(captureDrainDone == captureNumDrain) break;
+			// Nothing coming in, get what we have onto disk
+			capture_flush(buf, &fill);
+			capture_idle(&idleNs);
+		} else {
+			idleNs = 0;
+		}
+	}
+
+	capture_flush(buf, &fill);
+	captureWriterDone = 1;
+	return NULL;
+}
+
+/**
+ * Consumer thread: hands copies of the blocks to the optional consumer
+ */
+static void *capture_consumer_thread(void *arg)
+{
+	capture_block_t *blk;
+	unsigned idleNs = 0;
+	(void)arg;
+
+	while(1) {
+		blk = ring_consume_begin(&captureConsumerRing);
+		if(blk) {
+			captureOpts.consumer(blk->events, blk->cnt, captureOpts.consumerArg);
+			ring_consume_end(&captureConsumerRing);
+			idleNs = 0;
+		} else if(captureWriterDone) {
+			break;
+		} else {
+			capture_idle(&idleNs);
+		}
+	}
+	return NULL;
+}
+
+/* ********************************************************************************************************
+ *
+ *  Implementation
+ *
+ * ******************************************************************************************************* */
+
+/**
+ * trace_capture_start - start the capture threads
+ * trace_init() and trace_file_open() must have been called before
+ */
+int trace_capture_start(trace_capture_opts_t *opts)
+{
+	unsigned numCores, perThread, cnt;
+
+	if(captureDrain) {
+		fprintf(stderr,"Capture is already running\n");
+		return -1;
+	}
+
+	numCores = trace_get_num_cores();
+	if(numCores == 0) {
+		fprintf(stderr,"Capture started before trace_init\n");
+		return -1;
+	}
+
+	memset(&captureOpts, 0, sizeof(captureOpts));
+	if(opts) captureOpts = *opts;
+	if(captureOpts.numDrainThreads == 0) captureOpts.numDrainThreads = (numCores + 15) / 16;
+	if(captureOpts.numDrainThreads > numCores) captureOpts.numDrainThreads = numCores;
+	if(captureOpts.blockEvents == 0) captureOpts.blockEvents = TRACE_CAPTURE_BLOCK_EVENTS;
+	if(captureOpts.numBlocks == 0) captureOpts.numBlocks = TRACE_CAPTURE_NUM_BLOCKS;
+
+	captureNumDrain = captureOpts.numDrainThreads;
+	captureDrain = (capture_drain_t *)calloc(captureNumDrain, sizeof(capture_drain_t));
+	if(captureDrain == NULL) return -1;
+
+	captureEvents = 0;
+	captureSkipped = 0;
+	captureWriteError = 0;
+	captureDrainDone = 0;
+	captureWriterDone = 0;
+	captureRunning = 1;
+
+	if(posix_memalign((void **)&captureBuf, CAPTURE_ALIGN, CAPTURE_WRITE_BUF_SIZE) != 0) {
+		fprintf(stderr,"Capture could not allocate the write buffer\n");
+		captureBuf = NULL;
+		trace_capture_stop();
+		return -1;
+	}
+
+	// Split the cores into contiguous groups, one per drain thread
+	perThread = numCores / captureNumDrain;
+	for(cnt=0;cnt<captureNumDrain;cnt++) {
+		captureDrain[cnt].firstCore = cnt * perThread;
+		captureDrain[cnt].numCores = (cnt == captureNumDrain - 1) ? numCores - cnt * perThread : perThread;
+		if(ring_init(&captureDrain[cnt].ring, captureOpts.numBlocks, captureOpts.blockEvents) != 0) {
+			fprintf(stderr,"Capture could not allocate its blocks\n");
+			captureNumDrain = cnt + 1;
+			trace_capture_stop();
+			return -1;
+		}
+	}
+	if(captureOpts.consumer &&
+	   ring_init(&captureConsumerRing, captureOpts.numBlocks, captureOpts.blockEvents) != 0) {
+		fprintf(stderr,"Capture could not allocate the consumer blocks\n");
+		trace_capture_stop();
+		return -1;
+	}
+
+	// Without a writer the drain threads give up on a full ring, so a
+	// failure at any point unwinds through trace_capture_stop()
+	for(cnt=0;cnt<captureNumDrain;cnt++) {
+		if(pthread_create(&captureDrain[cnt].thread, NULL, capture_drain_thread, &captureDrain[cnt]) != 0) {
+			captureDrain[cnt].thread = 0;
+			captureWriterDone = 1;
+			goto threadFailed;
+		}
+	}
+	if(pthread_create(&captureWriter, NULL, capture_writer_thread, NULL) != 0) {
+		captureWriter = 0;
+		captureWriterDone = 1;
+		goto threadFailed;
+	}
+	if(captureOpts.consumer &&
+	   pthread_create(&captureConsumer, NULL, capture_consumer_thread, NULL) != 0) {
+		captureConsumer = 0;
+		goto threadFailed;
+	}
+
+	return 0;
+
+threadFailed:
+	fprintf(stderr,"Capture could not start its threads\n");
+	trace_capture_stop();
+	return -1;
+}
+
+/**
+ * trace_capture_stop - drain what is left, stop and join all threads
+ */
+int trace_capture_stop()
+{
+	unsigned cnt;
+
+	if(captureDrain == NULL) return -1;
+
+	captureRunning = 0;
+	for(cnt=0;cnt<captureNumDrain;cnt++)
+		if(captureDrain[cnt].thread) pthread_join(captureDrain[cnt].thread, NULL);
+	if(captureWriter) pthread_join(captureWriter, NULL);
+	if(captureOpts.consumer && captureConsumer) pthread_join(captureConsumer, NULL);
+
+	for(cnt=0;cnt<captureNumDrain;cnt++) ring_free(&captureDrain[cnt].ring);
+	ring_free(&captureConsumerRing);
+	free(captureDrain);
+	captureDrain = NULL;
+	captureNumDrain = 0;
+	captureWriter = 0;
+	captureConsumer = 0;
+	free(captureBuf);
+	captureBuf = NULL;
+
+	return captureWriteError ? -1 : 0;
+}
+
+/**
+ * trace_capture_stats - events captured so far
+ * @param events - events handed to the file writer
+ * @param skipped - events the optional consumer missed because it was behind
+ */
+void trace_capture_stats(unsigned long long *events, unsigned long long *skipped)
+{
+	if(events) *events = captureEvents;
+	if(skipped) *skipped = captureSkipped;
+}
@@ -0,0 +1,156 @@
+/*
+ * e_trace_json.c
+ *
+ *  Streaming conversion of trace files to the Chrome trace event format
+ *  (JSON), which chrome://tracing and the Perfetto UI load directly.
+ *
+ *  Every core becomes a thread (track) named after its row and column.
+ *  The viewers sort the events by time themselves, so the converter only
+ *  needs the per-core order that both file formats already have: plain
+ *  files (.etr) are read in chunks while rebuilding each core's 64-bit
+ *  time, block files (.etb) are read core by core through the index.
+ *  Memory use is therefore independent of the size of the capture.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <e-trace.h>
+
+#define JSON_MAX_COREID     0x1000
+#define JSON_FILE_HDR_BYTES (32*4)
+#define JSON_FILE_FTR_BYTES (6*4)
+
+/* ********************************************************************************************************
+ *
+ *  Internal helpers
+ *
+ * ******************************************************************************************************* */
+
+static int json_put_event(FILE *oFile, unsigned char *named, int *first,
+		unsigned long long time, unsigned long long event)
+{
+	char eventBuf[512];
+	unsigned coreId = (unsigned)(event >> 40) & 0xFFF;
+
+	if(!named[coreId]) {
+		// Name the track of a core the first time it shows up
+		fprintf(oFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+				"\"args\":{\"name\":\"core %u,%u\"}}",
+				*first ? "\n" : ",\n", coreId, (coreId >> 6) & 0x3F, coreId & 0x3F);
+		*first = 0;
+		named[coreId] = 1;
+	}
+
+	trace_event_to_json(eventBuf, time, event);
+	if(fprintf(oFile, "%s%s", *first ? "\n" : ",\n", eventBuf) < 0) return -1;
+	*first = 0;
+	return 0;
+}
+
+static int json_plain_file(char *inFileName, FILE *oFile, unsigned char *named, int *first)
+{
+	struct stat iFileStat;
+	unsigned long long rdBuf[1024];
+	unsigned long long nEvents, time;
+	trace_clock_t *clock;
+	unsigned raw, coreId;
+	size_t rdCnt, idx;
+	FILE *iFile;
+	int retVal = 0;
+
+	if(stat(inFileName, &iFileStat) < 0 || iFileStat.st_size < JSON_FILE_HDR_BYTES + JSON_FILE_FTR_BYTES) {
+		fprintf(stderr,"Not enough data in file %s\n", inFileName);
+		return -1;
+	}
+	iFile = fopen(inFileName,"rb");
+	if(iFile == NULL) {
+		fprintf(stderr,"Error opening input file %s \n", inFileName);
+		return -1;
+	}
+	clock = (trace_clock_t *)calloc(JSON_MAX_COREID, sizeof(trace_clock_t));
+	if(clock == NULL) {
+		fclose(iFile);
+		return -1;
+	}
+
+	nEvents = (iFileStat.st_size - JSON_FILE_HDR_BYTES - JSON_FILE_FTR_BYTES) / 8;
+	fseek(iFile, JSON_FILE_HDR_BYTES, SEEK_SET);
+
+	while(nEvents > 0 && retVal == 0) {
+		rdCnt = fread(rdBuf, 8, nEvents < 1024 ? nEvents : 1024, iFile);
+		if(rdCnt == 0) break;
+		nEvents -= rdCnt;
+		for(idx=0;idx<rdCnt && retVal==0;idx++) {
+			coreId = (unsigned)(rdBuf[idx] >> 40) & 0xFFF;
+			raw = (unsigned)(rdBuf[idx] & 0xFFFFFFFFULL);
+			time = trace_clock_ticks(&clock[coreId], raw);
+			retVal = json_put_event(oFile, named, first, time, rdBuf[idx]);
+		}
+	}
+
+	free(clock);
+	fclose(iFile);
+	return retVal;
+}
+
+static int json_block_file(trace_block_reader_t *r, FILE *oFile, unsigned char *named, int *first)
+{
+	trace_block_iter_t it;
+	trace_merged_event_t mBuf[1024];
+	int n, cnt;
+
+	trace_block_query(r, &it, TRACE_BLOCK_ANY_CORE, 0, ~0ULL);
+	while((n = trace_block_iter_next(&it, mBuf, 1024)) > 0) {
+		for(cnt=0;cnt<n;cnt++)
+			if(json_put_event(oFile, named, first, mBuf[cnt].time, mBuf[cnt].event) != 0) return -1;
+	}
+	return 0;
+}
+
+/* ********************************************************************************************************
+ *
+ *  Implementation
+ *
+ * ******************************************************************************************************* */
+
+/**
+ * Convert a trace file (.etr or .etb) to Chrome/Perfetto JSON
+ * @param inFileName - name of trace file to read
+ * @param outFileName - name of JSON file to write
+ * @return 0 on success
+ */
+int trace_file_to_json(char *inFileName, char *outFileName)
+{
+	unsigned char named[JSON_MAX_COREID];
+	trace_block_reader_t *r;
+	FILE *oFile;
+	int first = 1;
+	int retVal;
+
+	if(inFileName == NULL || outFileName == NULL) {
+		fprintf(stderr,"Invalid input or output file name\n");
+		return -1;
+	}
+	oFile = fopen(outFileName,"wb");
+	if(oFile == NULL) {
+		fprintf(stderr,"Could not open output file %s for writing \n", outFileName);
+		return -1;
+	}
+
+	memset(named, 0, sizeof(named));
+	fprintf(oFile, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	r = trace_block_reader_open(inFileName);
+	if(r) {
+		retVal = json_block_file(r, oFile, named, &first);
+		trace_block_reader_close(r);
+	} else {
+		retVal = json_plain_file(inFileName, oFile, named, &first);
+	}
+
+	fprintf(oFile, "\n]}\n");
+	if(fclose(oFile) != 0) retVal = -1;
+	return retVal;
+}
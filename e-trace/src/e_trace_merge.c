@@ -0,0 +1,451 @@
+/*
+ * e_trace_merge.c
+ *
+ *  Globally time-ordered view of the per-core trace streams
+ *
+ *  Every event carries the E_CTIMER_1 value of the core that wrote it. The
+ *  timer counts down from E_CTIMER_MAX and timer1_trace_isr() reloads it, so
+ *  a raw value larger than the previous one from the same core means the
+ *  counter wrapped. Per core the merger keeps a wrap count and rebuilds a
+ *  64-bit tick count since the core started its timer:
+ *
+ *      ticks = wraps * 2^32 + (E_CTIMER_MAX - raw)
+ *
+ *  Cores that started with trace_start_wait_all() all start counting when
+ *  the WAND barrier releases, so their tick counts share the same zero.
+ *  Remaining skew (or cores started with trace_start()) can be corrected
+ *  with trace_merge_set_offset().
+ *
+ *  Events of one core arrive in time order, so a k-way merge with a min-heap
+ *  over the cores gives a global order. An event is only released once it is
+ *  no later than the newest time seen from every core (the watermark), since
+ *  no core can still produce an earlier one. Cores that have gone quiet hold
+ *  the watermark back; trace_merge_flush() releases everything at the end.
+ *
+ *  A core that stays idle for a full timer period (2^32 cycles) between two
+ *  events cannot have that wrap detected, its later events come out one
+ *  period early.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <e-trace.h>
+
+#define MERGE_MAX_COREID     0x1000  /* coreid is 12 bits in the event */
+#define MERGE_QUEUE_MIN      256     /* initial per-core queue length */
+#define MERGE_FILE_HDR_BYTES (32*4)
+#define MERGE_FILE_FTR_BYTES (6*4)
+
+/**
+ * Per-core state
+ */
+typedef struct merge_core_s {
+	unsigned coreId;
+	trace_clock_t clock;         // rebuilds the 64-bit ticks
+	long long offset;            // added to the rebuilt ticks
+	unsigned long long lastTime; // newest aligned time seen
+	trace_merged_event_t *queue; // events waiting to be merged
+	unsigned qHead, qCnt, qSize; // ring of pending events
+	int inHeap;
+	int done;                    // no more events, does not hold the watermark
+} merge_core_t;
+
+static short mergeIndex[MERGE_MAX_COREID]; // coreid -> core slot + 1
+static merge_core_t *mergeCores = 0;
+static unsigned mergeNumCores = 0;
+static unsigned mergeCoresSize = 0;
+static unsigned *mergeHeap = 0;             // core slots ordered by head time
+static unsigned mergeHeapCnt = 0;
+static long long mergePendingOffset[MERGE_MAX_COREID];
+
+/* ********************************************************************************************************
+ *
+ *  Internal helpers
+ *
+ * ******************************************************************************************************* */
+
+static merge_core_t *merge_get_core(unsigned coreId)
+{
+	merge_core_t *core;
+
+	if(mergeIndex[coreId]) return &mergeCores[mergeIndex[coreId] - 1];
+
+	if(mergeNumCores == mergeCoresSize) {
+		unsigned newSize = mergeCoresSize ? mergeCoresSize * 2 : 64;
+		merge_core_t *newCores = (merge_core_t *)realloc(mergeCores, newSize * sizeof(merge_core_t));
+		unsigned *newHeap = (unsigned *)realloc(mergeHeap, newSize * sizeof(unsigned));
+		if(newCores == NULL || newHeap == NULL) {
+			if(newCores) mergeCores = newCores;
+			if(newHeap) mergeHeap = newHeap;
+			return NULL;
+		}
+		mergeCores = newCores;
+		mergeHeap = newHeap;
+		mergeCoresSize = newSize;
+	}
+
+	core = &mergeCores[mergeNumCores];
+	memset(core, 0, sizeof(*core));
+	core->coreId = coreId;
+	core->offset = mergePendingOffset[coreId];
+	mergeIndex[coreId] = ++mergeNumCores;
+	return core;
+}
+
+static int merge_queue_put(merge_core_t *core, unsigned long long time, unsigned long long event)
+{
+	if(core->qCnt == core->qSize) {
+		unsigned newSize = core->qSize ? core->qSize * 2 : MERGE_QUEUE_MIN;
+		trace_merged_event_t *newQueue = (trace_merged_event_t *)malloc(newSize * sizeof(trace_merged_event_t));
+		unsigned cnt;
+		if(newQueue == NULL) return -1;
+		for(cnt=0;cnt<core->qCnt;cnt++)
+			newQueue[cnt] = core->queue[(core->qHead + cnt) % core->qSize];
+		free(core->queue);
+		core->queue = newQueue;
+		core->qHead = 0;
+		core->qSize = newSize;
+	}
+	core->queue[(core->qHead + core->qCnt) % core->qSize].time = time;
+	core->queue[(core->qHead + core->qCnt) % core->qSize].event = event;
+	core->qCnt++;
+	return 0;
+}
+
+static unsigned long long merge_head_time(unsigned slot)
+{
+	merge_core_t *core = &mergeCores[slot];
+	return core->queue[core->qHead].time;
+}
+
+static void merge_heap_up(unsigned pos)
+{
+	unsigned slot = mergeHeap[pos];
+	unsigned long long time = merge_head_time(slot);
+
+	while(pos > 0) {
+		unsigned parent = (pos - 1) / 2;
+		if(merge_head_time(mergeHeap[parent]) <= time) break;
+		mergeHeap[pos] = mergeHeap[parent];
+		pos = parent;
+	}
+	mergeHeap[pos] = slot;
+}
+
+static void merge_heap_down(unsigned pos)
+{
+	unsigned slot = mergeHeap[pos];
+	unsigned long long time = merge_head_time(slot);
+	unsigned child;
+
+	while((child = 2 * pos + 1) < mergeHeapCnt) {
+		if(child + 1 < mergeHeapCnt &&
+		   merge_head_time(mergeHeap[child + 1]) < merge_head_time(mergeHeap[child]))
+			child++;
+		if(time <= merge_head_time(mergeHeap[child])) break;
+		mergeHeap[pos] = mergeHeap[child];
+		pos = child;
+	}
+	mergeHeap[pos] = slot;
+}
+
+/**
+ * Queue an event with its aligned time and put its core on the heap
+ */
+static int merge_insert(merge_core_t *core, unsigned long long time, unsigned long long event)
+{
+	if(time < core->lastTime) time = core->lastTime; // keep each core monotonic after offset changes
+	core->lastTime = time;
+
+	if(merge_queue_put(core, time, event) != 0) return -1;
+	if(!core->inHeap) {
+		core->inHeap = 1;
+		mergeHeap[mergeHeapCnt++] = core - mergeCores;
+		merge_heap_up(mergeHeapCnt - 1);
+	}
+	return 0;
+}
+
+/**
+ * Take events off the heap top while they are no later than limit
+ */
+static int merge_emit(trace_merged_event_t *out, unsigned max, unsigned long long limit)
+{
+	merge_core_t *core;
+	unsigned n = 0;
+
+	while(n < max && mergeHeapCnt > 0) {
+		core = &mergeCores[mergeHeap[0]];
+		if(core->queue[core->qHead].time > limit) break;
+
+		out[n++] = core->queue[core->qHead];
+		core->qHead = (core->qHead + 1) % core->qSize;
+		core->qCnt--;
+
+		if(core->qCnt == 0) {
+			core->inHeap = 0;
+			mergeHeap[0] = mergeHeap[--mergeHeapCnt];
+		}
+		if(mergeHeapCnt > 0) merge_heap_down(0);
+	}
+	return n;
+}
+
+/**
+ * Merge the cores of an indexed block file. Every core is read with its own
+ * query and the core that holds back the watermark is always read next, so
+ * only a little of each core is pending at any time.
+ */
+static int merge_block_file(trace_block_reader_t *r, char *outFileName)
+{
+	const trace_block_index_t *index;
+	trace_block_iter_t *iters;
+	merge_core_t *core, *next;
+	trace_merged_event_t mBuf[1024];
+	char eventBuf[1024];
+	unsigned long long evNo = 0;
+	unsigned nBlocks, blk, cnt;
+	int n, retVal = 0;
+	FILE *oFile;
+
+	oFile = fopen(outFileName,"wb");
+	if(oFile == NULL) {
+		fprintf(stderr,"Could not open output file %s for writing \n", outFileName);
+		trace_block_reader_close(r);
+		return -1;
+	}
+
+	index = trace_block_reader_index(r, &nBlocks);
+	trace_merge_init();
+	iters = (trace_block_iter_t *)calloc(MERGE_MAX_COREID, sizeof(trace_block_iter_t));
+	if(iters == NULL) retVal = -1;
+
+	// One core slot and query per core found in the index
+	for(blk=0;retVal==0 && blk<nBlocks;blk++) {
+		if(blk > 0 && index[blk].coreId == index[blk - 1].coreId) continue;
+		if(merge_get_core(index[blk].coreId) == NULL) retVal = -1;
+		else trace_block_query(r, &iters[index[blk].coreId], index[blk].coreId, 0, ~0ULL);
+	}
+
+	while(retVal == 0) {
+		next = NULL;
+		for(cnt=0;cnt<mergeNumCores;cnt++) {
+			core = &mergeCores[cnt];
+			if(!core->done && (next == NULL || core->lastTime < next->lastTime)) next = core;
+		}
+		if(next == NULL) break;
+
+		n = trace_block_iter_next(&iters[next->coreId], mBuf, 256);
+		if(n == 0) next->done = 1;
+		for(cnt=0;cnt<(unsigned)n;cnt++)
+			if(merge_insert(next, mBuf[cnt].time + next->offset, mBuf[cnt].event) != 0) retVal = -1;
+
+		while((n = trace_merge_pop(mBuf, 1024)) > 0) {
+			for(cnt=0;cnt<(unsigned)n;cnt++) {
+				trace_merged_event_to_string(eventBuf, &mBuf[cnt]);
+				fprintf(oFile,"E-No: %llu: %s\n", evNo++, eventBuf);
+			}
+		}
+	}
+	if(retVal != 0) fprintf(stderr,"Out of memory merging events\n");
+
+	free(iters);
+	trace_merge_finalize();
+	fclose(oFile);
+	trace_block_reader_close(r);
+	return retVal;
+}
+
+/* ********************************************************************************************************
+ *
+ *  Implementation
+ *
+ * ******************************************************************************************************* */
+
+/**
+ * trace_merge_init - reset the merger
+ * @return 0 on success
+ */
+int trace_merge_init()
+{
+	trace_merge_finalize();
+	memset(mergeIndex, 0, sizeof(mergeIndex));
+	memset(mergePendingOffset, 0, sizeof(mergePendingOffset));
+	return 0;
+}
+
+/**
+ * trace_merge_finalize - free all merger state
+ */
+void trace_merge_finalize()
+{
+	unsigned cnt;
+
+	for(cnt=0;cnt<mergeNumCores;cnt++) free(mergeCores[cnt].queue);
+	free(mergeCores);
+	free(mergeHeap);
+	mergeCores = NULL;
+	mergeHeap = NULL;
+	mergeNumCores = 0;
+	mergeCoresSize = 0;
+	mergeHeapCnt = 0;
+	memset(mergeIndex, 0, sizeof(mergeIndex));
+}
+
+/**
+ * trace_merge_set_offset - correct the clock of one core
+ * @param coreId - core id as found in the events
+ * @param ticks - added to every rebuilt timestamp of that core
+ * @return 0 on success
+ */
+int trace_merge_set_offset(unsigned coreId, long long ticks)
+{
+	if(coreId >= MERGE_MAX_COREID) return -1;
+	mergePendingOffset[coreId] = ticks;
+	if(mergeIndex[coreId]) mergeCores[mergeIndex[coreId] - 1].offset = ticks;
+	return 0;
+}
+
+/**
+ * trace_merge_push - add raw events in the order they were read
+ * (events of one core must stay in order, cores may be interleaved freely)
+ * @param events - raw trace events
+ * @param cnt - number of events
+ * @return number of events taken, -1 on allocation failure
+ */
+int trace_merge_push(const unsigned long long *events, unsigned cnt)
+{
+	merge_core_t *core;
+	trace_event_t te;
+	unsigned long long ticks;
+	unsigned idx;
+
+	for(idx=0;idx<cnt;idx++) {
+		trace_event_to_struct(&te, events[idx]);
+		core = merge_get_core(te.coreId);
+		if(core == NULL) return -1;
+
+		ticks = trace_clock_ticks(&core->clock, te.timestamp);
+		if(merge_insert(core, ticks + core->offset, events[idx]) != 0) return -1;
+	}
+	return cnt;
+}
+
+/**
+ * trace_merge_pop - take events that are safe to emit in global time order
+ * @param out - buffer for merged events
+ * @param max - max number of events
+ * @return number of events returned
+ */
+int trace_merge_pop(trace_merged_event_t *out, unsigned max)
+{
+	unsigned long long watermark = ~0ULL;
+	unsigned cnt;
+
+	if(mergeNumCores == 0) return 0;
+	for(cnt=0;cnt<mergeNumCores;cnt++)
+		if(!mergeCores[cnt].done && mergeCores[cnt].lastTime < watermark) watermark = mergeCores[cnt].lastTime;
+
+	return merge_emit(out, max, watermark);
+}
+
+/**
+ * trace_merge_flush - take all pending events in global time order,
+ * regardless of cores that may still be behind (use at end of trace)
+ * @param out - buffer for merged events
+ * @param max - max number of events
+ * @return number of events returned
+ */
+int trace_merge_flush(trace_merged_event_t *out, unsigned max)
+{
+	return merge_emit(out, max, ~0ULL);
+}
+
+/**
+ * trace_merged_event_to_string - creates a string from a merged event
+ * @param buf - buffer to put the string
+ * @param me - the merged event
+ * @return 0 on success
+ */
+int trace_merged_event_to_string(char *buf, trace_merged_event_t *me)
+{
+	trace_event_t te;
+	trace_event_to_struct(&te, me->event);
+	sprintf(buf, "Time: %14llu CoreId: 0x%03x Severity: %1u, EventId: %3u, bp: %1u, data: %3u",
+			me->time, te.coreId, te.severity, te.eventId, te.breakpoint, te.data);
+	return 0;
+}
+
+/**
+ * Read a trace file and write its events as text in global time order
+ * @param inFileName - name of trace file to read
+ * @param outFileName - name of textual trace file to write
+ * @return 0 on success
+ */
+int trace_file_merge(char *inFileName, char *outFileName)
+{
+	struct stat iFileStat;
+	unsigned long long rdBuf[1024];
+	trace_merged_event_t mBuf[1024];
+	char eventBuf[1024];
+	unsigned long long nEvents, evNo = 0;
+	size_t rdCnt;
+	int n, cnt;
+	FILE *iFile, *oFile;
+	trace_block_reader_t *blockFile;
+
+	if(inFileName == NULL || outFileName == NULL) {
+		fprintf(stderr,"Invalid input or output file name\n");
+		return -1;
+	}
+	blockFile = trace_block_reader_open(inFileName);
+	if(blockFile) return merge_block_file(blockFile, outFileName);
+	if(stat(inFileName, &iFileStat) < 0 || iFileStat.st_size < MERGE_FILE_HDR_BYTES + MERGE_FILE_FTR_BYTES) {
+		fprintf(stderr,"Not enough data in file %s\n", inFileName);
+		return -1;
+	}
+	iFile = fopen(inFileName,"rb");
+	if(iFile == NULL) {
+		fprintf(stderr,"Error opening input file %s \n", inFileName);
+		return -1;
+	}
+	oFile = fopen(outFileName,"wb");
+	if(oFile == NULL) {
+		fprintf(stderr,"Could not open output file %s for writing \n", outFileName);
+		fclose(iFile);
+		return -1;
+	}
+
+	nEvents = (iFileStat.st_size - MERGE_FILE_HDR_BYTES - MERGE_FILE_FTR_BYTES) / 8;
+	fseek(iFile, MERGE_FILE_HDR_BYTES, SEEK_SET);
+	trace_merge_init();
+
+	while(nEvents > 0) {
+		rdCnt = fread(rdBuf, 8, nEvents < 1024 ? nEvents : 1024, iFile);
+		if(rdCnt == 0) break;
+		nEvents -= rdCnt;
+		if(trace_merge_push(rdBuf, rdCnt) < 0) {
+			fprintf(stderr,"Out of memory merging events\n");
+			break;
+		}
+		while((n = trace_merge_pop(mBuf, 1024)) > 0) {
+			for(cnt=0;cnt<n;cnt++) {
+				trace_merged_event_to_string(eventBuf, &mBuf[cnt]);
+				fprintf(oFile,"E-No: %llu: %s\n", evNo++, eventBuf);
+			}
+		}
+	}
+	while((n = trace_merge_flush(mBuf, 1024)) > 0) {
+		for(cnt=0;cnt<n;cnt++) {
+			trace_merged_event_to_string(eventBuf, &mBuf[cnt]);
+			fprintf(oFile,"E-No: %llu: %s\n", evNo++, eventBuf);
+		}
+	}
+
+	trace_merge_finalize();
+	fclose(iFile);
+	fclose(oFile);
+	return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * e_trace_stats.c
+ *
+ *  Live aggregation of trace events on the host
+ *
+ *  Instead of (or next to) writing every event to a file the statistics
+ *  module keeps per-core and per-event counts, event rates and latency
+ *  histograms between matching start/stop events. A start event (even id
+ *  below 10) is matched with the following stop event (id + 1) of the same
+ *  core and breakpoint; the time between them goes into a log2 histogram
+ *  of timer ticks for that event pair and breakpoint.
+ *
+ *  trace_stats_consumer() plugs into trace_capture_start() so it runs on
+ *  the capture consumer thread. trace_stats_serve() answers every
+ *  connection on a Unix socket with the current report as text, e.g.
+ *
+ *      socat - UNIX-CONNECT:/tmp/e-trace.sock
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <e-trace.h>
+
+#define STATS_MAX_COREID  0x1000
+#define STATS_NUM_EVENTS  64
+#define STATS_NUM_PAIRS   5            /* start/stop pairs, event ids 0 .. 9 */
+#define STATS_NUM_BP      16
+#define STATS_NUM_BUCKETS 64
+
+/**
+ * Per-core counters and open start events
+ */
+typedef struct stats_core_s {
+	unsigned coreId;
+	unsigned long long events;
+	unsigned long long perEvent[STATS_NUM_EVENTS];
+	trace_clock_t clock;
+	unsigned long long openTime[STATS_NUM_PAIRS][STATS_NUM_BP];
+	unsigned char open[STATS_NUM_PAIRS][STATS_NUM_BP];
+} stats_core_t;
+
+/**
+ * Latencies of one start/stop pair and breakpoint
+ */
+typedef struct stats_latency_s {
+	unsigned long long cnt;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long bucket[STATS_NUM_BUCKETS]; // bucket n: 2^(n-1) <= ticks < 2^n
+} stats_latency_t;
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static short statsIndex[STATS_MAX_COREID];  // coreid -> core slot + 1
+static stats_core_t *statsCores = 0;
+static unsigned statsNumCores = 0;
+static unsigned statsCoresSize = 0;
+static stats_latency_t statsLatency[STATS_NUM_PAIRS][STATS_NUM_BP];
+static unsigned long long statsEvents = 0;
+static unsigned long long statsUnmatched = 0;  // stop events without a start
+static unsigned long long statsLost = 0;       // events without memory for their core
+static struct timeval statsStartTime;
+static unsigned long long statsLastEvents = 0;  // at the previous report
+static struct timeval statsLastTime;
+
+static pthread_t statsServer;
+static int statsServerFd = -1;
+static volatile int statsServing = 0;
+static char statsSocketPath[108];
+
+/* ********************************************************************************************************
+ *
+ *  Internal helpers
+ *
+ * ******************************************************************************************************* */
+
+static stats_core_t *stats_get_core(unsigned coreId)
+{
+	stats_core_t *core;
+
+	if(statsIndex[coreId]) return &statsCores[statsIndex[coreId] - 1];
+
+	if(statsNumCores == statsCoresSize) {
+		unsigned newSize = statsCoresSize ? statsCoresSize * 2 : 64;
+		stats_core_t *newCores = (stats_core_t *)realloc(statsCores, newSize * sizeof(stats_core_t));
+		if(newCores == NULL) return NULL;
+		statsCores = newCores;
+		statsCoresSize = newSize;
+	}
+
+	core = &statsCores[statsNumCores];
+	memset(core, 0, sizeof(*core));
+	core->coreId = coreId;
+	statsIndex[coreId] = ++statsNumCores;
+	return core;
+}
+
+static unsigned stats_bucket(unsigned long long ticks)
+{
+	unsigned bucket = 0;
+
+	while(ticks && bucket < STATS_NUM_BUCKETS - 1) {
+		ticks >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static double stats_seconds(struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+/**
+ * Accept loop of the Unix socket endpoint
+ */
+static void *stats_server_thread(void *arg)
+{
+	struct pollfd pfd;
+	FILE *fp;
+	char *text, *pos;
+	size_t len;
+	ssize_t sent;
+	int fd;
+	(void)arg;
+
+	while(statsServing) {
+		pfd.fd = statsServerFd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, 200) <= 0) continue; // timeout lets us notice a stop
+
+		fd = accept(statsServerFd, NULL, NULL);
+		if(fd < 0) continue;
+
+		// Send the report with MSG_NOSIGNAL, a client that hung up early
+		// must not kill the capture with SIGPIPE
+		text = NULL;
+		fp = open_memstream(&text, &len);
+		if(fp != NULL) {
+			trace_stats_print(fp);
+			fclose(fp);
+			for(pos=text;pos && len>0;pos+=sent,len-=sent) {
+				sent = send(fd, pos, len, MSG_NOSIGNAL);
+				if(sent < 0 && errno == EINTR) sent = 0;
+				else if(sent <= 0) break;
+			}
+		}
+		free(text);
+		close(fd);
+	}
+	return NULL;
+}
+
+/* ********************************************************************************************************
+ *
+ *  Implementation
+ *
+ * ******************************************************************************************************* */
+
+/**
+ * trace_stats_init - clear all statistics
+ * @return 0 on success
+ */
+int trace_stats_init()
+{
+	pthread_mutex_lock(&statsLock);
+	free(statsCores);
+	statsCores = NULL;
+	statsNumCores = 0;
+	statsCoresSize = 0;
+	memset(statsIndex, 0, sizeof(statsIndex));
+	memset(statsLatency, 0, sizeof(statsLatency));
+	statsEvents = 0;
+	statsUnmatched = 0;
+	statsLost = 0;
+	statsLastEvents = 0;
+	gettimeofday(&statsStartTime, 0);
+	statsLastTime = statsStartTime;
+	pthread_mutex_unlock(&statsLock);
+	return 0;
+}
+
+/**
+ * trace_stats_add - aggregate raw events
+ * (events of one core must stay in order, cores may be interleaved freely)
+ * @param events - raw trace events
+ * @param cnt - number of events
+ * @return 0 on success, -1 if events were lost on allocation failure
+ */
+int trace_stats_add(const unsigned long long *events, unsigned cnt)
+{
+	stats_core_t *core;
+	stats_latency_t *lat;
+	trace_event_t te;
+	unsigned long long time, ticks;
+	unsigned idx, pair;
+	int retVal = 0;
+
+	pthread_mutex_lock(&statsLock);
+	for(idx=0;idx<cnt;idx++) {
+		trace_event_to_struct(&te, events[idx]);
+		core = stats_get_core(te.coreId);
+		if(core == NULL) {
+			// Keep going, the cores seen so far still have their slots
+			statsLost++;
+			retVal = -1;
+			continue;
+		}
+
+		time = trace_clock_ticks(&core->clock, te.timestamp);
+
+		core->events++;
+		core->perEvent[te.eventId]++;
+		statsEvents++;
+
+		if(te.eventId >= STATS_NUM_PAIRS * 2) continue;
+		pair = te.eventId / 2;
+		if(!(te.eventId & 1)) {
+			core->openTime[pair][te.breakpoint] = time;
+			core->open[pair][te.breakpoint] = 1;
+		} else if(core->open[pair][te.breakpoint]) {
+			core->open[pair][te.breakpoint] = 0;
+			ticks = time - core->openTime[pair][te.breakpoint];
+			lat = &statsLatency[pair][te.breakpoint];
+			if(lat->cnt == 0 || ticks < lat->min) lat->min = ticks;
+			if(ticks > lat->max) lat->max = ticks;
+			lat->cnt++;
+			lat->sum += ticks;
+			lat->bucket[stats_bucket(ticks)]++;
+		} else {
+			statsUnmatched++;
+		}
+	}
+	pthread_mutex_unlock(&statsLock);
+	return retVal;
+}
+
+/**
+ * trace_stats_consumer - capture consumer that aggregates the events,
+ * pass it in trace_capture_opts_t.consumer
+ * (events it can not aggregate show up as "lost" in the report)
+ */
+void trace_stats_consumer(const unsigned long long *events, unsigned cnt, void *arg)
+{
+	(void)arg;
+	trace_stats_add(events, cnt);
+}
+
+/**
+ * trace_stats_print - write the current statistics as text
+ * @param fp - stream to write to
+ * @return 0 on success
+ */
+int trace_stats_print(FILE *fp)
+{
+	static const char *pairName[STATS_NUM_PAIRS] = { "program", "processing", "write", "read", "user1" };
+	struct timeval now;
+	stats_latency_t *lat;
+	unsigned cnt, ev, pair, bp, bucket;
+	unsigned long long skipped, dropped;
+	double total, interval;
+
+	// Events the capture consumer ring skipped are dropped as well
+	trace_capture_stats(NULL, &skipped);
+	dropped = skipped + (trace_get_num_cores() ? trace_dropped_total() : 0ULL);
+
+	pthread_mutex_lock(&statsLock);
+	gettimeofday(&now, 0);
+	total = stats_seconds(&statsStartTime, &now);
+	interval = stats_seconds(&statsLastTime, &now);
+
+	fprintf(fp, "events %llu elapsed %.3f s rate %.1f ev/s recent %.1f ev/s dropped %llu lost %llu unmatched %llu\n",
+			statsEvents, total, total > 0 ? statsEvents / total : 0.0,
+			interval > 0 ? (statsEvents - statsLastEvents) / interval : 0.0,
+			dropped, statsLost, statsUnmatched);
+	statsLastEvents = statsEvents;
+	statsLastTime = now;
+
+	for(cnt=0;cnt<statsNumCores;cnt++) {
+		fprintf(fp, "core 0x%03x events %llu rate %.1f ev/s",
+				statsCores[cnt].coreId, statsCores[cnt].events,
+				total > 0 ? statsCores[cnt].events / total : 0.0);
+		for(ev=0;ev<STATS_NUM_EVENTS;ev++)
+			if(statsCores[cnt].perEvent[ev])
+				fprintf(fp, " e%u:%llu", ev, statsCores[cnt].perEvent[ev]);
+		fprintf(fp, "\n");
+	}
+
+	for(pair=0;pair<STATS_NUM_PAIRS;pair++) {
+		for(bp=0;bp<STATS_NUM_BP;bp++) {
+			lat = &statsLatency[pair][bp];
+			if(lat->cnt == 0) continue;
+			fprintf(fp, "latency %s bp%u cnt %llu min %llu avg %llu max %llu ticks hist",
+					pairName[pair], bp, lat->cnt, lat->min, lat->sum / lat->cnt, lat->max);
+			for(bucket=0;bucket<STATS_NUM_BUCKETS;bucket++)
+				if(lat->bucket[bucket])
+					fprintf(fp, " <2^%u:%llu", bucket, lat->bucket[bucket]);
+			fprintf(fp, "\n");
+		}
+	}
+	pthread_mutex_unlock(&statsLock);
+	return 0;
+}
+
+/**
+ * trace_stats_serve - answer connections on a Unix socket with the report
+ * @param socketPath - path of the socket, replaced if it exists
+ * @return 0 on success
+ */
+int trace_stats_serve(const char *socketPath)
+{
+	struct sockaddr_un addr;
+
+	if(statsServing) return -1;
+	if(socketPath == NULL || strlen(socketPath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr,"Invalid stats socket path\n");
+		return -1;
+	}
+
+	statsServerFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(statsServerFd < 0) {
+		fprintf(stderr,"Could not create stats socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+	unlink(socketPath);
+	if(bind(statsServerFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	   listen(statsServerFd, 4) != 0) {
+		fprintf(stderr,"Could not listen on %s: %s\n", socketPath, strerror(errno));
+		close(statsServerFd);
+		statsServerFd = -1;
+		return -1;
+	}
+	strcpy(statsSocketPath, socketPath);
+
+	statsServing = 1;
+	if(pthread_create(&statsServer, NULL, stats_server_thread, NULL) != 0) {
+		statsServing = 0;
+		close(statsServerFd);
+		statsServerFd = -1;
+		unlink(statsSocketPath);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * trace_stats_stop_serving - close the Unix socket endpoint
+ */
+void trace_stats_stop_serving()
+{
+	if(!statsServing) return;
+	statsServing = 0;
+	pthread_join(statsServer, NULL);
+	close(statsServerFd);
+	statsServerFd = -1;
+	unlink(statsSocketPath);
+}
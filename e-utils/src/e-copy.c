@@ -0,0 +1,406 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 Adapteva, Inc
+
+Contributed by Yaniv Sapir <support@adapteva.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// e-copy: move whole files into or out of core SRAM and external memory
+// with bulk e_write()/e_read() calls. A transfer to or from a group of
+// cores is spread over several threads, one core at a time per thread;
+// a transfer to or from external memory is split into one chunk per
+// thread. The achieved throughput is reported at the end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "e-hal.h"
+
+#define MAX_THREADS 64
+
+typedef enum {
+	LOC_FILE,
+	LOC_CORE,
+	LOC_EMEM,
+} loc_type_t;
+
+typedef struct {
+	loc_type_t type;
+	char      *path;       // LOC_FILE
+	int        row, col;   // LOC_CORE, first core of the group
+	int        rows, cols; // LOC_CORE, size of the group
+	unsigned   addr;       // core address or external memory offset
+} loc_t;
+
+typedef struct {
+	e_bool_t verbose;
+	int      threads;
+	size_t   size;         // bytes to read, from -n
+} prtopt_t;
+
+prtopt_t prtopt = {E_FALSE, 4, 0};
+
+typedef struct {
+	pthread_t thread;
+	int       id;
+	void     *dev;         // e_epiphany_t or e_mem_t
+	loc_t    *loc;
+	int       to_dev;      // direction
+	char     *buf;         // whole file image
+	size_t    size;        // bytes per core, or of the whole emem transfer
+	int       errors;
+} job_t;
+
+static job_t jobs[MAX_THREADS];
+static int   numjobs;
+
+void usage();
+static int parse_loc(char *s, loc_t *loc);
+
+
+// Each thread takes every numjobs-th core of the group
+static void *core_worker(void *arg)
+{
+	job_t *job = (job_t *) arg;
+	loc_t *loc = job->loc;
+	char   fname[1024];
+	char  *buf;
+	FILE  *fp;
+	int    i, r, c;
+
+	buf = job->to_dev ? job->buf : malloc(job->size);
+	if (!buf)
+	{
+		job->errors++;
+		return NULL;
+	}
+
+	for (i = job->id; i < loc->rows * loc->cols; i += numjobs)
+	{
+		r = i / loc->cols;
+		c = i % loc->cols;
+
+		if (job->to_dev)
+		{
+			if (e_write(job->dev, r, c, loc->addr, buf, job->size) != (ssize_t) job->size)
+			{
+				fprintf(stderr, "e-copy: write to core (%d,%d) failed\n", loc->row + r, loc->col + c);
+				job->errors++;
+			}
+			continue;
+		}
+
+		if (e_read(job->dev, r, c, loc->addr, buf, job->size) != (ssize_t) job->size)
+		{
+			fprintf(stderr, "e-copy: read from core (%d,%d) failed\n", loc->row + r, loc->col + c);
+			job->errors++;
+			continue;
+		}
+
+		// One output file per core when reading a group
+		if (loc->rows * loc->cols > 1)
+			snprintf(fname, sizeof(fname), "%s.%d_%d", job->buf, loc->row + r, loc->col + c);
+		else
+			snprintf(fname, sizeof(fname), "%s", job->buf);
+
+		fp = fopen(fname, "wb");
+		if (!fp || fwrite(buf, 1, job->size, fp) != job->size)
+		{
+			fprintf(stderr, "e-copy: cannot write %s\n", fname);
+			job->errors++;
+		}
+		if (fp)
+			fclose(fp);
+	}
+
+	if (!job->to_dev)
+		free(buf);
+	return NULL;
+}
+
+
+// Each thread moves one contiguous chunk of the external memory range
+static void *emem_worker(void *arg)
+{
+	job_t *job = (job_t *) arg;
+	size_t chunk, from, len;
+
+	chunk = (job->size + numjobs - 1) / numjobs;
+	chunk = (chunk + 7) & ~((size_t) 7);
+	from  = chunk * job->id;
+	if (from >= job->size)
+		return NULL;
+	len = (from + chunk > job->size) ? job->size - from : chunk;
+
+	if (job->to_dev)
+	{
+		if (e_write(job->dev, 0, 0, from, job->buf + from, len) != (ssize_t) len)
+			job->errors++;
+	} else {
+		if (e_read(job->dev, 0, 0, from, job->buf + from, len) != (ssize_t) len)
+			job->errors++;
+	}
+
+	return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+	e_epiphany_t   edev;
+	e_mem_t        emem;
+	e_platform_t   plat;
+	loc_t          src, dst, *dev;
+	struct timeval t0, t1;
+	struct stat    st;
+	char          *buf = NULL, *fname;
+	size_t         size, total;
+	double         secs;
+	FILE          *fp;
+	int            opt, i, to_dev, errors = 0;
+
+	while ((opt = getopt(argc, argv, "vj:n:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v':
+			prtopt.verbose = E_TRUE;
+			break;
+		case 'j':
+			prtopt.threads = atoi(optarg);
+			break;
+		case 'n':
+			prtopt.size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if ((argc - optind) != 2 || parse_loc(argv[optind], &src) || parse_loc(argv[optind + 1], &dst))
+	{
+		usage();
+		exit(1);
+	}
+
+	if (prtopt.threads < 1)
+		prtopt.threads = 1;
+	if (prtopt.threads > MAX_THREADS)
+		prtopt.threads = MAX_THREADS;
+
+	if (src.type == LOC_FILE && dst.type != LOC_FILE)
+	{
+		to_dev = 1;
+		dev    = &dst;
+		fname  = src.path;
+	} else if (dst.type == LOC_FILE && src.type != LOC_FILE) {
+		to_dev = 0;
+		dev    = &src;
+		fname  = dst.path;
+	} else {
+		fprintf(stderr, "e-copy: exactly one side must be a file\n");
+		exit(1);
+	}
+
+	// Get the data, or the size of what we are to read
+	if (to_dev)
+	{
+		fp = fopen(fname, "rb");
+		if (!fp || fstat(fileno(fp), &st))
+		{
+			fprintf(stderr, "e-copy: cannot open %s\n", fname);
+			exit(1);
+		}
+		size = prtopt.size ? prtopt.size : (size_t) st.st_size;
+		if (size > (size_t) st.st_size)
+			size = st.st_size;
+		buf = malloc(size ? size : 1);
+		if (!buf || fread(buf, 1, size, fp) != size)
+		{
+			fprintf(stderr, "e-copy: cannot read %s\n", fname);
+			exit(1);
+		}
+		fclose(fp);
+	} else {
+		size = prtopt.size;
+		if (!size)
+		{
+			fprintf(stderr, "e-copy: give the number of bytes to read with -n\n");
+			exit(1);
+		}
+	}
+
+	e_set_host_verbosity(H_D0);
+	if (E_OK != e_init(NULL))
+	{
+		fprintf(stderr, "e-copy: failed to initialize the Epiphany platform\n");
+		exit(1);
+	}
+	e_get_platform_info(&plat);
+
+	if (dev->type == LOC_CORE)
+	{
+		// rows and cols are positive, checked when parsed
+		if ((dev->row < 0) || (dev->col < 0) ||
+			((unsigned) dev->row >= plat.rows) || ((unsigned) dev->rows > plat.rows - dev->row) ||
+			((unsigned) dev->col >= plat.cols) || ((unsigned) dev->cols > plat.cols - dev->col))
+		{
+			fprintf(stderr, "e-copy: core coordinates exceed platform boundaries!\n");
+			e_finalize();
+			exit(1);
+		}
+		if (E_OK != e_open(&edev, dev->row, dev->col, dev->rows, dev->cols))
+		{
+			e_finalize();
+			exit(1);
+		}
+		if (prtopt.threads > dev->rows * dev->cols)
+			prtopt.threads = dev->rows * dev->cols;
+		total = size * dev->rows * dev->cols;
+	} else {
+		if (E_OK != e_alloc(&emem, (off_t) dev->addr, size))
+		{
+			e_finalize();
+			exit(1);
+		}
+		if (!to_dev && !(buf = malloc(size)))
+		{
+			fprintf(stderr, "e-copy: out of memory\n");
+			exit(1);
+		}
+		total = size;
+	}
+
+	if (prtopt.verbose)
+	{
+		if (dev->type == LOC_CORE)
+			printf("%s %u bytes %s cores (%d,%d) .. (%d,%d) at 0x%x, %d threads.\n",
+				   to_dev ? "Writing" : "Reading", (unsigned) size, to_dev ? "to" : "from",
+				   dev->row, dev->col, dev->row + dev->rows - 1, dev->col + dev->cols - 1,
+				   dev->addr, prtopt.threads);
+		else
+			printf("%s %u bytes %s external memory at offset 0x%x, %d threads.\n",
+				   to_dev ? "Writing" : "Reading", (unsigned) size, to_dev ? "to" : "from",
+				   dev->addr, prtopt.threads);
+	}
+
+	numjobs = prtopt.threads;
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < numjobs; i++)
+	{
+		jobs[i].id     = i;
+		jobs[i].dev    = (dev->type == LOC_CORE) ? (void *) &edev : (void *) &emem;
+		jobs[i].loc    = dev;
+		jobs[i].to_dev = to_dev;
+		// the core workers get the file name to write to when reading
+		jobs[i].buf    = (dev->type == LOC_CORE && !to_dev) ? fname : buf;
+		jobs[i].size   = size;
+		jobs[i].errors = 0;
+		pthread_create(&jobs[i].thread, NULL, (dev->type == LOC_CORE) ? core_worker : emem_worker, &jobs[i]);
+	}
+	for (i = 0; i < numjobs; i++)
+	{
+		pthread_join(jobs[i].thread, NULL);
+		errors += jobs[i].errors;
+	}
+	gettimeofday(&t1, NULL);
+
+	if (dev->type == LOC_EMEM && !to_dev && !errors)
+	{
+		fp = fopen(fname, "wb");
+		if (!fp || fwrite(buf, 1, size, fp) != size)
+		{
+			fprintf(stderr, "e-copy: cannot write %s\n", fname);
+			errors++;
+		}
+		if (fp)
+			fclose(fp);
+	}
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("%u bytes in %.3f ms, %.2f MB/s%s\n", (unsigned) total, secs * 1e3,
+		   secs > 0 ? total / secs / 1e6 : 0.0, errors ? " (with errors)" : "");
+
+	if (dev->type == LOC_CORE)
+		e_close(&edev);
+	else
+		e_free(&emem);
+	e_finalize();
+	free(buf);
+
+	return errors ? 1 : 0;
+}
+
+
+// <file> | core:<row>,<col>[:<rows>,<cols>]@<addr> | emem@<offset>
+static int parse_loc(char *s, loc_t *loc)
+{
+	memset(loc, 0, sizeof(*loc));
+
+	if (!strncmp(s, "core:", 5))
+	{
+		loc->type = LOC_CORE;
+		loc->rows = loc->cols = 1;
+		if (sscanf(s + 5, "%d,%d:%d,%d@%x", &loc->row, &loc->col, &loc->rows, &loc->cols, &loc->addr) == 5)
+			return (loc->rows < 1 || loc->cols < 1);
+		if (sscanf(s + 5, "%d,%d@%x", &loc->row, &loc->col, &loc->addr) == 3)
+			return 0;
+		return 1;
+	}
+
+	if (!strncmp(s, "emem@", 5))
+	{
+		loc->type = LOC_EMEM;
+		return (sscanf(s + 5, "%x", &loc->addr) != 1);
+	}
+
+	loc->type = LOC_FILE;
+	loc->path = s;
+	return 0;
+}
+
+
+void usage()
+{
+	printf("Usage: e-copy [-v] [-j <threads>] [-n <bytes>] <from> <to>\n");
+	printf("   from, to       - one of them is a file, the other one of\n");
+	printf("                    core:<row>,<col>@<addr>                  one core\n");
+	printf("                    core:<row>,<col>:<rows>,<cols>@<addr>    a group of cores\n");
+	printf("                    emem@<offset>                            external memory\n");
+	printf("                    (addresses and offsets in hex)\n");
+	printf("   -n bytes       - number of bytes to copy; required when reading from the\n");
+	printf("                    device, limits the part of the file written to it.\n");
+	printf("                    Reading a group writes one file per core, <file>.<row>_<col>\n");
+	printf("   -j threads     - number of threads moving data in parallel (default 4).\n");
+	printf("   -v             - verbose mode. Print more information.\n");
+	printf("Examples:\n");
+	printf("   e-copy data.bin core:0,0:4,4@2000     write data.bin to 0x2000 of 16 cores\n");
+	printf("   e-copy -n 0x100000 emem@0 dump.bin    read 1MB of external memory\n");
+
+	return;
+}
@@ -0,0 +1,137 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 Adapteva, Inc
+
+Contributed by Yaniv Sapir <support@adapteva.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// e-hdf-compile: compile a text or XML platform description (HDF) into the
+// binary format that e_init() and e-server map instead of parsing. Set
+// EPIPHANY_HDF to the compiled file to use it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "e-hal.h"
+
+void usage();
+static void print_hdf(const e_hdf_t *desc);
+
+
+int main(int argc, char *argv[])
+{
+	e_hdf_t *desc;
+	e_bool_t print = E_FALSE;
+	int      opt;
+
+	while ((opt = getopt(argc, argv, "ph")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			print = E_TRUE;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2 || (argc - optind == 1 && !print))
+	{
+		usage();
+		exit(1);
+	}
+
+	desc = e_hdf_load(argv[optind]);
+	if (!desc)
+	{
+		fprintf(stderr, "e-hdf-compile: can't read %s\n", argv[optind]);
+		exit(1);
+	}
+
+	if (print)
+		print_hdf(desc);
+
+	if (argc - optind == 2 && E_OK != e_hdf_save(desc, argv[optind + 1]))
+	{
+		fprintf(stderr, "e-hdf-compile: can't write %s\n", argv[optind + 1]);
+		e_hdf_free(desc);
+		exit(1);
+	}
+
+	e_hdf_free(desc);
+
+	return 0;
+}
+
+
+// Print the description in the text HDF format, with what only the XML
+// format can hold as comments
+static void print_hdf(const e_hdf_t *desc)
+{
+	const e_hdf_chip_t *chip = E_HDF_CHIPS(desc);
+	const e_hdf_emem_t *emem = E_HDF_EMEMS(desc);
+	static const char  *type[] = {"", "RD", "WR", "RDWR"};
+	unsigned            i;
+
+	printf("// Platform %s, lib \"%s\", libinitargs \"%s\"\n", desc->name, desc->lib, desc->libinitargs);
+	printf("PLATFORM_VERSION  %s\n\n", desc->version);
+
+	printf("NUM_CHIPS         %u\n", desc->num_chips);
+	for (i = 0; i < desc->num_chips; i++)
+	{
+		printf("CHIP              %s\n", chip[i].version);
+		printf("CHIP_ROW          %u\n", chip[i].row);
+		printf("CHIP_COL          %u\n", chip[i].col);
+		printf("// %ux%u cores, generation %u, 0x%x bytes of SRAM, host base 0x%08x",
+			   chip[i].rows, chip[i].cols, chip[i].arch, chip[i].sram_size, chip[i].host_base);
+		if (chip[i].ioreg_row != E_HDF_NO_IOREG)
+			printf(", I/O registers at (%u,%u)", chip[i].ioreg_row, chip[i].ioreg_col);
+		printf("\n");
+	}
+
+	printf("\nNUM_EXT_MEMS      %u\n", desc->num_emems);
+	for (i = 0; i < desc->num_emems; i++)
+	{
+		printf("EMEM              %s\n", emem[i].name[0] ? emem[i].name : "-");
+		printf("EMEM_BASE_ADDRESS 0x%08x\n", emem[i].phy_base);
+		printf("EMEM_EPI_BASE     0x%08x\n", emem[i].ephy_base);
+		printf("EMEM_SIZE         0x%08x\n", emem[i].size);
+		printf("EMEM_TYPE         %s\n", type[emem[i].type & 3]);
+	}
+
+	return;
+}
+
+
+void usage()
+{
+	printf("Usage: e-hdf-compile [-p] <hdf> [<output>]\n");
+	printf("   hdf          - text HDF, XML HDF or compiled description\n");
+	printf("   output       - compiled description to write\n");
+	printf("   -p           - print the description in the text HDF format\n");
+
+	return;
+}
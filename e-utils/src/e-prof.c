@@ -0,0 +1,285 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 Adapteva, Inc
+
+Contributed by Yaniv Sapir <support@adapteva.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// e-prof: collect the region profiling tables published by the e-lib
+// e_prof_* functions and aggregate them across all cores. The table is
+// read with the per-entry sequence counts, so the cores keep running.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "e-hal.h"
+
+// NOTE: These types must match the ones in the e-lib e_prof.h
+#define E_PROF_SHM_NAME     "e_prof_table"
+#define E_PROF_MAGIC        0xe9f0f001
+#define E_PROF_MAX_REGIONS  16
+#define E_PROF_NAME_LEN     16
+
+typedef struct ALIGN(8) {
+	char              name[E_PROF_NAME_LEN];
+	volatile uint32_t seq;
+	uint32_t          count;
+	uint64_t          cycles;
+	uint64_t          events;
+} e_prof_entry_t;
+
+typedef struct ALIGN(8) {
+	uint32_t          coreid;
+	uint32_t          event;
+	e_prof_entry_t    region[E_PROF_MAX_REGIONS];
+} e_prof_core_t;
+
+typedef struct ALIGN(8) {
+	uint32_t          magic;
+	uint32_t          num_cores;
+	e_prof_core_t     core[];
+} e_prof_table_t;
+
+typedef struct {
+	char               name[E_PROF_NAME_LEN];
+	unsigned           cores;
+	unsigned long long count;
+	unsigned long long cycles;
+	unsigned long long events;
+	unsigned long long max_cycles;
+	unsigned           max_coreid;
+} prof_total_t;
+
+void usage();
+int  prof_alloc(unsigned num_cores);
+void prof_show(e_prof_table_t *table);
+int  prof_read_entry(e_prof_entry_t *dst, e_prof_entry_t *src);
+
+typedef struct {
+	e_bool_t verbose;
+} prtopt_t;
+
+prtopt_t prtopt = {E_FALSE};
+
+static const char *event_names[16] = {
+	"off", "clk", "idle", "?", "ialu", "fpu", "dual", "e1-stall",
+	"ra-stall", "?", "?", "?", "xfetch-stall", "xload-stall", "?", "?"
+};
+
+int main(int argc, char *argv[])
+{
+	e_mem_t         mbuf;
+	unsigned        num_cores = 0, interval = 0;
+	e_bool_t        release = E_FALSE;
+	int             opt;
+
+	while ((opt = getopt(argc, argv, "a:di:vh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a':
+			num_cores = atoi(optarg);
+			break;
+		case 'd':
+			release = E_TRUE;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'v':
+			prtopt.verbose = E_TRUE;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	e_set_host_verbosity(H_D0);
+	if (E_OK != e_init(NULL))
+	{
+		fprintf(stderr, "e-prof: failed to initialize the platform.\n");
+		exit(1);
+	}
+
+	if (num_cores)
+	{
+		opt = prof_alloc(num_cores);
+		e_finalize();
+		return opt;
+	}
+
+	if (E_OK != e_shm_attach(&mbuf, E_PROF_SHM_NAME))
+	{
+		fprintf(stderr, "e-prof: no profiling table, allocate one with -a first.\n");
+		e_finalize();
+		exit(1);
+	}
+
+	if (release)
+	{
+		// Drop our own reference and the one taken by "e-prof -a"
+		e_shm_release(E_PROF_SHM_NAME);
+		e_shm_release(E_PROF_SHM_NAME);
+		e_finalize();
+		return 0;
+	}
+
+	do {
+		prof_show((e_prof_table_t *) mbuf.base);
+		if (interval)
+		{
+			printf("\n");
+			fflush(stdout);
+			sleep(interval);
+		}
+	} while (interval);
+
+	e_shm_release(E_PROF_SHM_NAME);
+	e_finalize();
+
+	return 0;
+}
+
+
+int prof_alloc(unsigned num_cores)
+{
+	e_mem_t         mbuf;
+	e_prof_table_t *table;
+	size_t          size;
+
+	size = sizeof(e_prof_table_t) + num_cores * sizeof(e_prof_core_t);
+	if (E_OK != e_shm_alloc(&mbuf, E_PROF_SHM_NAME, size))
+	{
+		fprintf(stderr, "e-prof: failed to allocate a table for %u cores.\n", num_cores);
+		return 1;
+	}
+
+	table = (e_prof_table_t *) mbuf.base;
+	memset(table, 0, size);
+	table->num_cores = num_cores;
+	table->magic     = E_PROF_MAGIC;
+
+	if (prtopt.verbose) printf("Allocated profiling table for %u cores (%u bytes).\n",
+			num_cores, (unsigned) size);
+
+	return 0;
+}
+
+
+// Copy one entry, retrying while the core is in the middle of an update
+int prof_read_entry(e_prof_entry_t *dst, e_prof_entry_t *src)
+{
+	unsigned seq, tries;
+
+	for (tries = 0; tries < 1000; tries++)
+	{
+		seq = src->seq;
+		if (seq & 1)
+			continue;
+		__sync_synchronize();
+		memcpy(dst, src, sizeof(*dst));
+		__sync_synchronize();
+		if (src->seq == seq)
+			return E_OK;
+	}
+
+	return E_ERR;
+}
+
+
+void prof_show(e_prof_table_t *table)
+{
+	prof_total_t   total[E_PROF_MAX_REGIONS];
+	e_prof_entry_t entry;
+	e_prof_core_t *core;
+	unsigned       i, r, event = 0;
+
+	if (table->magic != E_PROF_MAGIC)
+	{
+		fprintf(stderr, "e-prof: profiling table is corrupted.\n");
+		return;
+	}
+
+	memset(total, 0, sizeof(total));
+
+	for (i = 0; i < table->num_cores; i++)
+	{
+		core = &table->core[i];
+		if (!core->coreid)
+			continue;
+		event = core->event & 0xf;
+
+		for (r = 0; r < E_PROF_MAX_REGIONS; r++)
+		{
+			if (E_OK != prof_read_entry(&entry, &core->region[r]) || !entry.count)
+				continue;
+
+			if (prtopt.verbose)
+				printf("core 0x%03x  region %2u  %-15.15s  calls %10u  cycles %14llu  %s %14llu\n",
+						core->coreid, r, entry.name, entry.count,
+						(unsigned long long) entry.cycles, event_names[event],
+						(unsigned long long) entry.events);
+
+			if (!total[r].name[0])
+				memcpy(total[r].name, entry.name, E_PROF_NAME_LEN);
+			total[r].cores++;
+			total[r].count  += entry.count;
+			total[r].cycles += entry.cycles;
+			total[r].events += entry.events;
+			if (entry.cycles > total[r].max_cycles)
+			{
+				total[r].max_cycles = entry.cycles;
+				total[r].max_coreid = core->coreid;
+			}
+		}
+	}
+
+	printf("%-6s %-15s %5s %12s %16s %12s %16s %10s %16s\n", "region", "name", "cores",
+			"calls", "cycles", "cycles/call", "max-core-cycles", "max-core", event_names[event]);
+	for (r = 0; r < E_PROF_MAX_REGIONS; r++)
+	{
+		if (!total[r].count)
+			continue;
+		printf("%-6u %-15.15s %5u %12llu %16llu %12llu %16llu %#10x %16llu\n", r,
+				total[r].name[0] ? total[r].name : "-", total[r].cores, total[r].count,
+				total[r].cycles, total[r].cycles / total[r].count, total[r].max_cycles,
+				total[r].max_coreid, total[r].events);
+	}
+}
+
+
+void usage()
+{
+	printf("Usage: e-prof [-v] [-a <num-cores>] [-d] [-i <seconds>]\n");
+	printf("   -a num-cores   - allocate the shared profiling table for a workgroup of\n");
+	printf("                    num-cores cores and exit. Do this before loading the program.\n");
+	printf("   -d             - release the profiling table and exit.\n");
+	printf("   -i seconds     - keep printing the aggregated table every few seconds.\n");
+	printf("   -v             - verbose mode. Also print the per-core results.\n");
+	printf("   With no -a or -d, print the table aggregated over all cores once.\n");
+
+	return;
+}
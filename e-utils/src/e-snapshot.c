@@ -0,0 +1,362 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014 Adapteva, Inc
+
+Contributed by Yaniv Sapir <support@adapteva.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// e-snapshot: capture the registers, DMA state and local memory of all
+// cores into a compact snapshot file, show it offline or compare two of
+// them. The cores are read in parallel and are not halted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "e-hal.h"
+
+typedef struct {
+	e_bool_t verbose;
+	e_bool_t scr_only;    // show: no general purpose registers
+	e_bool_t memory;      // show: dump the non-zero local memory
+	unsigned threads;
+	size_t   size;        // bytes of local memory per core, 0 for all
+	unsigned count;       // number of snapshots to take
+	unsigned interval;    // msec between snapshots
+} prtopt_t;
+
+prtopt_t prtopt = {E_FALSE, E_FALSE, E_FALSE, 0, 0, 1, 1000};
+
+void usage();
+static int do_capture(int argc, char *argv[]);
+static int do_show(int argc, char *argv[]);
+static int do_diff(int argc, char *argv[]);
+
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vsmj:n:c:i:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v':
+			prtopt.verbose = E_TRUE;
+			break;
+		case 's':
+			prtopt.scr_only = E_TRUE;
+			break;
+		case 'm':
+			prtopt.memory = E_TRUE;
+			break;
+		case 'j':
+			prtopt.threads = atoi(optarg);
+			break;
+		case 'n':
+			prtopt.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			prtopt.count = atoi(optarg);
+			break;
+		case 'i':
+			prtopt.interval = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (argc - optind < 2)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (!strcmp(argv[optind], "capture"))
+		return do_capture(argc - optind - 1, &argv[optind + 1]);
+	if (!strcmp(argv[optind], "show"))
+		return do_show(argc - optind - 1, &argv[optind + 1]);
+	if (!strcmp(argv[optind], "diff"))
+		return do_diff(argc - optind - 1, &argv[optind + 1]);
+
+	usage();
+	exit(1);
+}
+
+
+// capture <file> [<row> <col> <rows> <cols>]
+static int do_capture(int argc, char *argv[])
+{
+	e_epiphany_t dev;
+	e_platform_t plat;
+	e_snapshot_t snap;
+	char         fname[1024];
+	int          row = 0, col = 0, rows, cols, errors = 0;
+	unsigned     n;
+
+	if (argc != 1 && argc != 5)
+	{
+		usage();
+		exit(1);
+	}
+
+	e_set_host_verbosity(H_D0);
+	if (E_OK != e_init(NULL))
+	{
+		fprintf(stderr, "e-snapshot: failed to initialize the Epiphany platform\n");
+		exit(1);
+	}
+	e_get_platform_info(&plat);
+
+	rows = plat.rows;
+	cols = plat.cols;
+	if (argc == 5)
+	{
+		row  = atoi(argv[1]);
+		col  = atoi(argv[2]);
+		rows = atoi(argv[3]);
+		cols = atoi(argv[4]);
+	}
+
+	if ((row < 0) || (col < 0) || (rows < 1) || (cols < 1) ||
+		((unsigned) row >= plat.rows) || ((unsigned) rows > plat.rows - row) ||
+		((unsigned) col >= plat.cols) || ((unsigned) cols > plat.cols - col))
+	{
+		fprintf(stderr, "e-snapshot: core coordinates exceed platform boundaries!\n");
+		e_finalize();
+		exit(1);
+	}
+
+	if (E_OK != e_open(&dev, row, col, rows, cols))
+	{
+		e_finalize();
+		exit(1);
+	}
+
+	for (n = 0; n < prtopt.count; n++)
+	{
+		if (n)
+			usleep(prtopt.interval * 1000);
+
+		// Number the files when taking a series of snapshots
+		if (prtopt.count > 1)
+			snprintf(fname, sizeof(fname), "%s.%u", argv[0], n);
+		else
+			snprintf(fname, sizeof(fname), "%s", argv[0]);
+
+		if (E_OK != e_snapshot_capture(&dev, &snap, prtopt.size, prtopt.threads))
+		{
+			fprintf(stderr, "e-snapshot: capture failed\n");
+			errors++;
+			break;
+		}
+
+		if (E_OK != e_snapshot_save(&snap, fname))
+			errors++;
+		else if (prtopt.verbose)
+			printf("Captured %d cores (%u bytes of local memory each) in %u usec to %s.\n",
+				   rows * cols, snap.sram_size, snap.capture_us, fname);
+
+		e_snapshot_free(&snap);
+	}
+
+	e_close(&dev);
+	e_finalize();
+
+	return errors ? 1 : 0;
+}
+
+
+static void show_core(e_snapshot_t *snap, e_core_snapshot_t *core)
+{
+	unsigned i, j;
+
+	printf("core (%u,%u) id 0x%03x\n", snap->row + core->row, snap->col + core->col, core->id);
+
+	if (!prtopt.scr_only)
+		for (i = 0; i < E_SNAPSHOT_NUM_GPRS; i++)
+			printf("  r%-2u%9s\t0x%08x\n", i, " ", core->gpr[i]);
+
+	for (i = 0; i < E_SNAPSHOT_NUM_SCRS; i++)
+		printf("  %-12s\t0x%08x\n", e_snapshot_scr_name(i), core->scr[i]);
+
+	if (!prtopt.memory)
+		return;
+
+	// Lines of 16 bytes, skipping the ones that are all zero
+	for (i = 0; i + 16 <= snap->sram_size; i += 16)
+	{
+		for (j = 0; j < 16 && !core->sram[i + j]; j++)
+			;
+		if (j == 16)
+			continue;
+
+		printf("  [0x%05x]", i);
+		for (j = 0; j < 16; j++)
+			printf(" %02x", core->sram[i + j]);
+		printf("\n");
+	}
+}
+
+
+// show <file> [<row> <col>]
+static int do_show(int argc, char *argv[])
+{
+	e_snapshot_t snap;
+	e_core_snapshot_t *core;
+	unsigned     i;
+
+	if (argc != 1 && argc != 3)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (E_OK != e_snapshot_load(&snap, argv[0]))
+		exit(1);
+
+	printf("Snapshot of cores (%u,%u) .. (%u,%u), %u bytes of local memory per core, captured in %u usec.\n",
+		   snap.row, snap.col, snap.row + snap.rows - 1, snap.col + snap.cols - 1,
+		   snap.sram_size, snap.capture_us);
+
+	if (argc == 3)
+	{
+		core = e_snapshot_core(&snap, atoi(argv[1]) - snap.row, atoi(argv[2]) - snap.col);
+		if (!core)
+		{
+			fprintf(stderr, "e-snapshot: core (%s,%s) is not in the snapshot\n", argv[1], argv[2]);
+			e_snapshot_free(&snap);
+			exit(1);
+		}
+		show_core(&snap, core);
+	} else {
+		for (i = 0; i < snap.rows * snap.cols; i++)
+			show_core(&snap, &snap.core[i]);
+	}
+
+	e_snapshot_free(&snap);
+
+	return 0;
+}
+
+
+// Print the differing registers and local memory ranges of a core
+static unsigned diff_core(e_snapshot_t *snap, e_core_snapshot_t *a, e_core_snapshot_t *b)
+{
+	unsigned i, start, ndiff = 0;
+	unsigned r = snap->row + a->row, c = snap->col + a->col;
+
+	for (i = 0; i < E_SNAPSHOT_NUM_GPRS; i++)
+		if (a->gpr[i] != b->gpr[i])
+		{
+			printf("core (%u,%u) r%-2u%9s\t0x%08x -> 0x%08x\n", r, c, i, " ", a->gpr[i], b->gpr[i]);
+			ndiff++;
+		}
+
+	for (i = 0; i < E_SNAPSHOT_NUM_SCRS; i++)
+		if (a->scr[i] != b->scr[i])
+		{
+			printf("core (%u,%u) %-12s\t0x%08x -> 0x%08x\n", r, c, e_snapshot_scr_name(i), a->scr[i], b->scr[i]);
+			ndiff++;
+		}
+
+	for (i = 0; i < snap->sram_size; )
+	{
+		if (a->sram[i] == b->sram[i])
+		{
+			i++;
+			continue;
+		}
+		start = i;
+		while (i < snap->sram_size && a->sram[i] != b->sram[i])
+			i++;
+		printf("core (%u,%u) sram [0x%05x .. 0x%05x] %u bytes differ\n", r, c, start, i - 1, i - start);
+		ndiff++;
+	}
+
+	return ndiff;
+}
+
+
+// diff <a> <b>
+static int do_diff(int argc, char *argv[])
+{
+	e_snapshot_t a, b;
+	unsigned     i, ndiff = 0;
+
+	if (argc != 2)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (E_OK != e_snapshot_load(&a, argv[0]))
+		exit(1);
+	if (E_OK != e_snapshot_load(&b, argv[1]))
+	{
+		e_snapshot_free(&a);
+		exit(1);
+	}
+
+	if (a.row != b.row || a.col != b.col || a.rows != b.rows || a.cols != b.cols || a.sram_size != b.sram_size)
+	{
+		fprintf(stderr, "e-snapshot: the snapshots do not cover the same cores and memory\n");
+		e_snapshot_free(&a);
+		e_snapshot_free(&b);
+		exit(1);
+	}
+
+	for (i = 0; i < a.rows * a.cols; i++)
+		ndiff += diff_core(&a, &a.core[i], &b.core[i]);
+
+	if (prtopt.verbose)
+		printf("%u differences, %.3f msec between the snapshots.\n",
+			   ndiff, (double) (int64_t) (b.timestamp - a.timestamp) / 1000.0);
+
+	e_snapshot_free(&a);
+	e_snapshot_free(&b);
+
+	return ndiff ? 2 : 0;
+}
+
+
+void usage()
+{
+	printf("Usage: e-snapshot [-v] [-j threads] [-n bytes] [-c count] [-i msec] capture <file> [<row> <col> <rows> <cols>]\n");
+	printf("       e-snapshot [-s] [-m] show <file> [<row> <col>]\n");
+	printf("       e-snapshot [-v] diff <file a> <file b>\n");
+	printf("   capture      - save the state of the cores, all cores if no group is given\n");
+	printf("   show         - print the registers of the cores in a snapshot\n");
+	printf("   diff         - print the registers and memory ranges that changed from a to b\n");
+	printf("   -v           - verbose mode\n");
+	printf("   -j threads   - number of capture threads, default one per core\n");
+	printf("   -n bytes     - local memory to save per core, default all of it\n");
+	printf("   -c count     - take count snapshots to <file>.0, <file>.1, ...\n");
+	printf("   -i msec      - interval between snapshots, default 1000\n");
+	printf("   -s           - show only the special core registers\n");
+	printf("   -m           - show the non-zero local memory as well\n");
+
+	return;
+}